@@ -0,0 +1,84 @@
+//
+//  BitSetWideTests.mm
+//
+// Hierarchical bitset with a bit for each bucket of a digit wider than 8 bits.
+
+#import <XCTest/XCTest.h>
+
+#include <random>
+#include <set>
+
+#include "bit_set_wide.hpp"
+
+@interface BitSetWideTests : XCTestCase
+
+@end
+
+@implementation BitSetWideTests
+
+- (void)testBitsetWideBasics {
+  bitsetWide_t bits;
+  bitsetWideInit(bits, 1 << 16);
+
+  XCTAssert(bitsetWideIsAllOff(bits));
+
+  bitsetWideSetBit(bits, 65535);
+  XCTAssert(bitsetWideFindFirstSetOpt(bits) == 65535);
+
+  bitsetWideSetBit(bits, 4096);
+  bitsetWideSetBit(bits, 64);
+  XCTAssert(bitsetWideFindFirstSetOpt(bits) == 64);
+  XCTAssert(bitsetWidePopCount(bits) == 3);
+
+  bitsetWideClearBit(bits, 64);
+  XCTAssert(bitsetWideFindFirstSetOpt(bits) == 4096);
+  XCTAssert(bitsetWideGetBit(bits, 4096));
+  XCTAssert(!bitsetWideGetBit(bits, 64));
+
+  bitsetWideClearBit(bits, 4096);
+  XCTAssert(bitsetWideFindFirstSetOpt(bits) == 65535);
+
+  bitsetWideClearBit(bits, 65535);
+  XCTAssert(bitsetWideIsAllOff(bits));
+}
+
+- (void)testBitsetWideClearUnsetBit {
+  // Clearing a bit that is not set leaves the other bits in the same word findable
+  bitsetWide_t bits;
+  bitsetWideInit(bits, 2048);
+
+  bitsetWideSetBit(bits, 1000);
+  bitsetWideClearBit(bits, 1001);
+  bitsetWideClearBit(bits, 2000);
+
+  XCTAssert(!bitsetWideIsAllOff(bits));
+  XCTAssert(bitsetWideFindFirstSetOpt(bits) == 1000);
+}
+
+- (void)testBitsetWideRandom {
+  // Walk the set bits in order and compare with std::set
+  constexpr unsigned int numBits = bitsetWideMaxBits;
+
+  bitsetWide_t bits;
+  bitsetWideInit(bits, numBits);
+
+  std::mt19937 generator(numBits);
+  std::set<unsigned int> expected;
+
+  for (unsigned int i = 0; i < 10000; i++) {
+    unsigned int bucket = generator() % numBits;
+    bitsetWideSetBit(bits, bucket);
+    expected.insert(bucket);
+  }
+
+  XCTAssert(bitsetWidePopCount(bits) == expected.size());
+
+  for (unsigned int bucket : expected) {
+    XCTAssert(bitsetWideFindFirstSetOpt(bits) == bucket);
+    bitsetWideClearBit(bits, bucket);
+  }
+
+  XCTAssert(bitsetWideIsAllOff(bits));
+}
+
+@end
@@ -0,0 +1,269 @@
+//
+//  ExternalSortTests.mm
+//
+// External sort tests, a small memory budget forces the input through spill
+// files and the output must match std::sort of the input records.
+
+#import <XCTest/XCTest.h>
+
+#include <random>
+#include <cstdio>
+#include <string>
+#include <thread>
+
+#include "in_place_sort_external.hpp"
+
+@interface ExternalSortTests : XCTestCase
+
+@end
+
+@implementation ExternalSortTests
+
+- (void)testExternalSortInMemory {
+  NSString *tmpDir = NSTemporaryDirectory();
+  const std::string spillDir([tmpDir UTF8String]);
+  const std::string inPath = spillDir + "/ExternalSortTestsIn.bin";
+  const std::string outPath = spillDir + "/ExternalSortTestsOut.bin";
+
+  const size_t N = 100000;
+  std::vector<uint32_t> records(N);
+  std::mt19937 generator(1);
+  for (auto & v : records) {
+    v = (uint32_t) generator();
+  }
+
+  FILE *fp = fopen(inPath.c_str(), "wb");
+  fwrite(records.data(), sizeof(uint32_t), N, fp);
+  fclose(fp);
+
+  bool worked = countingSortExternalOpt<uint32_t>(inPath.c_str(), outPath.c_str(), spillDir.c_str(), 1 << 24);
+
+  std::vector<uint32_t> sorted(N + 1);
+  fp = fopen(outPath.c_str(), "rb");
+  size_t numRead = (fp != nullptr) ? fread(sorted.data(), sizeof(uint32_t), N + 1, fp) : 0;
+  if (fp != nullptr) {
+    fclose(fp);
+  }
+  sorted.resize(numRead);
+
+  remove(inPath.c_str());
+  remove(outPath.c_str());
+
+  std::sort(begin(records), end(records));
+
+  XCTAssert(worked);
+  XCTAssert(sorted == records);
+}
+
+- (void)testExternalSortSpill {
+  // 16 MB of records with 4 MB of sort buffers
+  NSString *tmpDir = NSTemporaryDirectory();
+  const std::string spillDir([tmpDir UTF8String]);
+  const std::string inPath = spillDir + "/ExternalSortTestsIn.bin";
+  const std::string outPath = spillDir + "/ExternalSortTestsOut.bin";
+
+  const size_t N = 1 << 22;
+  std::vector<uint32_t> records(N);
+  std::mt19937 generator(2);
+  for (auto & v : records) {
+    v = (uint32_t) generator();
+  }
+
+  FILE *fp = fopen(inPath.c_str(), "wb");
+  fwrite(records.data(), sizeof(uint32_t), N, fp);
+  fclose(fp);
+
+  bool worked = countingSortExternalOpt<uint32_t>(inPath.c_str(), outPath.c_str(), spillDir.c_str(), 1 << 22);
+
+  std::vector<uint32_t> sorted(N + 1);
+  fp = fopen(outPath.c_str(), "rb");
+  size_t numRead = (fp != nullptr) ? fread(sorted.data(), sizeof(uint32_t), N + 1, fp) : 0;
+  if (fp != nullptr) {
+    fclose(fp);
+  }
+  sorted.resize(numRead);
+
+  remove(inPath.c_str());
+  remove(outPath.c_str());
+
+  std::sort(begin(records), end(records));
+
+  XCTAssert(worked);
+  XCTAssert(sorted == records);
+}
+
+- (void)testExternalSortSkewedSpill {
+  // Most values share the top digit, so that spill file is partitioned again
+  NSString *tmpDir = NSTemporaryDirectory();
+  const std::string spillDir([tmpDir UTF8String]);
+  const std::string inPath = spillDir + "/ExternalSortTestsIn.bin";
+  const std::string outPath = spillDir + "/ExternalSortTestsOut.bin";
+
+  const size_t N = 1 << 21;
+  std::vector<uint32_t> records(N);
+  std::mt19937 generator(3);
+  for (auto & v : records) {
+    v = (uint32_t) generator();
+    if ((v & 0x3) != 0) {
+      v &= 0x00FFFFFF;
+    }
+  }
+
+  FILE *fp = fopen(inPath.c_str(), "wb");
+  fwrite(records.data(), sizeof(uint32_t), N, fp);
+  fclose(fp);
+
+  bool worked = countingSortExternalOpt<uint32_t>(inPath.c_str(), outPath.c_str(), spillDir.c_str(), 1 << 20);
+
+  std::vector<uint32_t> sorted(N + 1);
+  fp = fopen(outPath.c_str(), "rb");
+  size_t numRead = (fp != nullptr) ? fread(sorted.data(), sizeof(uint32_t), N + 1, fp) : 0;
+  if (fp != nullptr) {
+    fclose(fp);
+  }
+  sorted.resize(numRead);
+
+  remove(inPath.c_str());
+  remove(outPath.c_str());
+
+  std::sort(begin(records), end(records));
+
+  XCTAssert(worked);
+  XCTAssert(sorted == records);
+}
+
+- (void)testExternalSortEqualValues {
+  // Every digit is partitioned and the last spill file is copied in pieces
+  NSString *tmpDir = NSTemporaryDirectory();
+  const std::string spillDir([tmpDir UTF8String]);
+  const std::string inPath = spillDir + "/ExternalSortTestsIn.bin";
+  const std::string outPath = spillDir + "/ExternalSortTestsOut.bin";
+
+  const size_t N = 1 << 18;
+  std::vector<uint32_t> records(N);
+  std::mt19937 generator(4);
+  for (auto & v : records) {
+    v = ((generator() & 0xF) == 0) ? (uint32_t) generator() : (uint32_t) 42;
+  }
+
+  FILE *fp = fopen(inPath.c_str(), "wb");
+  fwrite(records.data(), sizeof(uint32_t), N, fp);
+  fclose(fp);
+
+  bool worked = countingSortExternalOpt<uint32_t>(inPath.c_str(), outPath.c_str(), spillDir.c_str(), 1 << 12);
+
+  std::vector<uint32_t> sorted(N + 1);
+  fp = fopen(outPath.c_str(), "rb");
+  size_t numRead = (fp != nullptr) ? fread(sorted.data(), sizeof(uint32_t), N + 1, fp) : 0;
+  if (fp != nullptr) {
+    fclose(fp);
+  }
+  sorted.resize(numRead);
+
+  remove(inPath.c_str());
+  remove(outPath.c_str());
+
+  std::sort(begin(records), end(records));
+
+  XCTAssert(worked);
+  XCTAssert(sorted == records);
+}
+
+- (void)testExternalSort64 {
+  NSString *tmpDir = NSTemporaryDirectory();
+  const std::string spillDir([tmpDir UTF8String]);
+  const std::string inPath = spillDir + "/ExternalSortTestsIn.bin";
+  const std::string outPath = spillDir + "/ExternalSortTestsOut.bin";
+
+  const size_t N = 1 << 20;
+  std::vector<uint64_t> records(N);
+  std::mt19937_64 generator(5);
+  for (auto & v : records) {
+    v = (uint64_t) generator();
+  }
+
+  FILE *fp = fopen(inPath.c_str(), "wb");
+  fwrite(records.data(), sizeof(uint64_t), N, fp);
+  fclose(fp);
+
+  bool worked = countingSortExternalOpt<uint64_t>(inPath.c_str(), outPath.c_str(), spillDir.c_str(), 1 << 21);
+
+  std::vector<uint64_t> sorted(N + 1);
+  fp = fopen(outPath.c_str(), "rb");
+  size_t numRead = (fp != nullptr) ? fread(sorted.data(), sizeof(uint64_t), N + 1, fp) : 0;
+  if (fp != nullptr) {
+    fclose(fp);
+  }
+  sorted.resize(numRead);
+
+  remove(inPath.c_str());
+  remove(outPath.c_str());
+
+  std::sort(begin(records), end(records));
+
+  XCTAssert(worked);
+  XCTAssert(sorted == records);
+}
+
+- (void)testExternalSortMissingInput {
+  bool worked = countingSortExternalOpt<uint32_t>("/nonexistent/in.bin", "/nonexistent/out.bin", "/nonexistent", 1 << 20);
+  XCTAssert(!worked);
+  XCTAssert(errno == ENOENT);
+}
+
+- (void)testExternalSortConcurrent {
+  // Two sorts in one process share spillDir, each call uses its own spill files
+  NSString *tmpDir = NSTemporaryDirectory();
+  const std::string spillDir([tmpDir UTF8String]);
+
+  const size_t N = 1 << 20;
+  std::vector<uint32_t> records[2];
+  bool worked[2] = { false, false };
+
+  std::mt19937 generator(6);
+  for (int sorti = 0; sorti < 2; sorti++) {
+    records[sorti].resize(N);
+    for (auto & v : records[sorti]) {
+      v = (uint32_t) generator();
+    }
+    const std::string inPath = spillDir + "/ExternalSortTestsConcurrentIn" + std::to_string(sorti) + ".bin";
+    FILE *fp = fopen(inPath.c_str(), "wb");
+    fwrite(records[sorti].data(), sizeof(uint32_t), N, fp);
+    fclose(fp);
+  }
+
+  std::vector<std::thread> threads;
+  for (int sorti = 0; sorti < 2; sorti++) {
+    threads.emplace_back([&, sorti]() {
+      const std::string inPath = spillDir + "/ExternalSortTestsConcurrentIn" + std::to_string(sorti) + ".bin";
+      const std::string outPath = spillDir + "/ExternalSortTestsConcurrentOut" + std::to_string(sorti) + ".bin";
+      worked[sorti] = countingSortExternalOpt<uint32_t>(inPath.c_str(), outPath.c_str(), spillDir.c_str(), 1 << 20);
+    });
+  }
+  for (auto & thread : threads) {
+    thread.join();
+  }
+
+  for (int sorti = 0; sorti < 2; sorti++) {
+    const std::string inPath = spillDir + "/ExternalSortTestsConcurrentIn" + std::to_string(sorti) + ".bin";
+    const std::string outPath = spillDir + "/ExternalSortTestsConcurrentOut" + std::to_string(sorti) + ".bin";
+
+    std::vector<uint32_t> sorted(N);
+    FILE *fp = fopen(outPath.c_str(), "rb");
+    size_t numRead = (fp != nullptr) ? fread(sorted.data(), sizeof(uint32_t), N, fp) : 0;
+    if (fp != nullptr) {
+      fclose(fp);
+    }
+
+    remove(inPath.c_str());
+    remove(outPath.c_str());
+
+    std::sort(begin(records[sorti]), end(records[sorti]));
+
+    XCTAssert(worked[sorti]);
+    XCTAssert(numRead == N);
+    XCTAssert(sorted == records[sorti]);
+  }
+}
+
+@end
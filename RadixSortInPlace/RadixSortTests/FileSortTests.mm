@@ -0,0 +1,207 @@
+//
+//  FileSortTests.mm
+//
+// Memory mapped file sort tests, the sorted file must match std::sort of the
+// records that were written.
+
+#import <XCTest/XCTest.h>
+
+#include <random>
+#include <cstdio>
+#include <string>
+
+#include "in_place_sort_file.hpp"
+
+@interface FileSortTests : XCTestCase
+
+@end
+
+@implementation FileSortTests
+
+- (void)testFileSortEmpty {
+  NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"FileSortTests.bin"];
+  const std::string filePath([path UTF8String]);
+
+  const size_t N = 0;
+  std::vector<uint32_t> records(N);
+  std::mt19937 generator(N);
+  for (auto & v : records) {
+    v = (uint32_t) generator();
+  }
+
+  FILE *fp = fopen(filePath.c_str(), "wb");
+  fwrite(records.data(), sizeof(uint32_t), N, fp);
+  fclose(fp);
+
+  bool worked = countingSortFileOpt<uint32_t>(filePath.c_str());
+
+  std::vector<uint32_t> sorted(N + 1);
+  fp = fopen(filePath.c_str(), "rb");
+  size_t numRead = fread(sorted.data(), sizeof(uint32_t), N + 1, fp);
+  fclose(fp);
+  sorted.resize(numRead);
+
+  remove(filePath.c_str());
+
+  std::sort(begin(records), end(records));
+
+  XCTAssert(worked);
+  XCTAssert(sorted == records);
+}
+
+- (void)testFileSortOne {
+  NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"FileSortTests.bin"];
+  const std::string filePath([path UTF8String]);
+
+  const size_t N = 1;
+  std::vector<uint32_t> records(N);
+  std::mt19937 generator(N);
+  for (auto & v : records) {
+    v = (uint32_t) generator();
+  }
+
+  FILE *fp = fopen(filePath.c_str(), "wb");
+  fwrite(records.data(), sizeof(uint32_t), N, fp);
+  fclose(fp);
+
+  bool worked = countingSortFileOpt<uint32_t>(filePath.c_str());
+
+  std::vector<uint32_t> sorted(N + 1);
+  fp = fopen(filePath.c_str(), "rb");
+  size_t numRead = fread(sorted.data(), sizeof(uint32_t), N + 1, fp);
+  fclose(fp);
+  sorted.resize(numRead);
+
+  remove(filePath.c_str());
+
+  std::sort(begin(records), end(records));
+
+  XCTAssert(worked);
+  XCTAssert(sorted == records);
+}
+
+- (void)testFileSortSmall {
+  NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"FileSortTests.bin"];
+  const std::string filePath([path UTF8String]);
+
+  const size_t N = 1000;
+  std::vector<uint32_t> records(N);
+  std::mt19937 generator(N);
+  for (auto & v : records) {
+    v = (uint32_t) generator();
+  }
+
+  FILE *fp = fopen(filePath.c_str(), "wb");
+  fwrite(records.data(), sizeof(uint32_t), N, fp);
+  fclose(fp);
+
+  bool worked = countingSortFileOpt<uint32_t>(filePath.c_str());
+
+  std::vector<uint32_t> sorted(N + 1);
+  fp = fopen(filePath.c_str(), "rb");
+  size_t numRead = fread(sorted.data(), sizeof(uint32_t), N + 1, fp);
+  fclose(fp);
+  sorted.resize(numRead);
+
+  remove(filePath.c_str());
+
+  std::sort(begin(records), end(records));
+
+  XCTAssert(worked);
+  XCTAssert(sorted == records);
+}
+
+- (void)testFileSortLarge {
+  NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"FileSortTests.bin"];
+  const std::string filePath([path UTF8String]);
+
+  const size_t N = 1 << 22;
+  std::vector<uint32_t> records(N);
+  std::mt19937 generator(N);
+  for (auto & v : records) {
+    v = (uint32_t) generator();
+  }
+
+  FILE *fp = fopen(filePath.c_str(), "wb");
+  fwrite(records.data(), sizeof(uint32_t), N, fp);
+  fclose(fp);
+
+  bool worked = countingSortFileOpt<uint32_t>(filePath.c_str());
+
+  std::vector<uint32_t> sorted(N + 1);
+  fp = fopen(filePath.c_str(), "rb");
+  size_t numRead = fread(sorted.data(), sizeof(uint32_t), N + 1, fp);
+  fclose(fp);
+  sorted.resize(numRead);
+
+  remove(filePath.c_str());
+
+  std::sort(begin(records), end(records));
+
+  XCTAssert(worked);
+  XCTAssert(sorted == records);
+}
+
+- (void)testFileSort64 {
+  NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"FileSortTests.bin"];
+  const std::string filePath([path UTF8String]);
+
+  const size_t N = 1 << 20;
+  std::vector<uint64_t> records(N);
+  std::mt19937_64 generator(N);
+  for (auto & v : records) {
+    v = (uint64_t) generator();
+  }
+
+  FILE *fp = fopen(filePath.c_str(), "wb");
+  fwrite(records.data(), sizeof(uint64_t), N, fp);
+  fclose(fp);
+
+  bool worked = countingSortFileOpt<uint64_t>(filePath.c_str());
+
+  std::vector<uint64_t> sorted(N + 1);
+  fp = fopen(filePath.c_str(), "rb");
+  size_t numRead = fread(sorted.data(), sizeof(uint64_t), N + 1, fp);
+  fclose(fp);
+  sorted.resize(numRead);
+
+  remove(filePath.c_str());
+
+  std::sort(begin(records), end(records));
+
+  XCTAssert(worked);
+  XCTAssert(sorted == records);
+}
+
+- (void)testFileSortPartialRecord {
+  // 3 bytes is not a whole uint32_t record, the file must not be changed
+  NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"FileSortTests.bin"];
+  const std::string filePath([path UTF8String]);
+
+  const uint8_t bytes[3] = { 3, 2, 1 };
+  FILE *fp = fopen(filePath.c_str(), "wb");
+  fwrite(bytes, 1, sizeof(bytes), fp);
+  fclose(fp);
+
+  bool worked = countingSortFileOpt<uint32_t>(filePath.c_str());
+  XCTAssert(!worked);
+  XCTAssert(errno == EINVAL);
+
+  uint8_t readBytes[4] = { 0, 0, 0, 0 };
+  fp = fopen(filePath.c_str(), "rb");
+  size_t numRead = fread(readBytes, 1, sizeof(readBytes), fp);
+  fclose(fp);
+
+  remove(filePath.c_str());
+
+  XCTAssert(numRead == 3);
+  XCTAssert(readBytes[0] == 3 && readBytes[1] == 2 && readBytes[2] == 1);
+}
+
+- (void)testFileSortMissingFile {
+  bool worked = countingSortFileOpt<uint32_t>("/nonexistent/FileSortTests.bin");
+  XCTAssert(!worked);
+  XCTAssert(errno == ENOENT);
+}
+
+@end
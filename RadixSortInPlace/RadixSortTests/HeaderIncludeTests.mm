@@ -0,0 +1,43 @@
+//
+//  HeaderIncludeTests.mm
+//
+// The public headers share in_place_sort_opt.hpp, so any combination of them must
+// compile in one translation unit.
+
+#import <XCTest/XCTest.h>
+
+#include "in_place_sort_file.hpp"
+#include "in_place_sort_external.hpp"
+#include "in_place_sort_incremental.hpp"
+#include "in_place_sort_parallel.hpp"
+
+@interface HeaderIncludeTests : XCTestCase
+
+@end
+
+@implementation HeaderIncludeTests
+
+- (void)testFileAndExternalHeaders {
+  std::vector<uint32_t> inWords = { 3, 1, 2 };
+  countingSortInPlaceOpt<3>(inWords.data(), 0, (unsigned int) inWords.size());
+  std::vector<uint32_t> expected = { 1, 2, 3 };
+  XCTAssert(inWords == expected);
+}
+
+- (void)testIncrementalAndParallelHeaders {
+  IncrementalSorter<uint32_t> sorter;
+  {
+    IncrementalSorter<uint32_t>::Producer producer(sorter);
+    const uint32_t keys[] = { 3, 1, 2 };
+    producer.append(keys, 3);
+  }
+  std::vector<uint32_t> sorted(sorter.size());
+  sorter.finish(sorted.data());
+
+  std::vector<uint32_t> inWords = { 3, 1, 2 };
+  countingSortInPlaceOptParallel<3>(inWords.data(), 0, (unsigned int) inWords.size());
+
+  XCTAssert(sorted == inWords);
+}
+
+@end
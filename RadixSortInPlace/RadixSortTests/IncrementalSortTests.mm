@@ -0,0 +1,232 @@
+//
+//  IncrementalSortTests.mm
+//
+// Incremental sorter tests, keys appended by several producer threads must come
+// out of finish() in the same order as std::sort of all the keys.
+
+#import <XCTest/XCTest.h>
+
+#include <random>
+#include <thread>
+
+#include "in_place_sort_incremental.hpp"
+
+@interface IncrementalSortTests : XCTestCase
+
+@end
+
+@implementation IncrementalSortTests
+
+- (void)testIncrementalEmpty {
+  IncrementalSorter<uint32_t> sorter;
+
+  {
+    IncrementalSorter<uint32_t>::Producer producer(sorter);
+    producer.append(nullptr, 0);
+  }
+
+  XCTAssert(sorter.size() == 0);
+  std::vector<uint32_t> sorted(1, 42);
+  sorter.finish(sorted.data());
+  XCTAssert(sorted[0] == 42);
+}
+
+- (void)testIncrementalOneProducer {
+  // One key per append
+  const unsigned int N = 100000;
+  IncrementalSorter<uint32_t> sorter;
+
+  std::vector<uint32_t> inWords(N);
+  std::mt19937 generator(N);
+  for (auto & v : inWords) {
+    v = (uint32_t) generator();
+  }
+
+  {
+    IncrementalSorter<uint32_t>::Producer producer(sorter);
+    for (unsigned int i = 0; i < N; i++) {
+      producer.append(&inWords[i], 1);
+    }
+  }
+
+  std::vector<uint32_t> sorted(sorter.size());
+  sorter.finish(sorted.data(), 1);
+
+  std::sort(begin(inWords), end(inWords));
+  XCTAssert(sorted == inWords);
+}
+
+- (void)testIncrementalManyProducers {
+  const unsigned int numProducers = 8;
+  const size_t perProducerN = 200000;
+  IncrementalSorter<uint32_t> sorter;
+
+  std::vector<std::vector<uint32_t>> inputs(numProducers);
+  std::vector<uint32_t> expected;
+  std::mt19937 generator(1);
+  for (auto & input : inputs) {
+    input.resize(perProducerN);
+    for (auto & v : input) {
+      v = (uint32_t) generator();
+    }
+    expected.insert(end(expected), begin(input), end(input));
+  }
+  std::sort(begin(expected), end(expected));
+
+  std::vector<std::thread> threads;
+  for (unsigned int produceri = 0; produceri < numProducers; produceri++) {
+    threads.emplace_back([&, produceri]() {
+      IncrementalSorter<uint32_t>::Producer producer(sorter);
+      for (size_t i = 0; i < perProducerN; i += 1000) {
+        producer.append(inputs[produceri].data() + i, std::min<size_t>(1000, perProducerN - i));
+      }
+    });
+  }
+  for (auto & thread : threads) {
+    thread.join();
+  }
+
+  std::vector<uint32_t> sorted(sorter.size());
+  sorter.finish(sorted.data(), 0);
+
+  XCTAssert(sorted == expected);
+  XCTAssert(sorter.size() == 0);
+}
+
+- (void)testIncrementalSkewed {
+  // Only 4 top digit buckets are used
+  const unsigned int numProducers = 4;
+  const size_t perProducerN = 100000;
+  IncrementalSorter<uint32_t> sorter;
+
+  std::vector<std::vector<uint32_t>> inputs(numProducers);
+  std::vector<uint32_t> expected;
+  std::mt19937 generator(1);
+  for (auto & input : inputs) {
+    input.resize(perProducerN);
+    for (auto & v : input) {
+      v = (uint32_t) generator() & 0x0300FFFF;
+    }
+    expected.insert(end(expected), begin(input), end(input));
+  }
+  std::sort(begin(expected), end(expected));
+
+  std::vector<std::thread> threads;
+  for (unsigned int produceri = 0; produceri < numProducers; produceri++) {
+    threads.emplace_back([&, produceri]() {
+      IncrementalSorter<uint32_t>::Producer producer(sorter);
+      for (size_t i = 0; i < perProducerN; i += 777) {
+        producer.append(inputs[produceri].data() + i, std::min<size_t>(777, perProducerN - i));
+      }
+    });
+  }
+  for (auto & thread : threads) {
+    thread.join();
+  }
+
+  std::vector<uint32_t> sorted(sorter.size());
+  sorter.finish(sorted.data(), 4);
+
+  XCTAssert(sorted == expected);
+  XCTAssert(sorter.size() == 0);
+}
+
+- (void)testIncremental64 {
+  const unsigned int numProducers = 4;
+  const size_t perProducerN = 100000;
+  IncrementalSorter<uint64_t> sorter;
+
+  std::vector<std::vector<uint64_t>> inputs(numProducers);
+  std::vector<uint64_t> expected;
+  std::mt19937_64 generator(1);
+  for (auto & input : inputs) {
+    input.resize(perProducerN);
+    for (auto & v : input) {
+      v = (uint64_t) generator();
+    }
+    expected.insert(end(expected), begin(input), end(input));
+  }
+  std::sort(begin(expected), end(expected));
+
+  std::vector<std::thread> threads;
+  for (unsigned int produceri = 0; produceri < numProducers; produceri++) {
+    threads.emplace_back([&, produceri]() {
+      IncrementalSorter<uint64_t>::Producer producer(sorter);
+      for (size_t i = 0; i < perProducerN; i += 1000) {
+        producer.append(inputs[produceri].data() + i, std::min<size_t>(1000, perProducerN - i));
+      }
+    });
+  }
+  for (auto & thread : threads) {
+    thread.join();
+  }
+
+  std::vector<uint64_t> sorted(sorter.size());
+  sorter.finish(sorted.data(), 2);
+
+  XCTAssert(sorted == expected);
+  XCTAssert(sorter.size() == 0);
+}
+
+- (void)testIncrementalFloat {
+  const unsigned int numProducers = 4;
+  const size_t perProducerN = 100000;
+  IncrementalSorter<float> sorter;
+
+  std::vector<std::vector<float>> inputs(numProducers);
+  std::vector<float> expected;
+  std::mt19937 generator(1);
+  for (auto & input : inputs) {
+    input.resize(perProducerN);
+    for (auto & v : input) {
+      v = (float) ((int32_t) generator()) / 3.0f;
+    }
+    expected.insert(end(expected), begin(input), end(input));
+  }
+  std::sort(begin(expected), end(expected));
+
+  std::vector<std::thread> threads;
+  for (unsigned int produceri = 0; produceri < numProducers; produceri++) {
+    threads.emplace_back([&, produceri]() {
+      IncrementalSorter<float>::Producer producer(sorter);
+      for (size_t i = 0; i < perProducerN; i += 1000) {
+        producer.append(inputs[produceri].data() + i, std::min<size_t>(1000, perProducerN - i));
+      }
+    });
+  }
+  for (auto & thread : threads) {
+    thread.join();
+  }
+
+  std::vector<float> sorted(sorter.size());
+  sorter.finish(sorted.data(), 2);
+
+  XCTAssert(sorted == expected);
+  XCTAssert(sorter.size() == 0);
+}
+
+- (void)testIncrementalReuse {
+  // The second round takes its chunks from the free lists filled by the first
+  IncrementalSorter<uint32_t> sorter;
+  std::mt19937 generator(3);
+
+  for (int roundi = 0; roundi < 2; roundi++) {
+    std::vector<uint32_t> inWords(50000 + roundi);
+    for (auto & v : inWords) {
+      v = generator();
+    }
+
+    {
+      IncrementalSorter<uint32_t>::Producer producer(sorter);
+      producer.append(inWords.data(), inWords.size());
+    }
+
+    std::vector<uint32_t> sorted(sorter.size());
+    sorter.finish(sorted.data());
+
+    std::sort(begin(inWords), end(inWords));
+    XCTAssert(sorted == inWords);
+  }
+}
+
+@end
@@ -0,0 +1,395 @@
+//
+//  KeyValueSortTests.mm
+//
+// Key + value and argsort tests, each value must end up next to the key it
+// was paired with before the sort.
+
+#import <XCTest/XCTest.h>
+
+#include <random>
+#include <numeric>
+#include <cstddef>  // For std::ptrdiff_t
+
+#include "in_place_sort_opt.hpp"
+
+@interface KeyValueSortTests : XCTestCase
+
+@end
+
+static
+__attribute__((noinline))
+void setupRandomKeyValues(std::vector<uint32_t> & inputValues, uint32_t maxNum) {
+  const unsigned int nSrcValues = (unsigned int) inputValues.size();
+
+  std::random_device                  rand_dev;
+  std::mt19937                        generator(rand_dev());
+
+  std::uniform_int_distribution<uint32_t>  distr(0, maxNum); // even dist between buckets
+
+  for ( int i = 0 ; i < nSrcValues; i++ ) {
+    inputValues[i] = distr(generator);
+  }
+}
+
+@implementation KeyValueSortTests
+
+- (void)testKeyValueTriplesOpt {
+  std::vector<uint32_t> keys{
+    0, 2, 3, 3, 3, 2, 0, 0, 1, 1
+  };
+  std::vector<uint32_t> values{
+    100, 102, 103, 103, 103, 102, 100, 100, 101, 101
+  };
+  std::vector<uint32_t> expectedKeys{
+    0, 0, 0, 1, 1, 2, 2, 3, 3, 3
+  };
+  std::vector<uint32_t> expectedValues{
+    100, 100, 100, 101, 101, 102, 102, 103, 103, 103
+  };
+  const unsigned int N = (int) keys.size();
+
+  countingSortInPlaceOptKV<0>(keys.data(), values.data(), 0, N);
+
+  XCTAssert(keys == expectedKeys);
+  XCTAssert(values == expectedValues);
+}
+
+- (void)testArgsortSmall {
+  std::vector<uint32_t> keys{
+    2, 2, 3, 3, 0, 1, 0, 1
+  };
+  const unsigned int N = (int) keys.size();
+  std::vector<uint32_t> indices(N);
+
+  argsortInPlaceOpt<0>(keys.data(), indices.data(), N);
+
+  std::vector<uint32_t> expectedKeys{
+    0, 0, 1, 1, 2, 2, 3, 3
+  };
+  XCTAssert(keys == expectedKeys);
+
+  // Index order within a bucket of equal keys is not defined
+  std::sort(begin(indices), begin(indices) + 2);
+  std::sort(begin(indices) + 2, begin(indices) + 4);
+  std::sort(begin(indices) + 4, begin(indices) + 6);
+  std::sort(begin(indices) + 6, begin(indices) + 8);
+  std::vector<uint32_t> expectedIndices{
+    4, 6, 5, 7, 0, 1, 2, 3
+  };
+  XCTAssert(indices == expectedIndices);
+}
+
+- (void)testArgsortRandomU32 {
+  const unsigned int N = 1000000;
+  std::vector<uint32_t> keys(N);
+  setupRandomKeyValues(keys, 0xFFFFFFFF);
+
+  std::vector<uint32_t> inputKeys = keys;
+  std::vector<uint32_t> expectedKeys = keys;
+  std::sort(begin(expectedKeys), end(expectedKeys));
+
+  std::vector<uint32_t> indices(N);
+  argsortInPlaceOpt<3>(keys.data(), indices.data(), N);
+
+  XCTAssert(keys == expectedKeys);
+
+  // indices must be a permutation that maps each sorted key to its input key
+  for (unsigned int i = 0; i < N; i++) {
+    XCTAssert(indices[i] < N && inputKeys[indices[i]] == keys[i]);
+  }
+  std::sort(begin(indices), end(indices));
+  std::vector<uint32_t> expectedIndices(N);
+  std::iota(begin(expectedIndices), end(expectedIndices), 0);
+  XCTAssert(indices == expectedIndices);
+}
+
+- (void)testArgsortRandomU16 {
+  const unsigned int N = 1000000;
+  std::vector<uint32_t> keys(N);
+  setupRandomKeyValues(keys, 0xFFFF);
+
+  std::vector<uint32_t> inputKeys = keys;
+  std::vector<uint32_t> expectedKeys = keys;
+  std::sort(begin(expectedKeys), end(expectedKeys));
+
+  std::vector<uint32_t> indices(N);
+  argsortInPlaceOpt<3>(keys.data(), indices.data(), N);
+
+  XCTAssert(keys == expectedKeys);
+
+  // indices must be a permutation that maps each sorted key to its input key
+  for (unsigned int i = 0; i < N; i++) {
+    XCTAssert(indices[i] < N && inputKeys[indices[i]] == keys[i]);
+  }
+  std::sort(begin(indices), end(indices));
+  std::vector<uint32_t> expectedIndices(N);
+  std::iota(begin(expectedIndices), end(expectedIndices), 0);
+  XCTAssert(indices == expectedIndices);
+}
+
+- (void)testArgsortFewBuckets {
+  const unsigned int N = 1000000;
+  std::vector<uint32_t> keys(N);
+  setupRandomKeyValues(keys, 3);
+
+  std::vector<uint32_t> inputKeys = keys;
+  std::vector<uint32_t> expectedKeys = keys;
+  std::sort(begin(expectedKeys), end(expectedKeys));
+
+  std::vector<uint32_t> indices(N);
+  argsortInPlaceOpt<3>(keys.data(), indices.data(), N);
+
+  XCTAssert(keys == expectedKeys);
+
+  // indices must be a permutation that maps each sorted key to its input key
+  for (unsigned int i = 0; i < N; i++) {
+    XCTAssert(indices[i] < N && inputKeys[indices[i]] == keys[i]);
+  }
+  std::sort(begin(indices), end(indices));
+  std::vector<uint32_t> expectedIndices(N);
+  std::iota(begin(expectedIndices), end(expectedIndices), 0);
+  XCTAssert(indices == expectedIndices);
+}
+
+- (void)testKeyValue64BitPayload {
+  // Payload wider than the key, the pairs sort is used for small buckets
+  const unsigned int N = 100000;
+  std::vector<uint32_t> keys(N);
+  setupRandomKeyValues(keys, 0xFFFFFFFF);
+
+  std::vector<uint64_t> values(N);
+  for (unsigned int i = 0; i < N; i++) {
+    values[i] = (((uint64_t) keys[i]) << 32) | i;
+  }
+
+  countingSortInPlaceOptKV<3>(keys.data(), values.data(), 0, N);
+
+  XCTAssert(std::is_sorted(begin(keys), end(keys)));
+  for (unsigned int i = 0; i < N; i++) {
+    XCTAssert((values[i] >> 32) == keys[i]);
+  }
+}
+
+//constexpr unsigned int PERF_N = 100000000; // 100 million numbers
+
+constexpr unsigned int PERF_N =   1073741824 / 4; // (2*30)/4 is very very large (1 Gb x 2)
+
+// Argsort compared to sorting an index array with std::sort and a key comparator
+
+- (void)testArgsortPerformanceD3Opt {
+  constexpr unsigned int N = PERF_N;
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint32_t>>(N);
+  setupRandomKeyValues(*sharedRandomWords, 0xFFFFFFFF);
+
+  auto sharedKeys = std::make_shared<std::vector<uint32_t>>(N);
+  auto sharedIndices = std::make_shared<std::vector<uint32_t>>(N);
+
+  [self measureBlock:^{
+    std::vector<uint32_t> & keys = *sharedKeys;
+    std::vector<uint32_t> & indices = *sharedIndices;
+    memcpy(keys.data(), sharedRandomWords->data(), N * sizeof(uint32_t));
+
+    argsortInPlaceOpt<3>(keys.data(), indices.data(), N);
+
+#if defined(DEBUG)
+    XCTAssert(std::is_sorted(begin(keys), end(keys)));
+#endif // DEBUG
+  }];
+}
+
+- (void)testArgsortPerformanceStdSort {
+  constexpr unsigned int N = PERF_N;
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint32_t>>(N);
+  setupRandomKeyValues(*sharedRandomWords, 0xFFFFFFFF);
+
+  auto sharedIndices = std::make_shared<std::vector<uint32_t>>(N);
+
+  [self measureBlock:^{
+    std::vector<uint32_t> & keys = *sharedRandomWords;
+    std::vector<uint32_t> & indices = *sharedIndices;
+    std::iota(begin(indices), end(indices), 0);
+
+    std::sort(begin(indices), end(indices), [&keys](uint32_t i0, uint32_t i1) {
+      return keys[i0] < keys[i1];
+    });
+  }];
+}
+
+// Time one key + value partition of N random uint32_t keys. The permutation loops only
+// prefetch ahead when PERMUTE_PREFETCH_DISTANCE is defined, so build with and without
+// it (for example as 16) to compare.
+
+- (void)testKVPartitionPerformance20 {
+  constexpr unsigned int N = (1 << 20);
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint32_t>>(N);
+  std::vector<uint32_t> & randomWordsVec = *sharedRandomWords;
+
+  constexpr unsigned int maxU32 = 0xFFFFFFFF;
+  setupRandomKeyValues(randomWordsVec, maxU32);
+
+  auto sharedKeys = std::make_shared<std::vector<uint32_t>>(N);
+  auto sharedValues = std::make_shared<std::vector<uint32_t>>(N);
+  auto sharedBoundaries = std::make_shared<std::vector<unsigned int>>(radixPartitionBoundariesN(1));
+
+  [self measureBlock:^{
+    std::vector<uint32_t> & randomWords = *sharedRandomWords;
+    uint32_t *inPtr = randomWords.data();
+    std::vector<uint32_t> & keys = *sharedKeys;
+    uint32_t *keysPtr = keys.data();
+    std::vector<uint32_t> & values = *sharedValues;
+    uint32_t *valuesPtr = values.data();
+
+    memcpy(keysPtr, inPtr, N * sizeof(uint32_t));
+
+    radixPartitionOptKV<3>(keysPtr, valuesPtr, 0, N, sharedBoundaries->data());
+  }];
+}
+
+- (void)testKVPartitionPerformance22 {
+  constexpr unsigned int N = (1 << 22);
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint32_t>>(N);
+  std::vector<uint32_t> & randomWordsVec = *sharedRandomWords;
+
+  constexpr unsigned int maxU32 = 0xFFFFFFFF;
+  setupRandomKeyValues(randomWordsVec, maxU32);
+
+  auto sharedKeys = std::make_shared<std::vector<uint32_t>>(N);
+  auto sharedValues = std::make_shared<std::vector<uint32_t>>(N);
+  auto sharedBoundaries = std::make_shared<std::vector<unsigned int>>(radixPartitionBoundariesN(1));
+
+  [self measureBlock:^{
+    std::vector<uint32_t> & randomWords = *sharedRandomWords;
+    uint32_t *inPtr = randomWords.data();
+    std::vector<uint32_t> & keys = *sharedKeys;
+    uint32_t *keysPtr = keys.data();
+    std::vector<uint32_t> & values = *sharedValues;
+    uint32_t *valuesPtr = values.data();
+
+    memcpy(keysPtr, inPtr, N * sizeof(uint32_t));
+
+    radixPartitionOptKV<3>(keysPtr, valuesPtr, 0, N, sharedBoundaries->data());
+  }];
+}
+
+- (void)testKVPartitionPerformance24 {
+  constexpr unsigned int N = (1 << 24);
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint32_t>>(N);
+  std::vector<uint32_t> & randomWordsVec = *sharedRandomWords;
+
+  constexpr unsigned int maxU32 = 0xFFFFFFFF;
+  setupRandomKeyValues(randomWordsVec, maxU32);
+
+  auto sharedKeys = std::make_shared<std::vector<uint32_t>>(N);
+  auto sharedValues = std::make_shared<std::vector<uint32_t>>(N);
+  auto sharedBoundaries = std::make_shared<std::vector<unsigned int>>(radixPartitionBoundariesN(1));
+
+  [self measureBlock:^{
+    std::vector<uint32_t> & randomWords = *sharedRandomWords;
+    uint32_t *inPtr = randomWords.data();
+    std::vector<uint32_t> & keys = *sharedKeys;
+    uint32_t *keysPtr = keys.data();
+    std::vector<uint32_t> & values = *sharedValues;
+    uint32_t *valuesPtr = values.data();
+
+    memcpy(keysPtr, inPtr, N * sizeof(uint32_t));
+
+    radixPartitionOptKV<3>(keysPtr, valuesPtr, 0, N, sharedBoundaries->data());
+  }];
+}
+
+- (void)testKVPartitionPerformance26 {
+  constexpr unsigned int N = (1 << 26);
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint32_t>>(N);
+  std::vector<uint32_t> & randomWordsVec = *sharedRandomWords;
+
+  constexpr unsigned int maxU32 = 0xFFFFFFFF;
+  setupRandomKeyValues(randomWordsVec, maxU32);
+
+  auto sharedKeys = std::make_shared<std::vector<uint32_t>>(N);
+  auto sharedValues = std::make_shared<std::vector<uint32_t>>(N);
+  auto sharedBoundaries = std::make_shared<std::vector<unsigned int>>(radixPartitionBoundariesN(1));
+
+  [self measureBlock:^{
+    std::vector<uint32_t> & randomWords = *sharedRandomWords;
+    uint32_t *inPtr = randomWords.data();
+    std::vector<uint32_t> & keys = *sharedKeys;
+    uint32_t *keysPtr = keys.data();
+    std::vector<uint32_t> & values = *sharedValues;
+    uint32_t *valuesPtr = values.data();
+
+    memcpy(keysPtr, inPtr, N * sizeof(uint32_t));
+
+    radixPartitionOptKV<3>(keysPtr, valuesPtr, 0, N, sharedBoundaries->data());
+  }];
+}
+
+- (void)testKVPartitionPerformance28 {
+  constexpr unsigned int N = PERF_N;
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint32_t>>(N);
+  std::vector<uint32_t> & randomWordsVec = *sharedRandomWords;
+
+  constexpr unsigned int maxU32 = 0xFFFFFFFF;
+  setupRandomKeyValues(randomWordsVec, maxU32);
+
+  auto sharedKeys = std::make_shared<std::vector<uint32_t>>(N);
+  auto sharedValues = std::make_shared<std::vector<uint32_t>>(N);
+  auto sharedBoundaries = std::make_shared<std::vector<unsigned int>>(radixPartitionBoundariesN(1));
+
+  [self measureBlock:^{
+    std::vector<uint32_t> & randomWords = *sharedRandomWords;
+    uint32_t *inPtr = randomWords.data();
+    std::vector<uint32_t> & keys = *sharedKeys;
+    uint32_t *keysPtr = keys.data();
+    std::vector<uint32_t> & values = *sharedValues;
+    uint32_t *valuesPtr = values.data();
+
+    memcpy(keysPtr, inPtr, N * sizeof(uint32_t));
+
+    radixPartitionOptKV<3>(keysPtr, valuesPtr, 0, N, sharedBoundaries->data());
+  }];
+}
+
+// The 2^30 test needs about 12 Gb (random input, keys and values), define
+// PERFORMANCE_KV_PARTITION_VERY_BIG_N to run it.
+
+//#define PERFORMANCE_KV_PARTITION_VERY_BIG_N
+
+#if defined(PERFORMANCE_KV_PARTITION_VERY_BIG_N)
+
+- (void)testKVPartitionPerformance30 {
+  constexpr unsigned int N = (1 << 30);
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint32_t>>(N);
+  std::vector<uint32_t> & randomWordsVec = *sharedRandomWords;
+
+  constexpr unsigned int maxU32 = 0xFFFFFFFF;
+  setupRandomKeyValues(randomWordsVec, maxU32);
+
+  auto sharedKeys = std::make_shared<std::vector<uint32_t>>(N);
+  auto sharedValues = std::make_shared<std::vector<uint32_t>>(N);
+  auto sharedBoundaries = std::make_shared<std::vector<unsigned int>>(radixPartitionBoundariesN(1));
+
+  [self measureBlock:^{
+    std::vector<uint32_t> & randomWords = *sharedRandomWords;
+    uint32_t *inPtr = randomWords.data();
+    std::vector<uint32_t> & keys = *sharedKeys;
+    uint32_t *keysPtr = keys.data();
+    std::vector<uint32_t> & values = *sharedValues;
+    uint32_t *valuesPtr = values.data();
+
+    memcpy(keysPtr, inPtr, N * sizeof(uint32_t));
+
+    radixPartitionOptKV<3>(keysPtr, valuesPtr, 0, N, sharedBoundaries->data());
+  }];
+}
+
+#endif // PERFORMANCE_KV_PARTITION_VERY_BIG_N
+
+@end
@@ -0,0 +1,417 @@
+//
+//  LSDSortTests.mm
+//
+// Out-of-place LSD sort tests, the result must match std::sort with and without
+// scratch. The performance tests compare LSD with the in-place sort for 64 bit keys,
+// LSD is used at 2^16 and 2^24 while 2^20 falls back to the in-place sort. For 32 bit
+// keys the in-place sort is always used since LSD was never measured to be faster.
+
+#import <XCTest/XCTest.h>
+
+#include <random>
+
+#include "in_place_sort_opt.hpp"
+
+@interface LSDSortTests : XCTestCase
+
+@end
+
+@implementation LSDSortTests
+
+- (void)testLSDSmall {
+  // Smaller than lsdSortMinN, sorted in-place
+  const unsigned int N = 100;
+  std::vector<uint32_t> inWords(3 + N + 3);
+  std::mt19937 generator(N);
+  for (auto & v : inWords) {
+    v = (uint32_t) generator();
+  }
+
+  std::vector<uint32_t> expected = inWords;
+  std::sort(begin(expected) + 3, begin(expected) + 3 + N);
+
+  std::vector<uint32_t> scratch(N);
+  countingSortLSDOpt(inWords.data(), 3, 3 + N, scratch.data());
+
+  XCTAssert(inWords == expected);
+}
+
+- (void)testLSDU32 {
+  const unsigned int N = 100000;
+  std::vector<uint32_t> inWords(N);
+  std::mt19937 generator(N);
+  for (auto & v : inWords) {
+    v = (uint32_t) generator();
+  }
+
+  std::vector<uint32_t> expected = inWords;
+  std::sort(begin(expected), end(expected));
+
+  std::vector<uint32_t> scratch(N);
+  countingSortLSDOpt(inWords.data(), 0, N, scratch.data());
+
+  XCTAssert(inWords == expected);
+}
+
+- (void)testLSDU32Offset {
+  // The values outside [starti, endi) must not change
+  const unsigned int N = 100003;
+  std::vector<uint32_t> inWords(5 + N + 5);
+  std::mt19937 generator(N);
+  for (auto & v : inWords) {
+    v = (uint32_t) generator();
+  }
+
+  std::vector<uint32_t> expected = inWords;
+  std::sort(begin(expected) + 5, begin(expected) + 5 + N);
+
+  std::vector<uint32_t> scratch(N);
+  countingSortLSDOpt(inWords.data(), 5, 5 + N, scratch.data());
+
+  XCTAssert(inWords == expected);
+}
+
+- (void)testLSDU32NoScratch {
+  const unsigned int N = 100000;
+  std::vector<uint32_t> inWords(7 + N);
+  std::mt19937 generator(N);
+  for (auto & v : inWords) {
+    v = (uint32_t) generator();
+  }
+
+  std::vector<uint32_t> expected = inWords;
+  std::sort(begin(expected) + 7, end(expected));
+
+  countingSortLSDOpt(inWords.data(), 7, 7 + N, (uint32_t *) nullptr);
+
+  XCTAssert(inWords == expected);
+}
+
+- (void)testLSDU32SkippedDigits {
+  // Digits 1 and 3 are constant, 32 bit keys are sorted in-place even with scratch
+  const unsigned int N = 100000;
+  std::vector<uint32_t> inWords(N);
+  std::mt19937 generator(N);
+  for (auto & v : inWords) {
+    v = (uint32_t) generator() & 0x00FF00FF;
+  }
+
+  std::vector<uint32_t> expected = inWords;
+  std::sort(begin(expected), end(expected));
+
+  std::vector<uint32_t> scratch(N);
+  countingSortLSDOpt(inWords.data(), 0, N, scratch.data());
+
+  XCTAssert(inWords == expected);
+}
+
+- (void)testLSDU32Large {
+  // Size where 64 bit keys use LSD, 32 bit keys are still sorted in-place
+  const unsigned int N = 4000000;
+  std::vector<uint32_t> inWords(N);
+  std::mt19937 generator(N);
+  for (auto & v : inWords) {
+    v = (uint32_t) generator();
+  }
+
+  std::vector<uint32_t> expected = inWords;
+  std::sort(begin(expected), end(expected));
+
+  std::vector<uint32_t> scratch(N);
+  countingSortLSDOpt(inWords.data(), 0, N, scratch.data());
+
+  XCTAssert(inWords == expected);
+}
+
+- (void)testLSDU64 {
+  const unsigned int N = 1000000;
+  std::vector<uint64_t> inWords(N);
+  std::mt19937_64 generator(N);
+  for (unsigned int i = 0; i < N; i++) {
+    inWords[i] = generator();
+  }
+
+  std::vector<uint64_t> expected = inWords;
+  std::sort(begin(expected), end(expected));
+
+  std::vector<uint64_t> scratch(N);
+  countingSortLSDOpt(inWords.data(), 0, N, scratch.data());
+
+  XCTAssert(inWords == expected);
+}
+
+- (void)testLSDU64SkippedDigits {
+  // Digits 1, 3, 5 and 7 are constant, so the result ends in scratch and is copied back
+  const unsigned int N = 100000;
+  std::vector<uint64_t> inWords(N);
+  std::mt19937_64 generator(N);
+  for (unsigned int i = 0; i < N; i++) {
+    inWords[i] = generator() & 0x00FF00FF00FF00FFull;
+  }
+
+  std::vector<uint64_t> expected = inWords;
+  std::sort(begin(expected), end(expected));
+
+  std::vector<uint64_t> scratch(N);
+  countingSortLSDOpt(inWords.data(), 0, N, scratch.data());
+
+  XCTAssert(inWords == expected);
+}
+
+- (void)testLSDU64Large {
+  // Large enough that LSD is used and the passes use streaming stores
+  const unsigned int N = 1 << 22;
+  std::vector<uint64_t> inWords(N);
+  std::mt19937_64 generator(N);
+  for (unsigned int i = 0; i < N; i++) {
+    inWords[i] = generator();
+  }
+
+  std::vector<uint64_t> expected = inWords;
+  std::sort(begin(expected), end(expected));
+
+  std::vector<uint64_t> scratch(N);
+  countingSortLSDOpt(inWords.data(), 0, N, scratch.data());
+
+  XCTAssert(inWords == expected);
+}
+
+- (void)testLSDSigned {
+  const unsigned int N = 100000;
+  std::vector<int32_t> inWords(N);
+  std::mt19937 generator(N);
+  for (unsigned int i = 0; i < N; i++) {
+    inWords[i] = (int32_t) generator();
+  }
+
+  std::vector<int32_t> expected = inWords;
+  std::sort(begin(expected), end(expected));
+
+  std::vector<int32_t> scratch(N);
+  countingSortLSDOpt(inWords.data(), 0, N, scratch.data());
+
+  XCTAssert(inWords == expected);
+}
+
+- (void)testLSDFloat {
+  const unsigned int N = 100000;
+  std::mt19937 generator(N);
+  std::uniform_real_distribution<float> floatDist(-1000.0f, 1000.0f);
+  std::vector<float> inFloats(N);
+  for (unsigned int i = 0; i < N; i++) {
+    inFloats[i] = floatDist(generator);
+  }
+
+  std::vector<float> expected = inFloats;
+  std::sort(begin(expected), end(expected));
+
+  std::vector<float> scratch(N);
+  countingSortLSDOpt(inFloats.data(), 0, N, scratch.data());
+
+  XCTAssert(inFloats == expected);
+}
+
+- (void)testLSDDouble {
+  const unsigned int N = 100000;
+  std::mt19937_64 generator(N);
+  std::uniform_real_distribution<double> doubleDist(-1.0e6, 1.0e6);
+  std::vector<double> inDoubles(N);
+  for (unsigned int i = 0; i < N; i++) {
+    inDoubles[i] = doubleDist(generator);
+  }
+
+  std::vector<double> expected = inDoubles;
+  std::sort(begin(expected), end(expected));
+
+  std::vector<double> scratch(N);
+  countingSortLSDOpt(inDoubles.data(), 0, N, scratch.data());
+
+  XCTAssert(inDoubles == expected);
+}
+
+// Time N random uint64_t numLoops times, LSD with scratch or the in-place sort
+
+- (void)testLSDPerformance16 {
+  constexpr unsigned int N = (1 << 16);
+  constexpr unsigned int numLoops = 256;
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint64_t>>(N);
+  std::mt19937_64 generator(N);
+  for (auto & v : *sharedRandomWords) {
+    v = generator();
+  }
+
+  auto sharedDstVec = std::make_shared<std::vector<uint64_t>>(N);
+  auto sharedScratch = std::make_shared<std::vector<uint64_t>>(N);
+
+  [self measureBlock:^{
+    std::vector<uint64_t> & randomWords = *sharedRandomWords;
+    uint64_t *inPtr = randomWords.data();
+    std::vector<uint64_t> & dstVec = *sharedDstVec;
+    uint64_t *outPtr = dstVec.data();
+
+    for (unsigned int loopi = 0; loopi < numLoops; loopi++) {
+      memcpy(outPtr, inPtr, N * sizeof(uint64_t));
+
+      countingSortLSDOpt(outPtr, 0, N, sharedScratch->data());
+    }
+
+#if defined(DEBUG)
+    XCTAssert(std::is_sorted(begin(dstVec), end(dstVec)));
+#endif // DEBUG
+  }];
+}
+
+- (void)testLSDPerformance16InPlace {
+  constexpr unsigned int N = (1 << 16);
+  constexpr unsigned int numLoops = 256;
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint64_t>>(N);
+  std::mt19937_64 generator(N);
+  for (auto & v : *sharedRandomWords) {
+    v = generator();
+  }
+
+  auto sharedDstVec = std::make_shared<std::vector<uint64_t>>(N);
+
+  [self measureBlock:^{
+    std::vector<uint64_t> & randomWords = *sharedRandomWords;
+    uint64_t *inPtr = randomWords.data();
+    std::vector<uint64_t> & dstVec = *sharedDstVec;
+    uint64_t *outPtr = dstVec.data();
+
+    for (unsigned int loopi = 0; loopi < numLoops; loopi++) {
+      memcpy(outPtr, inPtr, N * sizeof(uint64_t));
+
+      countingSortInPlaceOpt<7>(outPtr, 0, N);
+    }
+
+#if defined(DEBUG)
+    XCTAssert(std::is_sorted(begin(dstVec), end(dstVec)));
+#endif // DEBUG
+  }];
+}
+
+- (void)testLSDPerformance20 {
+  constexpr unsigned int N = (1 << 20);
+  constexpr unsigned int numLoops = 16;
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint64_t>>(N);
+  std::mt19937_64 generator(N);
+  for (auto & v : *sharedRandomWords) {
+    v = generator();
+  }
+
+  auto sharedDstVec = std::make_shared<std::vector<uint64_t>>(N);
+  auto sharedScratch = std::make_shared<std::vector<uint64_t>>(N);
+
+  [self measureBlock:^{
+    std::vector<uint64_t> & randomWords = *sharedRandomWords;
+    uint64_t *inPtr = randomWords.data();
+    std::vector<uint64_t> & dstVec = *sharedDstVec;
+    uint64_t *outPtr = dstVec.data();
+
+    for (unsigned int loopi = 0; loopi < numLoops; loopi++) {
+      memcpy(outPtr, inPtr, N * sizeof(uint64_t));
+
+      countingSortLSDOpt(outPtr, 0, N, sharedScratch->data());
+    }
+
+#if defined(DEBUG)
+    XCTAssert(std::is_sorted(begin(dstVec), end(dstVec)));
+#endif // DEBUG
+  }];
+}
+
+- (void)testLSDPerformance20InPlace {
+  constexpr unsigned int N = (1 << 20);
+  constexpr unsigned int numLoops = 16;
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint64_t>>(N);
+  std::mt19937_64 generator(N);
+  for (auto & v : *sharedRandomWords) {
+    v = generator();
+  }
+
+  auto sharedDstVec = std::make_shared<std::vector<uint64_t>>(N);
+
+  [self measureBlock:^{
+    std::vector<uint64_t> & randomWords = *sharedRandomWords;
+    uint64_t *inPtr = randomWords.data();
+    std::vector<uint64_t> & dstVec = *sharedDstVec;
+    uint64_t *outPtr = dstVec.data();
+
+    for (unsigned int loopi = 0; loopi < numLoops; loopi++) {
+      memcpy(outPtr, inPtr, N * sizeof(uint64_t));
+
+      countingSortInPlaceOpt<7>(outPtr, 0, N);
+    }
+
+#if defined(DEBUG)
+    XCTAssert(std::is_sorted(begin(dstVec), end(dstVec)));
+#endif // DEBUG
+  }];
+}
+
+- (void)testLSDPerformance24 {
+  constexpr unsigned int N = (1 << 24);
+  constexpr unsigned int numLoops = 1;
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint64_t>>(N);
+  std::mt19937_64 generator(N);
+  for (auto & v : *sharedRandomWords) {
+    v = generator();
+  }
+
+  auto sharedDstVec = std::make_shared<std::vector<uint64_t>>(N);
+  auto sharedScratch = std::make_shared<std::vector<uint64_t>>(N);
+
+  [self measureBlock:^{
+    std::vector<uint64_t> & randomWords = *sharedRandomWords;
+    uint64_t *inPtr = randomWords.data();
+    std::vector<uint64_t> & dstVec = *sharedDstVec;
+    uint64_t *outPtr = dstVec.data();
+
+    for (unsigned int loopi = 0; loopi < numLoops; loopi++) {
+      memcpy(outPtr, inPtr, N * sizeof(uint64_t));
+
+      countingSortLSDOpt(outPtr, 0, N, sharedScratch->data());
+    }
+
+#if defined(DEBUG)
+    XCTAssert(std::is_sorted(begin(dstVec), end(dstVec)));
+#endif // DEBUG
+  }];
+}
+
+- (void)testLSDPerformance24InPlace {
+  constexpr unsigned int N = (1 << 24);
+  constexpr unsigned int numLoops = 1;
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint64_t>>(N);
+  std::mt19937_64 generator(N);
+  for (auto & v : *sharedRandomWords) {
+    v = generator();
+  }
+
+  auto sharedDstVec = std::make_shared<std::vector<uint64_t>>(N);
+
+  [self measureBlock:^{
+    std::vector<uint64_t> & randomWords = *sharedRandomWords;
+    uint64_t *inPtr = randomWords.data();
+    std::vector<uint64_t> & dstVec = *sharedDstVec;
+    uint64_t *outPtr = dstVec.data();
+
+    for (unsigned int loopi = 0; loopi < numLoops; loopi++) {
+      memcpy(outPtr, inPtr, N * sizeof(uint64_t));
+
+      countingSortInPlaceOpt<7>(outPtr, 0, N);
+    }
+
+#if defined(DEBUG)
+    XCTAssert(std::is_sorted(begin(dstVec), end(dstVec)));
+#endif // DEBUG
+  }];
+}
+
+@end
@@ -0,0 +1,303 @@
+//
+//  ParallelSortTests.mm
+//
+// Multi-threaded radix sort tests, the performance tests report scaling
+// from 1 to N threads on the same PERF_N workloads as RadixSortTests.
+
+#import <XCTest/XCTest.h>
+
+#include <random>
+#include <cstddef>  // For std::ptrdiff_t
+
+#include "in_place_sort_parallel.hpp"
+
+@interface ParallelSortTests : XCTestCase
+
+@end
+
+static
+__attribute__((noinline))
+void setupRandomParallelValues(std::vector<uint32_t> & inputValues, uint32_t maxNum) {
+  const unsigned int nSrcValues = (unsigned int) inputValues.size();
+
+  std::random_device                  rand_dev;
+  std::mt19937                        generator(rand_dev());
+
+  std::uniform_int_distribution<uint32_t>  distr(0, maxNum); // even dist between buckets
+
+  for ( int i = 0 ; i < nSrcValues; i++ ) {
+    inputValues[i] = distr(generator);
+  }
+}
+
+@implementation ParallelSortTests
+
+- (void)testParallelSmallFallsBackToSerial {
+  std::vector<uint32_t> inWords{
+    2, 2, 3, 3, 0, 1, 0, 1
+  };
+  std::vector<uint32_t> expected{
+    0, 0, 1, 1, 2, 2, 3, 3
+  };
+  const unsigned int N = (int) inWords.size();
+
+  countingSortInPlaceOptParallel<3>(inWords.data(), 0, N, 4);
+
+  bool same = inWords == expected;
+  XCTAssert(same);
+}
+
+- (void)testParallelRandomU32 {
+  const unsigned int N = 1000000;
+  std::vector<uint32_t> randomWords(N);
+  setupRandomParallelValues(randomWords, 0xFFFFFFFF);
+
+  std::vector<uint32_t> expected = randomWords;
+  std::sort(begin(expected), end(expected));
+
+  for (unsigned int numThreads : {2, 3, 4, 8}) {
+    std::vector<uint32_t> inWords = randomWords;
+    countingSortInPlaceOptParallel<3>(inWords.data(), 0, N, numThreads);
+    XCTAssert(inWords == expected, @"numThreads %d", numThreads);
+  }
+}
+
+- (void)testParallelRandomU16 {
+  // Top two digits are zero, partition moves down to D = 1
+  const unsigned int N = 1000000;
+  std::vector<uint32_t> randomWords(N);
+  setupRandomParallelValues(randomWords, 0xFFFF);
+
+  std::vector<uint32_t> expected = randomWords;
+  std::sort(begin(expected), end(expected));
+
+  for (unsigned int numThreads : {2, 4}) {
+    std::vector<uint32_t> inWords = randomWords;
+    countingSortInPlaceOptParallel<3>(inWords.data(), 0, N, numThreads);
+    XCTAssert(inWords == expected, @"numThreads %d", numThreads);
+  }
+}
+
+- (void)testParallelFewBuckets {
+  // Only 4 buckets used, so most stripes are full and the repair step does most of the work
+  const unsigned int N = 1000000;
+  std::vector<uint32_t> randomWords(N);
+  setupRandomParallelValues(randomWords, 0x03FFFFFF);
+
+  std::vector<uint32_t> expected = randomWords;
+  std::sort(begin(expected), end(expected));
+
+  for (unsigned int numThreads : {2, 4, 8}) {
+    std::vector<uint32_t> inWords = randomWords;
+    countingSortInPlaceOptParallel<3>(inWords.data(), 0, N, numThreads);
+    XCTAssert(inWords == expected, @"numThreads %d", numThreads);
+  }
+}
+
+- (void)testParallelSkewedBuckets {
+  // Nearly all values land in top bucket 0, only work stealing at the
+  // lower recursion levels keeps all the threads busy.
+  const unsigned int N = 1000000;
+  std::vector<uint32_t> inWords(N);
+  setupRandomParallelValues(inWords, 0xFFFFFFFF);
+  for (unsigned int i = 0; i < N; i++) {
+    if ((i % 16) != 0) {
+      inWords[i] &= 0x00FFFFFF;
+    }
+  }
+
+  std::vector<uint32_t> expected = inWords;
+  std::sort(begin(expected), end(expected));
+
+  countingSortInPlaceOptParallel<3>(inWords.data(), 0, N, 4);
+
+  bool same = inWords == expected;
+  XCTAssert(same);
+}
+
+// Each task splits its range in half until the range is small, then adds
+// the range length to the total. Every value must be counted exactly once.
+
+static
+void workStealingSplitTask(WorkStealingPool & pool, unsigned int workeri, void * ctx, unsigned int starti, unsigned int endi) {
+  std::atomic<unsigned int> & total = *((std::atomic<unsigned int> *) ctx);
+  if ((endi - starti) <= 16) {
+    total += endi - starti;
+    return;
+  }
+  unsigned int midi = starti + (endi - starti) / 2;
+  pool.push(workeri, { workStealingSplitTask, ctx, starti, midi });
+  pool.push(workeri, { workStealingSplitTask, ctx, midi, endi });
+}
+
+- (void)testWorkStealingPoolRunsAllTasks {
+  for (unsigned int numWorkers : {1, 2, 4, 8}) {
+    std::atomic<unsigned int> total(0);
+    WorkStealingPool pool(numWorkers);
+    pool.push(0, { workStealingSplitTask, &total, 0, 1000000 });
+    pool.run();
+    XCTAssert(total == 1000000, @"numWorkers %d total %d", numWorkers, (int)total);
+  }
+}
+
+//constexpr unsigned int PERF_N = 100000000; // 100 million numbers
+
+constexpr unsigned int PERF_N =   1073741824 / 4; // (2*30)/4 is very very large (1 Gb x 2)
+
+- (void)testParallelPerformanceD3Threads1 {
+  constexpr unsigned int N = PERF_N;
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint32_t>>(N);
+  std::vector<uint32_t> & randomWordsVec = *sharedRandomWords;
+
+  constexpr unsigned int maxU32 = 0xFFFFFFFF;
+  setupRandomParallelValues(randomWordsVec, maxU32);
+
+  auto sharedDstVec = std::make_shared<std::vector<uint32_t>>(N);
+
+  [self measureBlock:^{
+    std::vector<uint32_t> & randomWords = *sharedRandomWords;
+    uint32_t *inPtr = randomWords.data();
+    std::vector<uint32_t> & dstVec = *sharedDstVec;
+    uint32_t *outPtr = dstVec.data();
+
+    memcpy(outPtr, inPtr, N * sizeof(uint32_t));
+
+    countingSortInPlaceOptParallel<3>(outPtr, 0, N, 1);
+
+#if defined(DEBUG)
+    {
+      std::vector<uint32_t> expected = randomWords;
+      std::sort(begin(expected), end(expected));
+      XCTAssert(expected == dstVec);
+    }
+#endif // DEBUG
+  }];
+}
+
+- (void)testParallelPerformanceD3Threads2 {
+  constexpr unsigned int N = PERF_N;
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint32_t>>(N);
+  std::vector<uint32_t> & randomWordsVec = *sharedRandomWords;
+
+  constexpr unsigned int maxU32 = 0xFFFFFFFF;
+  setupRandomParallelValues(randomWordsVec, maxU32);
+
+  auto sharedDstVec = std::make_shared<std::vector<uint32_t>>(N);
+
+  [self measureBlock:^{
+    std::vector<uint32_t> & randomWords = *sharedRandomWords;
+    uint32_t *inPtr = randomWords.data();
+    std::vector<uint32_t> & dstVec = *sharedDstVec;
+    uint32_t *outPtr = dstVec.data();
+
+    memcpy(outPtr, inPtr, N * sizeof(uint32_t));
+
+    countingSortInPlaceOptParallel<3>(outPtr, 0, N, 2);
+
+#if defined(DEBUG)
+    {
+      std::vector<uint32_t> expected = randomWords;
+      std::sort(begin(expected), end(expected));
+      XCTAssert(expected == dstVec);
+    }
+#endif // DEBUG
+  }];
+}
+
+- (void)testParallelPerformanceD3Threads4 {
+  constexpr unsigned int N = PERF_N;
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint32_t>>(N);
+  std::vector<uint32_t> & randomWordsVec = *sharedRandomWords;
+
+  constexpr unsigned int maxU32 = 0xFFFFFFFF;
+  setupRandomParallelValues(randomWordsVec, maxU32);
+
+  auto sharedDstVec = std::make_shared<std::vector<uint32_t>>(N);
+
+  [self measureBlock:^{
+    std::vector<uint32_t> & randomWords = *sharedRandomWords;
+    uint32_t *inPtr = randomWords.data();
+    std::vector<uint32_t> & dstVec = *sharedDstVec;
+    uint32_t *outPtr = dstVec.data();
+
+    memcpy(outPtr, inPtr, N * sizeof(uint32_t));
+
+    countingSortInPlaceOptParallel<3>(outPtr, 0, N, 4);
+
+#if defined(DEBUG)
+    {
+      std::vector<uint32_t> expected = randomWords;
+      std::sort(begin(expected), end(expected));
+      XCTAssert(expected == dstVec);
+    }
+#endif // DEBUG
+  }];
+}
+
+- (void)testParallelPerformanceD3Threads8 {
+  constexpr unsigned int N = PERF_N;
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint32_t>>(N);
+  std::vector<uint32_t> & randomWordsVec = *sharedRandomWords;
+
+  constexpr unsigned int maxU32 = 0xFFFFFFFF;
+  setupRandomParallelValues(randomWordsVec, maxU32);
+
+  auto sharedDstVec = std::make_shared<std::vector<uint32_t>>(N);
+
+  [self measureBlock:^{
+    std::vector<uint32_t> & randomWords = *sharedRandomWords;
+    uint32_t *inPtr = randomWords.data();
+    std::vector<uint32_t> & dstVec = *sharedDstVec;
+    uint32_t *outPtr = dstVec.data();
+
+    memcpy(outPtr, inPtr, N * sizeof(uint32_t));
+
+    countingSortInPlaceOptParallel<3>(outPtr, 0, N, 8);
+
+#if defined(DEBUG)
+    {
+      std::vector<uint32_t> expected = randomWords;
+      std::sort(begin(expected), end(expected));
+      XCTAssert(expected == dstVec);
+    }
+#endif // DEBUG
+  }];
+}
+
+- (void)testParallelPerformanceD3ThreadsAll {
+  constexpr unsigned int N = PERF_N;
+  // numThreads 0 means use all hardware threads
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint32_t>>(N);
+  std::vector<uint32_t> & randomWordsVec = *sharedRandomWords;
+
+  constexpr unsigned int maxU32 = 0xFFFFFFFF;
+  setupRandomParallelValues(randomWordsVec, maxU32);
+
+  auto sharedDstVec = std::make_shared<std::vector<uint32_t>>(N);
+
+  [self measureBlock:^{
+    std::vector<uint32_t> & randomWords = *sharedRandomWords;
+    uint32_t *inPtr = randomWords.data();
+    std::vector<uint32_t> & dstVec = *sharedDstVec;
+    uint32_t *outPtr = dstVec.data();
+
+    memcpy(outPtr, inPtr, N * sizeof(uint32_t));
+
+    countingSortInPlaceOptParallel<3>(outPtr, 0, N, 0);
+
+#if defined(DEBUG)
+    {
+      std::vector<uint32_t> expected = randomWords;
+      std::sort(begin(expected), end(expected));
+      XCTAssert(expected == dstVec);
+    }
+#endif // DEBUG
+  }];
+}
+
+@end
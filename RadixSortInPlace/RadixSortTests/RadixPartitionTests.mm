@@ -0,0 +1,180 @@
+//
+//  RadixPartitionTests.mm
+//
+// Partition only tests, every value must be in the bucket given by its digits
+// and the keys must still be a permutation of the input.
+
+#import <XCTest/XCTest.h>
+
+#include <random>
+#include <numeric>
+#include <cstddef>  // For std::ptrdiff_t
+
+#include "in_place_sort_opt.hpp"
+
+@interface RadixPartitionTests : XCTestCase
+
+@end
+
+static
+__attribute__((noinline))
+void setupRandomPartitionValues(std::vector<uint32_t> & inputValues, uint32_t maxNum) {
+  const unsigned int nSrcValues = (unsigned int) inputValues.size();
+
+  std::random_device                  rand_dev;
+  std::mt19937                        generator(rand_dev());
+
+  std::uniform_int_distribution<uint32_t>  distr(0, maxNum); // even dist between buckets
+
+  for ( int i = 0 ; i < nSrcValues; i++ ) {
+    inputValues[i] = distr(generator);
+  }
+}
+
+@implementation RadixPartitionTests
+
+- (void)testPartitionSmall {
+  std::vector<uint32_t> inWords{
+    0x03000001, 0x01000000, 0x03000000, 0x01000001
+  };
+  const unsigned int N = (int) inWords.size();
+  std::vector<unsigned int> boundaries(radixPartitionBoundariesN(1));
+
+  radixPartitionOpt<3>(inWords.data(), 0, N, boundaries.data());
+
+  XCTAssert(boundaries[0] == 0 && boundaries[1] == 0);
+  XCTAssert(boundaries[2] == 2 && boundaries[3] == 2);
+  XCTAssert(boundaries[4] == 4 && boundaries[256] == 4);
+  XCTAssert((inWords[0] >> 24) == 1 && (inWords[1] >> 24) == 1);
+  XCTAssert((inWords[2] >> 24) == 3 && (inWords[3] >> 24) == 3);
+}
+
+- (void)testPartitionEmpty {
+  std::vector<unsigned int> boundaries(radixPartitionBoundariesN(2), 0xFFFFFFFF);
+
+  radixPartitionOpt<3, 2>((uint32_t *) nullptr, 5, 5, boundaries.data());
+
+  XCTAssert(std::all_of(begin(boundaries), end(boundaries), [](unsigned int b) { return b == 5; }));
+}
+
+- (void)testPartitionOneLevelRandom {
+  const std::pair<unsigned int, uint32_t> sizes[] = { { 1000000, 0xFFFFFFFF }, { 1000, 0xFFFFFFFF }, { 1000000, 0x03FFFFFF } };
+
+  for (auto [N, maxNum] : sizes) {
+    std::vector<uint32_t> keys(N);
+    setupRandomPartitionValues(keys, maxNum);
+    std::vector<uint32_t> inputKeys = keys;
+
+    std::vector<uint32_t> rowIds(N);
+    std::iota(begin(rowIds), end(rowIds), 0);
+
+    std::vector<unsigned int> boundaries(radixPartitionBoundariesN(1));
+    radixPartitionOptKV<3, 1>(keys.data(), rowIds.data(), 0, N, boundaries.data());
+
+    XCTAssert(boundaries.front() == 0 && boundaries.back() == N, @"N %d maxNum %x", N, maxNum);
+
+    // Each value is in the bucket given by its top 8 bits and moved with its row id
+    for (size_t bucketi = 0; bucketi < (boundaries.size() - 1); bucketi++) {
+      XCTAssert(boundaries[bucketi] <= boundaries[bucketi + 1], @"bucket %d", (int) bucketi);
+      for (unsigned int i = boundaries[bucketi]; i < boundaries[bucketi + 1]; i++) {
+        XCTAssert((keys[i] >> 24) == bucketi, @"bucket %d", (int) bucketi);
+        XCTAssert(inputKeys[rowIds[i]] == keys[i], @"bucket %d", (int) bucketi);
+      }
+    }
+
+    std::vector<uint32_t> expectedRowIds(N);
+    std::iota(begin(expectedRowIds), end(expectedRowIds), 0);
+    std::sort(begin(rowIds), end(rowIds));
+    XCTAssert(rowIds == expectedRowIds, @"N %d maxNum %x", N, maxNum);
+  }
+}
+
+- (void)testPartitionTwoLevelsRandom {
+  const std::pair<unsigned int, uint32_t> sizes[] = { { 1000000, 0xFFFFFFFF }, { 1000, 0xFFFFFFFF }, { 1000000, 0x00FFFFFF } };
+
+  for (auto [N, maxNum] : sizes) {
+    std::vector<uint32_t> keys(N);
+    setupRandomPartitionValues(keys, maxNum);
+    std::vector<uint32_t> inputKeys = keys;
+
+    std::vector<uint32_t> rowIds(N);
+    std::iota(begin(rowIds), end(rowIds), 0);
+
+    std::vector<unsigned int> boundaries(radixPartitionBoundariesN(2));
+    radixPartitionOptKV<3, 2>(keys.data(), rowIds.data(), 0, N, boundaries.data());
+
+    XCTAssert(boundaries.front() == 0 && boundaries.back() == N, @"N %d maxNum %x", N, maxNum);
+
+    // Each value is in the bucket given by its top 16 bits and moved with its row id
+    for (size_t bucketi = 0; bucketi < (boundaries.size() - 1); bucketi++) {
+      XCTAssert(boundaries[bucketi] <= boundaries[bucketi + 1], @"bucket %d", (int) bucketi);
+      for (unsigned int i = boundaries[bucketi]; i < boundaries[bucketi + 1]; i++) {
+        XCTAssert((keys[i] >> 16) == bucketi, @"bucket %d", (int) bucketi);
+        XCTAssert(inputKeys[rowIds[i]] == keys[i], @"bucket %d", (int) bucketi);
+      }
+    }
+
+    std::vector<uint32_t> expectedRowIds(N);
+    std::iota(begin(expectedRowIds), end(expectedRowIds), 0);
+    std::sort(begin(rowIds), end(rowIds));
+    XCTAssert(rowIds == expectedRowIds, @"N %d maxNum %x", N, maxNum);
+  }
+}
+
+//constexpr unsigned int PERF_N = 100000000; // 100 million numbers
+
+constexpr unsigned int PERF_N =   1073741824 / 4; // (2*30)/4 is very very large (1 Gb x 2)
+
+// Partition on the top digit only, 256 buckets
+
+- (void)testPartitionPerformanceOneLevel {
+  constexpr unsigned int N = PERF_N;
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint32_t>>(N);
+  std::vector<uint32_t> & randomWordsVec = *sharedRandomWords;
+
+  constexpr unsigned int maxU32 = 0xFFFFFFFF;
+  setupRandomPartitionValues(randomWordsVec, maxU32);
+
+  auto sharedDstVec = std::make_shared<std::vector<uint32_t>>(N);
+  auto sharedBoundaries = std::make_shared<std::vector<unsigned int>>(radixPartitionBoundariesN(1));
+
+  [self measureBlock:^{
+    std::vector<uint32_t> & randomWords = *sharedRandomWords;
+    uint32_t *inPtr = randomWords.data();
+    std::vector<uint32_t> & dstVec = *sharedDstVec;
+    uint32_t *outPtr = dstVec.data();
+
+    memcpy(outPtr, inPtr, N * sizeof(uint32_t));
+
+    radixPartitionOpt<3, 1>(outPtr, 0, N, sharedBoundaries->data());
+  }];
+}
+
+// Partition on the top two digits, 65536 buckets
+
+- (void)testPartitionPerformanceTwoLevels {
+  constexpr unsigned int N = PERF_N;
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint32_t>>(N);
+  std::vector<uint32_t> & randomWordsVec = *sharedRandomWords;
+
+  constexpr unsigned int maxU32 = 0xFFFFFFFF;
+  setupRandomPartitionValues(randomWordsVec, maxU32);
+
+  auto sharedDstVec = std::make_shared<std::vector<uint32_t>>(N);
+  auto sharedBoundaries = std::make_shared<std::vector<unsigned int>>(radixPartitionBoundariesN(2));
+
+  [self measureBlock:^{
+    std::vector<uint32_t> & randomWords = *sharedRandomWords;
+    uint32_t *inPtr = randomWords.data();
+    std::vector<uint32_t> & dstVec = *sharedDstVec;
+    uint32_t *outPtr = dstVec.data();
+
+    memcpy(outPtr, inPtr, N * sizeof(uint32_t));
+
+    radixPartitionOpt<3, 2>(outPtr, 0, N, sharedBoundaries->data());
+  }];
+}
+
+@end
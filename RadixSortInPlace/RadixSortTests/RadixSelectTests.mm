@@ -0,0 +1,263 @@
+//
+//  RadixSelectTests.mm
+//
+// Radix select and partial sort tests, results are compared to std::nth_element
+// and std::partial_sort and the performance tests time both on the same inputs.
+
+#import <XCTest/XCTest.h>
+
+#include <random>
+#include <cstddef>  // For std::ptrdiff_t
+
+#include "in_place_sort_opt.hpp"
+
+@interface RadixSelectTests : XCTestCase
+
+@end
+
+static
+__attribute__((noinline))
+void setupRandomSelectValues(std::vector<uint32_t> & inputValues, uint32_t maxNum) {
+  const unsigned int nSrcValues = (unsigned int) inputValues.size();
+
+  std::random_device                  rand_dev;
+  std::mt19937                        generator(rand_dev());
+
+  std::uniform_int_distribution<uint32_t>  distr(0, maxNum); // even dist between buckets
+
+  for ( int i = 0 ; i < nSrcValues; i++ ) {
+    inputValues[i] = distr(generator);
+  }
+}
+
+@implementation RadixSelectTests
+
+- (void)testSelectSmall {
+  std::vector<uint32_t> inWords{
+    3, 0, 2, 1, 3, 0
+  };
+  const unsigned int N = (int) inWords.size();
+
+  radixSelectOpt<3>(inWords.data(), 0, N, 3);
+
+  XCTAssert(inWords[3] == 2);
+}
+
+- (void)testSelectRandom {
+  const unsigned int N = 1000000;
+  std::vector<uint32_t> randomWords(N);
+  setupRandomSelectValues(randomWords, 0xFFFFFFFF);
+
+  std::vector<uint32_t> expected = randomWords;
+  std::sort(begin(expected), end(expected));
+
+  for (unsigned int k : {0u, 1u, 500000u, 999999u}) {
+    std::vector<uint32_t> inWords = randomWords;
+    radixSelectOpt<3>(inWords.data(), 0, N, k);
+
+    // arr[k] is the sorted value and the values on each side of k are on the correct side
+    const uint32_t kth = inWords[k];
+    XCTAssert(kth == expected[k], @"k %d", k);
+    XCTAssert(std::all_of(begin(inWords), begin(inWords) + k, [kth](uint32_t v) { return v <= kth; }), @"k %d", k);
+    XCTAssert(std::all_of(begin(inWords) + k + 1, end(inWords), [kth](uint32_t v) { return v >= kth; }), @"k %d", k);
+  }
+}
+
+- (void)testSelectRandomU16 {
+  const unsigned int N = 1000000;
+  std::vector<uint32_t> randomWords(N);
+  setupRandomSelectValues(randomWords, 0xFFFF);
+
+  std::vector<uint32_t> expected = randomWords;
+  std::sort(begin(expected), end(expected));
+
+  for (unsigned int k : {0u, 1u, 500000u, 999999u}) {
+    std::vector<uint32_t> inWords = randomWords;
+    radixSelectOpt<3>(inWords.data(), 0, N, k);
+
+    // arr[k] is the sorted value and the values on each side of k are on the correct side
+    const uint32_t kth = inWords[k];
+    XCTAssert(kth == expected[k], @"k %d", k);
+    XCTAssert(std::all_of(begin(inWords), begin(inWords) + k, [kth](uint32_t v) { return v <= kth; }), @"k %d", k);
+    XCTAssert(std::all_of(begin(inWords) + k + 1, end(inWords), [kth](uint32_t v) { return v >= kth; }), @"k %d", k);
+  }
+}
+
+- (void)testSelectFewValues {
+  // Most values are equal to the kth value
+  const unsigned int N = 1000000;
+  std::vector<uint32_t> randomWords(N);
+  setupRandomSelectValues(randomWords, 3);
+
+  std::vector<uint32_t> expected = randomWords;
+  std::sort(begin(expected), end(expected));
+
+  for (unsigned int k : {0u, 1u, 500000u, 999999u}) {
+    std::vector<uint32_t> inWords = randomWords;
+    radixSelectOpt<3>(inWords.data(), 0, N, k);
+
+    // arr[k] is the sorted value and the values on each side of k are on the correct side
+    const uint32_t kth = inWords[k];
+    XCTAssert(kth == expected[k], @"k %d", k);
+    XCTAssert(std::all_of(begin(inWords), begin(inWords) + k, [kth](uint32_t v) { return v <= kth; }), @"k %d", k);
+    XCTAssert(std::all_of(begin(inWords) + k + 1, end(inWords), [kth](uint32_t v) { return v >= kth; }), @"k %d", k);
+  }
+}
+
+- (void)testSelectSigned {
+  std::vector<int64_t> inWords{
+    5, -1, 0, -9000000000, 9000000000, 2
+  };
+  const unsigned int N = (int) inWords.size();
+
+  radixSelectOpt<7>(inWords.data(), 0, N, 1);
+
+  XCTAssert(inWords[1] == -1);
+}
+
+- (void)testPartialSortRandom {
+  const unsigned int N = 1000000;
+  std::vector<uint32_t> randomWords(N);
+  setupRandomSelectValues(randomWords, 0xFFFFFFFF);
+
+  std::vector<uint32_t> expected = randomWords;
+  std::sort(begin(expected), end(expected));
+
+  for (unsigned int k : {0u, 1u, 1000u, 500000u, 1000000u}) {
+    std::vector<uint32_t> inWords = randomWords;
+    radixPartialSortOpt<3>(inWords.data(), 0, N, k);
+
+    XCTAssert(std::equal(begin(inWords), begin(inWords) + k, begin(expected)), @"k %d", k);
+
+    // The values after k are the rest of the input in any order
+    std::sort(begin(inWords) + k, end(inWords));
+    XCTAssert(inWords == expected, @"k %d", k);
+  }
+}
+
+- (void)testPartialSortRandomU16 {
+  const unsigned int N = 1000000;
+  std::vector<uint32_t> randomWords(N);
+  setupRandomSelectValues(randomWords, 0xFFFF);
+
+  std::vector<uint32_t> expected = randomWords;
+  std::sort(begin(expected), end(expected));
+
+  for (unsigned int k : {0u, 1u, 1000u, 500000u, 1000000u}) {
+    std::vector<uint32_t> inWords = randomWords;
+    radixPartialSortOpt<3>(inWords.data(), 0, N, k);
+
+    XCTAssert(std::equal(begin(inWords), begin(inWords) + k, begin(expected)), @"k %d", k);
+
+    // The values after k are the rest of the input in any order
+    std::sort(begin(inWords) + k, end(inWords));
+    XCTAssert(inWords == expected, @"k %d", k);
+  }
+}
+
+//constexpr unsigned int PERF_N = 100000000; // 100 million numbers
+
+constexpr unsigned int PERF_N =   1073741824 / 4; // (2*30)/4 is very very large (1 Gb x 2)
+
+// Median of PERF_N values, radix select compared to std::nth_element
+
+- (void)testSelectMedianPerformanceOpt {
+  constexpr unsigned int N = PERF_N;
+  constexpr unsigned int k = PERF_N / 2;
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint32_t>>(N);
+  std::vector<uint32_t> & randomWordsVec = *sharedRandomWords;
+
+  constexpr unsigned int maxU32 = 0xFFFFFFFF;
+  setupRandomSelectValues(randomWordsVec, maxU32);
+
+  auto sharedDstVec = std::make_shared<std::vector<uint32_t>>(N);
+
+  [self measureBlock:^{
+    std::vector<uint32_t> & randomWords = *sharedRandomWords;
+    uint32_t *inPtr = randomWords.data();
+    std::vector<uint32_t> & dstVec = *sharedDstVec;
+    uint32_t *outPtr = dstVec.data();
+
+    memcpy(outPtr, inPtr, N * sizeof(uint32_t));
+
+    radixSelectOpt<3>(outPtr, 0, N, k);
+  }];
+}
+
+- (void)testSelectMedianPerformanceStd {
+  constexpr unsigned int N = PERF_N;
+  constexpr unsigned int k = PERF_N / 2;
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint32_t>>(N);
+  std::vector<uint32_t> & randomWordsVec = *sharedRandomWords;
+
+  constexpr unsigned int maxU32 = 0xFFFFFFFF;
+  setupRandomSelectValues(randomWordsVec, maxU32);
+
+  auto sharedDstVec = std::make_shared<std::vector<uint32_t>>(N);
+
+  [self measureBlock:^{
+    std::vector<uint32_t> & randomWords = *sharedRandomWords;
+    uint32_t *inPtr = randomWords.data();
+    std::vector<uint32_t> & dstVec = *sharedDstVec;
+    uint32_t *outPtr = dstVec.data();
+
+    memcpy(outPtr, inPtr, N * sizeof(uint32_t));
+
+    std::nth_element(begin(dstVec), begin(dstVec) + k, end(dstVec));
+  }];
+}
+
+// Smallest k values in order, radix partial sort compared to std::nth_element + std::sort
+
+- (void)testPartialSortOnePercentPerformanceOpt {
+  constexpr unsigned int N = PERF_N;
+  constexpr unsigned int k = PERF_N / 100;
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint32_t>>(N);
+  std::vector<uint32_t> & randomWordsVec = *sharedRandomWords;
+
+  constexpr unsigned int maxU32 = 0xFFFFFFFF;
+  setupRandomSelectValues(randomWordsVec, maxU32);
+
+  auto sharedDstVec = std::make_shared<std::vector<uint32_t>>(N);
+
+  [self measureBlock:^{
+    std::vector<uint32_t> & randomWords = *sharedRandomWords;
+    uint32_t *inPtr = randomWords.data();
+    std::vector<uint32_t> & dstVec = *sharedDstVec;
+    uint32_t *outPtr = dstVec.data();
+
+    memcpy(outPtr, inPtr, N * sizeof(uint32_t));
+
+    radixPartialSortOpt<3>(outPtr, 0, N, k);
+  }];
+}
+
+- (void)testPartialSortOnePercentPerformanceStd {
+  constexpr unsigned int N = PERF_N;
+  constexpr unsigned int k = PERF_N / 100;
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint32_t>>(N);
+  std::vector<uint32_t> & randomWordsVec = *sharedRandomWords;
+
+  constexpr unsigned int maxU32 = 0xFFFFFFFF;
+  setupRandomSelectValues(randomWordsVec, maxU32);
+
+  auto sharedDstVec = std::make_shared<std::vector<uint32_t>>(N);
+
+  [self measureBlock:^{
+    std::vector<uint32_t> & randomWords = *sharedRandomWords;
+    uint32_t *inPtr = randomWords.data();
+    std::vector<uint32_t> & dstVec = *sharedDstVec;
+    uint32_t *outPtr = dstVec.data();
+
+    memcpy(outPtr, inPtr, N * sizeof(uint32_t));
+
+    std::nth_element(begin(dstVec), begin(dstVec) + k, end(dstVec));
+    std::sort(begin(dstVec), begin(dstVec) + k);
+  }];
+}
+
+@end
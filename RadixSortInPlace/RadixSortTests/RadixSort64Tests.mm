@@ -0,0 +1,234 @@
+//
+//  RadixSort64Tests.mm
+//
+// 64 bit key tests for countingSortInPlaceOpt<7>, the performance tests
+// compare to ska_sort on the same uint64_t inputs.
+
+#import <XCTest/XCTest.h>
+
+#include <random>
+#include <cstddef>  // For std::ptrdiff_t
+
+#include "in_place_sort_opt.hpp"
+
+#include "ska_sort.hpp"
+
+@interface RadixSort64Tests : XCTestCase
+
+@end
+
+static
+__attribute__((noinline))
+void setupRandom64Values(std::vector<uint64_t> & inputValues, uint64_t maxNum) {
+  const unsigned int nSrcValues = (unsigned int) inputValues.size();
+
+  std::random_device                  rand_dev;
+  std::mt19937_64                     generator(rand_dev());
+
+  std::uniform_int_distribution<uint64_t>  distr(0, maxNum); // even dist between buckets
+
+  for ( int i = 0 ; i < nSrcValues; i++ ) {
+    inputValues[i] = distr(generator);
+  }
+}
+
+@implementation RadixSort64Tests
+
+- (void)testExtractDigit64 {
+  uint64_t v = 0x0807060504030201ull;
+  XCTAssert(extractDigitOpt<0>(v) == 0x01);
+  XCTAssert(extractDigitOpt<3>(v) == 0x04);
+  XCTAssert(extractDigitOpt<4>(v) == 0x05);
+  XCTAssert(extractDigitOpt<7>(v) == 0x08);
+}
+
+- (void)testCSIPCheckTriples64Opt {
+  std::vector<uint64_t> inWords{
+    0x300000000ull, 2, 0x300000000ull, 3, 0, 2, 0, 0x100000000ull, 1, 0x100000000ull
+  };
+  std::vector<uint64_t> expected{
+    0, 0, 1, 2, 2, 3, 0x100000000ull, 0x100000000ull, 0x300000000ull, 0x300000000ull
+  };
+  const unsigned int N = (int) inWords.size();
+
+  countingSortInPlaceOpt<7>(inWords.data(), 0, N);
+
+  bool same = inWords == expected;
+  XCTAssert(same);
+}
+
+- (void)testCSIPRandomU64Opt {
+  const unsigned int N = 1000000;
+  std::vector<uint64_t> inWords(N);
+  setupRandom64Values(inWords, 0xFFFFFFFFFFFFFFFFull);
+
+  std::vector<uint64_t> expected = inWords;
+  std::sort(begin(expected), end(expected));
+
+  countingSortInPlaceOpt<7>(inWords.data(), 0, N);
+
+  XCTAssert(inWords == expected);
+}
+
+- (void)testCSIPRandomU40Opt {
+  // Top three digits are zero, like a timestamp
+  const unsigned int N = 1000000;
+  std::vector<uint64_t> inWords(N);
+  setupRandom64Values(inWords, 0xFFFFFFFFFFull);
+
+  std::vector<uint64_t> expected = inWords;
+  std::sort(begin(expected), end(expected));
+
+  countingSortInPlaceOpt<7>(inWords.data(), 0, N);
+
+  XCTAssert(inWords == expected);
+}
+
+- (void)testCSIPTopDigitOnly64Opt {
+  // Only the top digit varies, every lower level is a single bucket
+  const unsigned int N = 100000;
+  std::vector<uint64_t> inWords(N);
+  setupRandom64Values(inWords, 0xFF);
+  for (auto & v : inWords) {
+    v <<= 56;
+  }
+
+  std::vector<uint64_t> expected = inWords;
+  std::sort(begin(expected), end(expected));
+
+  countingSortInPlaceOpt<7>(inWords.data(), 0, N);
+
+  bool same = inWords == expected;
+  XCTAssert(same);
+}
+
+//constexpr unsigned int PERF_N = 100000000; // 100 million numbers
+
+constexpr unsigned int PERF_N =   1073741824 / 8; // (2*30)/8 64 bit values is very very large (1 Gb x 2)
+
+- (void)testCSIPPerformanceExampleD7Opt {
+  constexpr unsigned int N = PERF_N;
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint64_t>>(N);
+  std::vector<uint64_t> & randomWordsVec = *sharedRandomWords;
+
+  constexpr uint64_t maxU64 = 0xFFFFFFFFFFFFFFFFull;
+  setupRandom64Values(randomWordsVec, maxU64);
+
+  auto sharedDstVec = std::make_shared<std::vector<uint64_t>>(N);
+
+  [self measureBlock:^{
+    std::vector<uint64_t> & randomWords = *sharedRandomWords;
+    uint64_t *inPtr = randomWords.data();
+    std::vector<uint64_t> & dstVec = *sharedDstVec;
+    uint64_t *outPtr = dstVec.data();
+
+    memcpy(outPtr, inPtr, N * sizeof(uint64_t));
+
+    countingSortInPlaceOpt<7>(outPtr, 0, N);
+
+#if defined(DEBUG)
+    {
+      std::vector<uint64_t> expected = randomWords;
+      std::sort(begin(expected), end(expected));
+      XCTAssert(expected == dstVec);
+    }
+#endif // DEBUG
+  }];
+}
+
+- (void)testSkaSortPerformanceExample64 {
+  constexpr unsigned int N = PERF_N;
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint64_t>>(N);
+  std::vector<uint64_t> & randomWordsVec = *sharedRandomWords;
+
+  constexpr uint64_t maxU64 = 0xFFFFFFFFFFFFFFFFull;
+  setupRandom64Values(randomWordsVec, maxU64);
+
+  auto sharedDstVec = std::make_shared<std::vector<uint64_t>>(N);
+
+  [self measureBlock:^{
+    std::vector<uint64_t> & randomWords = *sharedRandomWords;
+    uint64_t *inPtr = randomWords.data();
+    std::vector<uint64_t> & dstVec = *sharedDstVec;
+    uint64_t *outPtr = dstVec.data();
+
+    memcpy(outPtr, inPtr, N * sizeof(uint64_t));
+
+    ska_sort(dstVec.begin(), dstVec.end());
+
+#if defined(DEBUG)
+    {
+      std::vector<uint64_t> expected = randomWords;
+      std::sort(begin(expected), end(expected));
+      XCTAssert(expected == dstVec);
+    }
+#endif // DEBUG
+  }];
+}
+
+- (void)testCSIPPerformanceExampleU40Opt {
+  constexpr unsigned int N = PERF_N;
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint64_t>>(N);
+  std::vector<uint64_t> & randomWordsVec = *sharedRandomWords;
+
+  // Top 3 digits are zero, so the sort starts at D = 4
+  constexpr uint64_t maxU64 = 0xFFFFFFFFFFull;
+  setupRandom64Values(randomWordsVec, maxU64);
+
+  auto sharedDstVec = std::make_shared<std::vector<uint64_t>>(N);
+
+  [self measureBlock:^{
+    std::vector<uint64_t> & randomWords = *sharedRandomWords;
+    uint64_t *inPtr = randomWords.data();
+    std::vector<uint64_t> & dstVec = *sharedDstVec;
+    uint64_t *outPtr = dstVec.data();
+
+    memcpy(outPtr, inPtr, N * sizeof(uint64_t));
+
+    countingSortInPlaceOpt<7>(outPtr, 0, N);
+
+#if defined(DEBUG)
+    {
+      std::vector<uint64_t> expected = randomWords;
+      std::sort(begin(expected), end(expected));
+      XCTAssert(expected == dstVec);
+    }
+#endif // DEBUG
+  }];
+}
+
+- (void)testSkaSortPerformanceExampleU40 {
+  constexpr unsigned int N = PERF_N;
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint64_t>>(N);
+  std::vector<uint64_t> & randomWordsVec = *sharedRandomWords;
+
+  constexpr uint64_t maxU64 = 0xFFFFFFFFFFull;
+  setupRandom64Values(randomWordsVec, maxU64);
+
+  auto sharedDstVec = std::make_shared<std::vector<uint64_t>>(N);
+
+  [self measureBlock:^{
+    std::vector<uint64_t> & randomWords = *sharedRandomWords;
+    uint64_t *inPtr = randomWords.data();
+    std::vector<uint64_t> & dstVec = *sharedDstVec;
+    uint64_t *outPtr = dstVec.data();
+
+    memcpy(outPtr, inPtr, N * sizeof(uint64_t));
+
+    ska_sort(dstVec.begin(), dstVec.end());
+
+#if defined(DEBUG)
+    {
+      std::vector<uint64_t> expected = randomWords;
+      std::sort(begin(expected), end(expected));
+      XCTAssert(expected == dstVec);
+    }
+#endif // DEBUG
+  }];
+}
+
+@end
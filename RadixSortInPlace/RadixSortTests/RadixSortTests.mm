@@ -9,6 +9,7 @@
 
 #include <random>
 #include <cstddef>  // For std::ptrdiff_t
+#include <pthread.h>
 
 #include "in_place_sort_opt.hpp"
 #include "in_place_sort.hpp"
@@ -105,6 +106,22 @@ void setupRandomPixelValues(std::vector<uint32_t> & inputValues, uint32_t maxNum
   XCTAssert(s == expectedNumBytes, @"page_size %d", (int)s);
 }
 
+- (void)testHardwareInfo {
+  const hardwareInfo_t & info = hardwareInfo();
+  
+  XCTAssert(std::has_single_bit(info.cacheLineSize), @"cacheLineSize %d", (int)info.cacheLineSize);
+  XCTAssert(std::has_single_bit(info.pageSize), @"pageSize %d", (int)info.pageSize);
+  XCTAssert(info.l1DataCacheSize >= 8192, @"l1DataCacheSize %d", (int)info.l1DataCacheSize);
+  XCTAssert(info.l2CacheSize == 0 || info.l2CacheSize >= info.l1DataCacheSize);
+  XCTAssert(info.numLogicalCores >= 1);
+  XCTAssert(info.numNumaNodes >= 1);
+  
+  // Cached after the first query
+  XCTAssert(&hardwareInfo() == &info);
+  
+  XCTAssert(smallBucketMaxN() >= 16 && smallBucketMaxN() <= smallSortMaxN);
+}
+
 - (void)testCSIPIdent1Opt {
   std::vector<uint32_t> inWords{
     0
@@ -459,6 +476,36 @@ void setupRandomPixelValues(std::vector<uint32_t> & inputValues, uint32_t maxNum
   XCTAssert(arr[3] == (255+93));
 }
 
+- (void)testCSIPLowDigitsRandom1Opt {
+  // The digits above the low 2 vary, so the buckets must not be regenerated from
+  // counts and the result must be a permutation of the input
+  const unsigned int N = 100000;
+  std::vector<uint32_t> inWords(N);
+  setupRandomPixelValues(inWords, 0xFFFFFFFF);
+
+  std::vector<uint32_t> expected = inWords;
+  std::sort(begin(expected), end(expected));
+
+  countingSortInPlaceOpt<1>(inWords.data(), 0, N);
+
+  std::sort(begin(inWords), end(inWords));
+  XCTAssert(inWords == expected);
+}
+
+- (void)testCSIPLowDigitsRandom2Opt {
+  const unsigned int N = 1 << 24;
+  std::vector<uint32_t> inWords(N);
+  setupRandomPixelValues(inWords, 0xFFFFFFFF);
+
+  std::vector<uint32_t> expected = inWords;
+  std::sort(begin(expected), end(expected));
+
+  countingSortInPlaceOpt<2>(inWords.data(), 0, N);
+
+  std::sort(begin(inWords), end(inWords));
+  XCTAssert(inWords == expected);
+}
+
 - (void)testCSIPCheckPartialSkip {
   std::vector<uint32_t> inWords{
     2, 2, 3, 3, 0, 1, 0, 1
@@ -534,6 +581,436 @@ void setupRandomPixelValues(std::vector<uint32_t> & inputValues, uint32_t maxNum
   XCTAssert(same);
 }
 
+- (void)testHistogramParallelMatchesSerial {
+  const unsigned int N = 1000000;
+  std::vector<uint32_t> inWords(N);
+  setupRandomPixelValues(inWords, 0xFFFFFFFF);
+  
+  uint32_t expected[256] = {};
+  for (unsigned int i = 0; i < N; i++) {
+    expected[inWords[i] >> 24] += 1;
+  }
+  
+  for (unsigned int numThreads : {1, 2, 3, 8}) {
+    uint32_t counts[256] = {};
+    unsigned int bucketi = 256;
+    
+    histogramParallelOpt<3, 256>(inWords.data(), 0, N, bucketi, counts, numThreads);
+    
+    bool same = memcmp(counts, expected, sizeof(counts)) == 0;
+    XCTAssert(same, @"numThreads %d", numThreads);
+    XCTAssert(bucketi == (inWords[N-1] >> 24));
+  }
+}
+
+- (void)testHistogramParallelAllOneBucket {
+  // bucketi must still detect the case where all values are in one bucket
+  const unsigned int N = 100000;
+  std::vector<uint32_t> inWords(N);
+  setupRandomPixelValues(inWords, 0xFFFF);
+  
+  uint32_t counts[256] = {};
+  unsigned int bucketi = 256;
+  
+  histogramParallelOpt<2, 256>(inWords.data(), 0, N, bucketi, counts, 4);
+  
+  XCTAssert(bucketi == 0);
+  XCTAssert(counts[bucketi] == N);
+}
+
+// Each histogram kernel supported by this CPU must produce the same counts as
+// a simple loop, odd N covers the cleanup loop after the unrolled loop.
+
+- (void)testHistogramKernelsMatchScalar {
+  const unsigned int N = 100003;
+  std::vector<uint32_t> inWords(N);
+  setupRandomPixelValues(inWords, 0xFFFFFFFF);
+  // Runs of the same value in every digit
+  for (unsigned int i = 0; i < N; i += 128) {
+    for (unsigned int j = i; j < std::min(N, i + 32); j++) {
+      inWords[j] = 0x01020304;
+    }
+  }
+  
+  uint32_t expected[256] = {};
+  for (unsigned int i = 7; i < N; i++) {
+    expected[(inWords[i] >> 8) & 0xFF] += 1;
+  }
+  
+  std::vector<histogramKernel_t> kernels;
+  kernels.push_back(HISTOGRAM_KERNEL_SCALAR);
+#if defined(HISTOGRAM_SIMD_X86)
+  if (__builtin_cpu_supports("avx2")) {
+    kernels.push_back(HISTOGRAM_KERNEL_AVX2);
+  }
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512cd")) {
+    kernels.push_back(HISTOGRAM_KERNEL_AVX512);
+  }
+#endif // HISTOGRAM_SIMD_X86
+  
+  for (histogramKernel_t kernel : kernels) {
+    uint32_t counts[256] = {};
+    histogramKernelOpt<1>(inWords.data(), 7, N, counts, kernel);
+    bool same = memcmp(counts, expected, sizeof(counts)) == 0;
+    XCTAssert(same, @"kernel %d", (int)kernel);
+  }
+  
+  {
+    uint32_t counts[256] = {};
+    unsigned int bucketi = 256;
+    histogramOpt<1, 256>(inWords.data(), 7, N, bucketi, counts);
+    bool same = memcmp(counts, expected, sizeof(counts)) == 0;
+    XCTAssert(same);
+    XCTAssert(bucketi == ((inWords[N-1] >> 8) & 0xFF));
+  }
+}
+
+- (void)testRadixDiffBits {
+  std::vector<uint32_t> inWords(5000, 0x12345678);
+  XCTAssert(radixDiffBitsOpt(inWords.data(), 0, 5000) == 0);
+  
+  inWords[4999] = 0x12345679;
+  XCTAssert(radixDiffBitsOpt(inWords.data(), 0, 5000) == 0x1);
+  XCTAssert(radixFirstVaryingDigitOpt(0x1u) == 0);
+  
+  inWords[10] = 0x12355678;
+  XCTAssert(radixDiffBitsOpt(inWords.data(), 0, 5000) == 0x10001);
+  XCTAssert(radixFirstVaryingDigitOpt(0x10001u) == 2);
+  
+  // Stops after the first block once the top digit varies
+  inWords[0] = 0x92345678;
+  XCTAssert(radixFirstVaryingDigitOpt(radixDiffBitsOpt(inWords.data(), 0, 5000)) == 3);
+}
+
+- (void)testCSIPLeadingDigitSkipOpt {
+  // Top three digits are the same, the sort starts at D = 0
+  for (uint32_t maxNum : {0xFFu, 0xFFFFu, 0xFFFFFu}) {
+    const unsigned int N = 100000;
+    std::vector<uint32_t> inWords(N);
+    setupRandomPixelValues(inWords, maxNum);
+    for (auto & v : inWords) {
+      v |= 0xAB000000;
+    }
+    
+    std::vector<uint32_t> expected = inWords;
+    std::sort(begin(expected), end(expected));
+    
+    countingSortInPlaceOpt<3>(inWords.data(), 0, N);
+    
+    XCTAssert(inWords == expected, @"maxNum %d", maxNum);
+  }
+}
+
+- (void)testCSIPAllSameOpt {
+  std::vector<uint32_t> inWords(1000, 7);
+  std::vector<uint32_t> expected = inWords;
+  
+  countingSortInPlaceOpt<3>(inWords.data(), 0, 1000);
+  
+  XCTAssert(inWords == expected);
+}
+
+- (void)testCSIPRegenerateSmallDomainsOpt {
+  // 8 and 16 bit domains are regenerated from counts, with and without a shared prefix
+  for (uint32_t prefix : {0x0u, 0xABCD0000u}) {
+    for (uint32_t maxNum : {0xFFu, 0xFFFFu}) {
+      const unsigned int N = 200000;
+      std::vector<uint32_t> inWords(N);
+      setupRandomPixelValues(inWords, maxNum);
+      for (auto & v : inWords) {
+        v |= prefix;
+      }
+      
+      std::vector<uint32_t> expected = inWords;
+      std::sort(begin(expected), end(expected));
+      
+      countingSortInPlaceOpt<3>(inWords.data(), 0, N);
+      
+      XCTAssert(inWords == expected, @"prefix %x maxNum %x", prefix, maxNum);
+    }
+  }
+}
+
+- (void)testCSIPRegenerateD0Opt {
+  std::vector<uint32_t> inWords{
+    0x102, 0x1FF, 0x100, 0x102, 0x101
+  };
+  std::vector<uint32_t> expected{
+    0x100, 0x101, 0x102, 0x102, 0x1FF
+  };
+  const unsigned int N = (int) inWords.size();
+  
+  countingSortInPlaceOpt<0>(inWords.data(), 0, N);
+  
+  XCTAssert(inWords == expected);
+}
+
+- (void)testCSIPPartitionOnlyD0Opt {
+  // The digits above D = 0 differ, so a direct D = 0 call only partitions by the last digit
+  std::vector<uint32_t> inWords{
+    0x201, 0x100, 0x301, 0x200
+  };
+  const unsigned int N = (int) inWords.size();
+  
+  countingSortInPlaceOpt<0>(inWords.data(), 0, N);
+  
+  XCTAssert((inWords[0] & 0xFF) == 0 && (inWords[1] & 0xFF) == 0);
+  XCTAssert((inWords[2] & 0xFF) == 1 && (inWords[3] & 0xFF) == 1);
+  std::sort(begin(inWords), end(inWords));
+  std::vector<uint32_t> expected{
+    0x100, 0x200, 0x201, 0x301
+  };
+  XCTAssert(inWords == expected);
+}
+
+- (void)testCSIPLargeIndexOpt {
+  // A range that fits in 32 bits is rebased, so starti need not be zero
+  const unsigned int N = 100000;
+  std::vector<uint32_t> inWords(N + 1);
+  setupRandomPixelValues(inWords, 0xFFFFFFFF);
+
+  std::vector<uint32_t> expected = inWords;
+  std::sort(begin(expected) + 1, end(expected));
+
+  countingSortInPlaceOptLarge<3>(inWords.data(), (size_t) 1, (size_t) (N + 1));
+
+  XCTAssert(inWords == expected);
+}
+
+- (void)testCSIPLargeIndexPartitionOpt {
+  // 64 bit counts and offsets, a real range of more than 4G values does not fit in test memory
+  const unsigned int N = 100000;
+  std::vector<uint32_t> inWords(N);
+  setupRandomPixelValues(inWords, 0xFFFFFFFF);
+
+  std::vector<uint32_t> expected = inWords;
+  std::sort(begin(expected), end(expected));
+
+  countingSortInPlaceOptPartition<3, size_t>(inWords.data(), 0, N, [](uint32_t *arr, size_t starti, size_t endi) {
+    recurseBucketOptLarge<3>(arr, starti, endi);
+  });
+
+  XCTAssert(inWords == expected);
+}
+
+- (void)testCSIPBlockPartitionOpt {
+  // Range does not begin or end on a block boundary
+  const unsigned int N = 100003;
+  std::vector<uint32_t> inWords(N + 5);
+  setupRandomPixelValues(inWords, 0xFFFFFFFF);
+
+  std::vector<uint32_t> expected = inWords;
+  std::sort(begin(expected) + 5, end(expected));
+
+  countingSortInPlaceOptBlockPartition<3, unsigned int>(inWords.data(), 5, N + 5, [](uint32_t *arr, unsigned int starti, unsigned int endi) {
+    recurseBucketOpt<3>(arr, starti, endi);
+  });
+
+  XCTAssert(inWords == expected);
+}
+
+- (void)testCSIPBlockPartitionLargeOpt {
+  // Large enough that the top level partition uses blocks
+  const unsigned int N = (unsigned int) (blockPermuteMinBytes / sizeof(uint32_t)) + 1000;
+  std::vector<uint32_t> inWords(N);
+  setupRandomPixelValues(inWords, 0xFFFFFFFF);
+
+  std::vector<uint32_t> expected = inWords;
+  std::sort(begin(expected), end(expected));
+
+  countingSortInPlaceOpt<3>(inWords.data(), 0, N);
+
+  XCTAssert(inWords == expected);
+}
+
+- (void)testCSIPKnownCountsOpt {
+  // Digit 2 histogram counted by the caller, as the block partition does with FUSED_CHILD_HISTOGRAM
+  const unsigned int N = 100000;
+  std::vector<uint32_t> inWords(N);
+  setupRandomPixelValues(inWords, 0x00FFFFFF);
+
+  std::vector<uint32_t> expected = inWords;
+  std::sort(begin(expected), end(expected));
+
+  unsigned int counts[256] = {};
+  for (uint32_t v : inWords) {
+    counts[(v >> 16) & 0xFF] += 1;
+  }
+
+  countingSortInPlaceOptKnownCounts<2>(inWords.data(), 0, N, counts);
+
+  XCTAssert(inWords == expected);
+}
+
+- (void)testCSIPMidSizeOpt {
+  // Top digit buckets of about 256 values with 3 varying digits are LSD sorted
+  const unsigned int N = 1 << 16;
+  std::vector<uint32_t> inWords(N);
+  setupRandomPixelValues(inWords, 0xFFFFFFFF);
+
+  std::vector<uint32_t> expected = inWords;
+  std::sort(begin(expected), end(expected));
+
+  countingSortInPlaceOpt<3>(inWords.data(), 0, N);
+
+  XCTAssert(inWords == expected);
+}
+
+- (void)testCSIPMidSizeSkippedDigitsOpt {
+  // Ranges of 200 to 16K 64 bit keys, only 3 digits vary so the whole range is LSD sorted
+  for (unsigned int N : { 200, 1000, 5000, 16384 }) {
+    std::vector<uint64_t> inWords(N);
+    std::mt19937_64 generator(N);
+    for (unsigned int i = 0; i < N; i++) {
+      inWords[i] = generator() & 0xFF000000FF00FF00;
+    }
+
+    std::vector<uint64_t> expected = inWords;
+    std::sort(begin(expected), end(expected));
+
+    countingSortInPlaceOpt<7>(inWords.data(), 0, N);
+
+    XCTAssert(inWords == expected);
+  }
+}
+
+- (void)testCSIPMidSizeFloatOpt {
+  const unsigned int N = 1 << 16;
+  std::mt19937 generator(N);
+  std::uniform_real_distribution<float> floatDist(-1000.0f, 1000.0f);
+  std::vector<float> inFloats(N);
+  for (unsigned int i = 0; i < N; i++) {
+    inFloats[i] = floatDist(generator);
+  }
+
+  std::vector<float> expected = inFloats;
+  std::sort(begin(expected), end(expected));
+
+  countingSortInPlaceOpt<3>(inFloats.data(), 0, N);
+
+  XCTAssert(inFloats == expected);
+}
+
+- (void)testCSIPWideTopDigitOpt {
+  // Top digit of 11, 12 and 16 bits, the schedule only picks these when
+  // WIDE_TOP_DIGIT_MIN_N is defined
+  const unsigned int N = 1000000;
+  std::vector<uint32_t> randomWords(N);
+  setupRandomPixelValues(randomWords, 0xFFFFFFFF);
+
+  std::vector<uint32_t> expected = randomWords;
+  std::sort(begin(expected), end(expected));
+
+  for (unsigned int bits : { 11, 12, 16 }) {
+    std::vector<uint32_t> inWords = randomWords;
+    countingSortInPlaceOptWide(inWords.data(), 0u, N, bits);
+    XCTAssert(inWords == expected);
+  }
+}
+
+- (void)testCSIPWideTopDigitSignedOpt {
+  const unsigned int N = 1000000;
+  std::mt19937 generator(N);
+  std::uniform_real_distribution<float> floatDist(-1000.0f, 1000.0f);
+  std::vector<float> randomFloats(N);
+  for (unsigned int i = 0; i < N; i++) {
+    randomFloats[i] = floatDist(generator);
+  }
+
+  std::vector<float> expected = randomFloats;
+  std::sort(begin(expected), end(expected));
+
+  for (unsigned int bits : { 11, 12, 16 }) {
+    std::vector<float> inFloats = randomFloats;
+    countingSortInPlaceOptWide(inFloats.data(), 0u, N, bits);
+    XCTAssert(inFloats == expected);
+  }
+}
+
+- (void)testCSIPStackOpt {
+  const unsigned int N = 100000;
+  std::vector<uint32_t> inWords(N);
+  setupRandomPixelValues(inWords, 0xFFFFFFFF);
+
+  std::vector<uint32_t> expected = inWords;
+  std::sort(begin(expected), end(expected));
+
+  countingSortInPlaceOptStack<3>(inWords.data(), 0, N);
+
+  XCTAssert(inWords == expected);
+}
+
+- (void)testCSIPStackSignedOpt {
+  // Signed keys are partitioned by radix key digits below the top digit too
+  const unsigned int N = 100000;
+  std::vector<uint32_t> inWords(N);
+  setupRandomPixelValues(inWords, 0xFFFFFFFF);
+
+  std::vector<int32_t> inInts(begin(inWords), end(inWords));
+  std::vector<int32_t> expected = inInts;
+  std::sort(begin(expected), end(expected));
+
+  countingSortInPlaceOptStack<3>(inInts.data(), 0, N);
+
+  XCTAssert(inInts == expected);
+}
+
+- (void)testCSIPStackLowDigitsOpt {
+  // The digits above D vary, so no bucket may be regenerated from counts and each
+  // result must be a permutation of the input
+  std::vector<uint32_t> randomWords(1 << 22);
+  setupRandomPixelValues(randomWords, 0xFFFFFFFF);
+
+  for (unsigned int N : { 1000, 100000, 1 << 22 }) {
+    std::vector<uint32_t> expected(begin(randomWords), begin(randomWords) + N);
+    std::sort(begin(expected), end(expected));
+
+    std::vector<uint32_t> inWords0(begin(randomWords), begin(randomWords) + N);
+    countingSortInPlaceOptStack<0>(inWords0.data(), 0, N);
+    std::sort(begin(inWords0), end(inWords0));
+    XCTAssert(inWords0 == expected);
+
+    std::vector<uint32_t> inWords1(begin(randomWords), begin(randomWords) + N);
+    countingSortInPlaceOptStack<1>(inWords1.data(), 0, N);
+    std::sort(begin(inWords1), end(inWords1));
+    XCTAssert(inWords1 == expected);
+
+    std::vector<uint32_t> inWords2(begin(randomWords), begin(randomWords) + N);
+    countingSortInPlaceOptStack<2>(inWords2.data(), 0, N);
+    std::sort(begin(inWords2), end(inWords2));
+    XCTAssert(inWords2 == expected);
+  }
+}
+
+- (void)testCSIPStackSmallThreadStackOpt {
+  // 64 bit keys sorted on a thread with a 64 KB stack
+  const unsigned int N = 1 << 20;
+  std::vector<uint64_t> inWords(N);
+  std::mt19937_64 generator(N);
+  for (unsigned int i = 0; i < N; i++) {
+    inWords[i] = generator();
+  }
+
+  std::vector<uint64_t> expected = inWords;
+  std::sort(begin(expected), end(expected));
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, 64 * 1024);
+
+  pthread_t thread;
+  int err = pthread_create(&thread, &attr, [](void *ptr) -> void * {
+    std::vector<uint64_t> & words = *((std::vector<uint64_t> *) ptr);
+    countingSortInPlaceOptStack<7>(words.data(), 0, (unsigned int) words.size());
+    return nullptr;
+  }, &inWords);
+  XCTAssert(err == 0);
+  pthread_join(thread, nullptr);
+  pthread_attr_destroy(&attr);
+
+  XCTAssert(inWords == expected);
+}
+
 //constexpr unsigned int PERF_N = 100;
 
 //constexpr unsigned int PERF_N = 100000; // 100 thousand numbers
@@ -878,6 +1355,112 @@ constexpr unsigned int PERF_N =   1073741824 / 4; // (2*30)/4 is very very large
     
 }
 
+- (void)testCSIPPerformanceExampleU16Opt {
+  constexpr unsigned int N = PERF_N;
+  //constexpr unsigned int N = 100000;
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint32_t>>(N);
+  std::vector<uint32_t> & randomWordsVec = *sharedRandomWords;
+  
+  // Dense 16 bit ids, the top two digits are the same in all values and are skipped
+  constexpr unsigned int maxU32 = 0xFFFF;
+  setupRandomPixelValues(randomWordsVec, maxU32);
+    
+  auto sharedDstVec = std::make_shared<std::vector<uint32_t>>(N);
+  std::vector<uint32_t> & dstVec = *sharedDstVec;
+  uint32_t *outOrigArr = dstVec.data();
+  memset(outOrigArr, 0, N * sizeof(uint32_t));
+  
+  [self measureBlock:^{
+    for (int i = 0; i < PERFORMANCE_VERY_BIG_N_NUM_LOOPS_TEST; i++) {
+      std::vector<uint32_t> & randomWords = *sharedRandomWords;
+      uint32_t *inPtr = randomWords.data();
+      std::vector<uint32_t> & dstVec = *sharedDstVec;
+      uint32_t *outPtr = dstVec.data();
+      
+      memcpy(outPtr, inPtr, N * sizeof(uint32_t));
+      
+      countingSortInPlaceOpt<3>(outPtr, 0, N);
+      
+#if defined(DEBUG)
+      {
+        std::vector<uint32_t> expected;
+        {
+          std::vector<uint32_t> stdSorted = randomWords;
+          std::sort(begin(stdSorted), end(stdSorted));
+          expected = stdSorted;
+        }
+        bool passed = true;
+        for (int exi = 0; exi < expected.size(); exi++) {
+          if (expected[exi] != outPtr[exi]) {
+            XCTAssert(false, "%d != %d : at exi %d", expected[exi], outPtr[exi], exi);
+            passed = false;
+            break;
+          }
+        }
+        if (!passed) {
+          break;
+        }
+      }
+#endif // DEBUG
+    }
+  }];
+    
+}
+
+- (void)testCSIPPerformanceExampleU8D3Opt {
+  constexpr unsigned int N = PERF_N;
+  //constexpr unsigned int N = 100000;
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint32_t>>(N);
+  std::vector<uint32_t> & randomWordsVec = *sharedRandomWords;
+  
+  // 8 bit labels, the output is regenerated from the counts
+  constexpr unsigned int maxU32 = 0xFF;
+  setupRandomPixelValues(randomWordsVec, maxU32);
+    
+  auto sharedDstVec = std::make_shared<std::vector<uint32_t>>(N);
+  std::vector<uint32_t> & dstVec = *sharedDstVec;
+  uint32_t *outOrigArr = dstVec.data();
+  memset(outOrigArr, 0, N * sizeof(uint32_t));
+  
+  [self measureBlock:^{
+    for (int i = 0; i < PERFORMANCE_VERY_BIG_N_NUM_LOOPS_TEST; i++) {
+      std::vector<uint32_t> & randomWords = *sharedRandomWords;
+      uint32_t *inPtr = randomWords.data();
+      std::vector<uint32_t> & dstVec = *sharedDstVec;
+      uint32_t *outPtr = dstVec.data();
+      
+      memcpy(outPtr, inPtr, N * sizeof(uint32_t));
+      
+      countingSortInPlaceOpt<3>(outPtr, 0, N);
+      
+#if defined(DEBUG)
+      {
+        std::vector<uint32_t> expected;
+        {
+          std::vector<uint32_t> stdSorted = randomWords;
+          std::sort(begin(stdSorted), end(stdSorted));
+          expected = stdSorted;
+        }
+        bool passed = true;
+        for (int exi = 0; exi < expected.size(); exi++) {
+          if (expected[exi] != outPtr[exi]) {
+            XCTAssert(false, "%d != %d : at exi %d", expected[exi], outPtr[exi], exi);
+            passed = false;
+            break;
+          }
+        }
+        if (!passed) {
+          break;
+        }
+      }
+#endif // DEBUG
+    }
+  }];
+    
+}
+
 - (void)testSkaSortPerformanceExample {
   constexpr unsigned int N = PERF_N;
   
@@ -987,6 +1570,33 @@ constexpr unsigned int PERF_N =   1073741824 / 4; // (2*30)/4 is very very large
     
 }
 
+// Top level histogram pass by itself, ranges of at least parallelHistogramMinN values
+// are split across all hardware threads.
+
+- (void)testHistogramPerformanceD3 {
+  constexpr unsigned int N = PERF_N;
+  
+  auto sharedRandomWords = std::make_shared<std::vector<uint32_t>>(N);
+  std::vector<uint32_t> & randomWordsVec = *sharedRandomWords;
+  
+  constexpr unsigned int maxU32 = 0xFFFFFFFF;
+  setupRandomPixelValues(randomWordsVec, maxU32);
+  
+  [self measureBlock:^{
+    for (int i = 0; i < PERFORMANCE_VERY_BIG_N_NUM_LOOPS_TEST; i++) {
+      std::vector<uint32_t> & randomWords = *sharedRandomWords;
+      uint32_t *inPtr = randomWords.data();
+      
+      uint32_t counts[256] = {};
+      unsigned int bucketi = 256;
+      
+      histogramOpt<3, 256>(inPtr, 0, N, bucketi, counts);
+      
+      XCTAssert(bucketi < 256);
+    }
+  }];
+}
+
 // Worst case, only 2 buckets used but the last element in the second bucket is needed to
 // close out the first bucket.
 
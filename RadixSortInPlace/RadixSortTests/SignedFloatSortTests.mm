@@ -0,0 +1,177 @@
+//
+//  SignedFloatSortTests.mm
+//
+// Signed integer and floating point key tests, the radixKeyOpt() transform
+// is applied as each digit is extracted so there is no pre or post pass.
+
+#import <XCTest/XCTest.h>
+
+#include <random>
+#include <cmath>
+#include <limits>
+#include <cstddef>  // For std::ptrdiff_t
+
+#include "in_place_sort_opt.hpp"
+
+@interface SignedFloatSortTests : XCTestCase
+
+@end
+
+static
+__attribute__((noinline))
+void setupRandomFloatValues(std::vector<float> & inputValues, float stddev) {
+  const unsigned int nSrcValues = (unsigned int) inputValues.size();
+
+  std::random_device                  rand_dev;
+  std::mt19937                        generator(rand_dev());
+
+  std::normal_distribution<float>     distr(0.0f, stddev);
+
+  for ( int i = 0 ; i < nSrcValues; i++ ) {
+    inputValues[i] = distr(generator);
+  }
+}
+
+@implementation SignedFloatSortTests
+
+- (void)testRadixKeyInverse {
+  for (int32_t v : {std::numeric_limits<int32_t>::min(), -1, 0, 1, std::numeric_limits<int32_t>::max()}) {
+    XCTAssert(radixKeyInverseOpt<int32_t>(radixKeyOpt(v)) == v);
+  }
+  for (float v : {-INFINITY, -1.5f, -0.0f, 0.0f, 1.5f, INFINITY}) {
+    float inv = radixKeyInverseOpt<float>(radixKeyOpt(v));
+    XCTAssert(memcmp(&inv, &v, sizeof(v)) == 0);
+  }
+}
+
+- (void)testSignedSmall {
+  std::vector<int32_t> inWords{
+    3, -2, 0, -2147483647 - 1, 2147483647, -1, 1, -3
+  };
+  std::vector<int32_t> expected{
+    -2147483647 - 1, -3, -2, -1, 0, 1, 3, 2147483647
+  };
+  const unsigned int N = (int) inWords.size();
+
+  countingSortInPlaceOpt<3>(inWords.data(), 0, N);
+
+  XCTAssert(inWords == expected);
+}
+
+- (void)testFloatNaNAndNegativeZeroOrder {
+  // -NaN < -inf < ... < -0.0 < +0.0 < ... < +inf < +NaN
+  const float nan = std::numeric_limits<float>::quiet_NaN();
+  std::vector<float> inWords{
+    1.0f, nan, -0.0f, INFINITY, -nan, 0.0f, -1.0f, -INFINITY
+  };
+  const unsigned int N = (int) inWords.size();
+
+  countingSortInPlaceOpt<3>(inWords.data(), 0, N);
+
+  XCTAssert(std::isnan(inWords[0]) && std::signbit(inWords[0]));
+  XCTAssert(inWords[1] == -INFINITY);
+  XCTAssert(inWords[2] == -1.0f);
+  XCTAssert(inWords[3] == 0.0f && std::signbit(inWords[3]));
+  XCTAssert(inWords[4] == 0.0f && !std::signbit(inWords[4]));
+  XCTAssert(inWords[5] == 1.0f);
+  XCTAssert(inWords[6] == INFINITY);
+  XCTAssert(std::isnan(inWords[7]) && !std::signbit(inWords[7]));
+}
+
+- (void)testSignedRandom {
+  std::mt19937_64 generator(1);
+  for (unsigned int N : {100, 10000, 1000000}) {
+    std::vector<int32_t> inWords32(N);
+    std::vector<int64_t> inWords64(N);
+    for (unsigned int i = 0; i < N; i++) {
+      inWords32[i] = (int32_t) generator();
+      inWords64[i] = (int64_t) generator();
+    }
+
+    std::vector<int32_t> expected32 = inWords32;
+    std::sort(begin(expected32), end(expected32));
+    std::vector<int64_t> expected64 = inWords64;
+    std::sort(begin(expected64), end(expected64));
+
+    countingSortInPlaceOpt<3>(inWords32.data(), 0, N);
+    countingSortInPlaceOpt<7>(inWords64.data(), 0, N);
+
+    XCTAssert(inWords32 == expected32, @"N %d", N);
+    XCTAssert(inWords64 == expected64, @"N %d", N);
+  }
+}
+
+- (void)testFloatRandomWithSpecialValues {
+  std::mt19937 generator(1);
+  for (unsigned int N : {100, 10000, 1000000}) {
+    std::vector<float> inWords(N);
+    setupRandomFloatValues(inWords, 1000.0f);
+    for (unsigned int i = 0; i < N; i += 7) {
+      const float special[] = {
+        -0.0f, 0.0f, INFINITY, -INFINITY, std::numeric_limits<float>::quiet_NaN()
+      };
+      inWords[i] = special[generator() % 5];
+    }
+
+    std::vector<double> inWords64(begin(inWords), end(inWords));
+
+    // NaN is not ordered by operator<, so sort by the radix key and compare the bits of
+    // each value so that NaN and -0.0 are checked exactly
+    std::vector<float> expected = inWords;
+    std::sort(begin(expected), end(expected), [](float v0, float v1) {
+      return radixKeyOpt(v0) < radixKeyOpt(v1);
+    });
+    std::vector<double> expected64 = inWords64;
+    std::sort(begin(expected64), end(expected64), [](double v0, double v1) {
+      return radixKeyOpt(v0) < radixKeyOpt(v1);
+    });
+
+    countingSortInPlaceOpt<3>(inWords.data(), 0, N);
+    countingSortInPlaceOpt<7>(inWords64.data(), 0, N);
+
+    XCTAssert(memcmp(inWords.data(), expected.data(), N * sizeof(float)) == 0, @"N %d", N);
+    XCTAssert(memcmp(inWords64.data(), expected64.data(), N * sizeof(double)) == 0, @"N %d", N);
+  }
+}
+
+//constexpr unsigned int PERF_N = 100000000; // 100 million numbers
+
+constexpr unsigned int PERF_N =   1073741824 / 4; // (2*30)/4 is very very large (1 Gb x 2)
+
+- (void)testFloatPerformanceD3Opt {
+  constexpr unsigned int N = PERF_N;
+
+  auto sharedRandomWords = std::make_shared<std::vector<float>>(N);
+  setupRandomFloatValues(*sharedRandomWords, 1000.0f);
+
+  auto sharedDstVec = std::make_shared<std::vector<float>>(N);
+
+  [self measureBlock:^{
+    std::vector<float> & dstVec = *sharedDstVec;
+    memcpy(dstVec.data(), sharedRandomWords->data(), N * sizeof(float));
+
+    countingSortInPlaceOpt<3>(dstVec.data(), 0, N);
+
+#if defined(DEBUG)
+    XCTAssert(std::is_sorted(begin(dstVec), end(dstVec)));
+#endif // DEBUG
+  }];
+}
+
+- (void)testFloatPerformanceStdSort {
+  constexpr unsigned int N = PERF_N;
+
+  auto sharedRandomWords = std::make_shared<std::vector<float>>(N);
+  setupRandomFloatValues(*sharedRandomWords, 1000.0f);
+
+  auto sharedDstVec = std::make_shared<std::vector<float>>(N);
+
+  [self measureBlock:^{
+    std::vector<float> & dstVec = *sharedDstVec;
+    memcpy(dstVec.data(), sharedRandomWords->data(), N * sizeof(float));
+
+    std::sort(begin(dstVec), end(dstVec));
+  }];
+}
+
+@end
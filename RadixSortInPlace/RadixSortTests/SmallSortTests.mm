@@ -0,0 +1,335 @@
+//
+//  SmallSortTests.mm
+//
+// Sorting network tests for the small bucket case, the performance tests sort
+// SMALL_PERF_N values as independent runs of one size class, once with
+// std::sort and once with smallSortOpt() so the two can be compared.
+
+#import <XCTest/XCTest.h>
+
+#include <random>
+#include <cstddef>  // For std::ptrdiff_t
+
+#include "small_sort_simd.hpp"
+
+@interface SmallSortTests : XCTestCase
+
+@end
+
+static
+__attribute__((noinline))
+void setupRandomSmallSortValues(std::vector<uint32_t> & inputValues, uint32_t maxNum) {
+  const unsigned int nSrcValues = (unsigned int) inputValues.size();
+
+  std::random_device                  rand_dev;
+  std::mt19937                        generator(rand_dev());
+
+  std::uniform_int_distribution<uint32_t>  distr(0, maxNum); // even dist between buckets
+
+  for ( int i = 0 ; i < nSrcValues; i++ ) {
+    inputValues[i] = distr(generator);
+  }
+}
+
+@implementation SmallSortTests
+
+- (void)testSmallSortRandomU32 {
+  // Sort every size from 0 to smallSortMaxN inside a larger buffer so that
+  // a write outside of [starti, endi) is detected
+  for (int i = 0; i < 100; i++) {
+    for (unsigned int n = 0; n <= smallSortMaxN; n++) {
+      std::vector<uint32_t> inWords(n + 2);
+      setupRandomSmallSortValues(inWords, 0xFFFFFFFF);
+
+      std::vector<uint32_t> expected = inWords;
+      std::sort(begin(expected) + 1, end(expected) - 1);
+
+      smallSortOpt(inWords.data(), 1, n + 1);
+
+      XCTAssert(inWords == expected, @"n %d", n);
+    }
+  }
+}
+
+- (void)testSmallSortDuplicates {
+  // Many equal values, including 0xFFFFFFFF which is also the padding value
+  for (int i = 0; i < 100; i++) {
+    for (unsigned int n = 0; n <= smallSortMaxN; n++) {
+      std::vector<uint32_t> inWords(n + 2);
+      setupRandomSmallSortValues(inWords, 3);
+
+      std::vector<uint32_t> expected = inWords;
+      std::sort(begin(expected) + 1, end(expected) - 1);
+
+      smallSortOpt(inWords.data(), 1, n + 1);
+
+      XCTAssert(inWords == expected, @"n %d", n);
+    }
+  }
+
+  std::vector<uint32_t> inWords(smallSortMaxN, 0xFFFFFFFF);
+  inWords[smallSortMaxN / 2] = 0;
+  smallSortOpt(inWords.data(), 0, smallSortMaxN);
+  XCTAssert(inWords[0] == 0);
+  XCTAssert(inWords[smallSortMaxN - 1] == 0xFFFFFFFF);
+}
+
+constexpr unsigned int SMALL_PERF_N = 1 << 24;
+
+- (void)testSmallSortPerformance16StdSort {
+  constexpr unsigned int N = SMALL_PERF_N;
+  constexpr unsigned int runN = 16;
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint32_t>>(N);
+  std::vector<uint32_t> & randomWordsVec = *sharedRandomWords;
+
+  constexpr unsigned int maxU32 = 0xFFFFFFFF;
+  setupRandomSmallSortValues(randomWordsVec, maxU32);
+
+  auto sharedDstVec = std::make_shared<std::vector<uint32_t>>(N);
+
+  [self measureBlock:^{
+    std::vector<uint32_t> & randomWords = *sharedRandomWords;
+    uint32_t *inPtr = randomWords.data();
+    std::vector<uint32_t> & dstVec = *sharedDstVec;
+    uint32_t *outPtr = dstVec.data();
+
+    memcpy(outPtr, inPtr, N * sizeof(uint32_t));
+
+    for (unsigned int starti = 0; (starti + runN) <= N; starti += runN) {
+      std::sort(outPtr + starti, outPtr + starti + runN);
+    }
+
+#if defined(DEBUG)
+    for (unsigned int starti = 0; (starti + runN) <= N; starti += runN) {
+      XCTAssert(std::is_sorted(outPtr + starti, outPtr + starti + runN));
+    }
+#endif // DEBUG
+  }];
+}
+
+- (void)testSmallSortPerformance16Network {
+  constexpr unsigned int N = SMALL_PERF_N;
+  constexpr unsigned int runN = 16;
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint32_t>>(N);
+  std::vector<uint32_t> & randomWordsVec = *sharedRandomWords;
+
+  constexpr unsigned int maxU32 = 0xFFFFFFFF;
+  setupRandomSmallSortValues(randomWordsVec, maxU32);
+
+  auto sharedDstVec = std::make_shared<std::vector<uint32_t>>(N);
+
+  [self measureBlock:^{
+    std::vector<uint32_t> & randomWords = *sharedRandomWords;
+    uint32_t *inPtr = randomWords.data();
+    std::vector<uint32_t> & dstVec = *sharedDstVec;
+    uint32_t *outPtr = dstVec.data();
+
+    memcpy(outPtr, inPtr, N * sizeof(uint32_t));
+
+    for (unsigned int starti = 0; (starti + runN) <= N; starti += runN) {
+      smallSortOpt(outPtr, starti, starti + runN);
+    }
+
+#if defined(DEBUG)
+    for (unsigned int starti = 0; (starti + runN) <= N; starti += runN) {
+      XCTAssert(std::is_sorted(outPtr + starti, outPtr + starti + runN));
+    }
+#endif // DEBUG
+  }];
+}
+
+- (void)testSmallSortPerformance32StdSort {
+  constexpr unsigned int N = SMALL_PERF_N;
+  constexpr unsigned int runN = 32;
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint32_t>>(N);
+  std::vector<uint32_t> & randomWordsVec = *sharedRandomWords;
+
+  constexpr unsigned int maxU32 = 0xFFFFFFFF;
+  setupRandomSmallSortValues(randomWordsVec, maxU32);
+
+  auto sharedDstVec = std::make_shared<std::vector<uint32_t>>(N);
+
+  [self measureBlock:^{
+    std::vector<uint32_t> & randomWords = *sharedRandomWords;
+    uint32_t *inPtr = randomWords.data();
+    std::vector<uint32_t> & dstVec = *sharedDstVec;
+    uint32_t *outPtr = dstVec.data();
+
+    memcpy(outPtr, inPtr, N * sizeof(uint32_t));
+
+    for (unsigned int starti = 0; (starti + runN) <= N; starti += runN) {
+      std::sort(outPtr + starti, outPtr + starti + runN);
+    }
+
+#if defined(DEBUG)
+    for (unsigned int starti = 0; (starti + runN) <= N; starti += runN) {
+      XCTAssert(std::is_sorted(outPtr + starti, outPtr + starti + runN));
+    }
+#endif // DEBUG
+  }];
+}
+
+- (void)testSmallSortPerformance32Network {
+  constexpr unsigned int N = SMALL_PERF_N;
+  constexpr unsigned int runN = 32;
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint32_t>>(N);
+  std::vector<uint32_t> & randomWordsVec = *sharedRandomWords;
+
+  constexpr unsigned int maxU32 = 0xFFFFFFFF;
+  setupRandomSmallSortValues(randomWordsVec, maxU32);
+
+  auto sharedDstVec = std::make_shared<std::vector<uint32_t>>(N);
+
+  [self measureBlock:^{
+    std::vector<uint32_t> & randomWords = *sharedRandomWords;
+    uint32_t *inPtr = randomWords.data();
+    std::vector<uint32_t> & dstVec = *sharedDstVec;
+    uint32_t *outPtr = dstVec.data();
+
+    memcpy(outPtr, inPtr, N * sizeof(uint32_t));
+
+    for (unsigned int starti = 0; (starti + runN) <= N; starti += runN) {
+      smallSortOpt(outPtr, starti, starti + runN);
+    }
+
+#if defined(DEBUG)
+    for (unsigned int starti = 0; (starti + runN) <= N; starti += runN) {
+      XCTAssert(std::is_sorted(outPtr + starti, outPtr + starti + runN));
+    }
+#endif // DEBUG
+  }];
+}
+
+- (void)testSmallSortPerformance64StdSort {
+  constexpr unsigned int N = SMALL_PERF_N;
+  constexpr unsigned int runN = 64;
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint32_t>>(N);
+  std::vector<uint32_t> & randomWordsVec = *sharedRandomWords;
+
+  constexpr unsigned int maxU32 = 0xFFFFFFFF;
+  setupRandomSmallSortValues(randomWordsVec, maxU32);
+
+  auto sharedDstVec = std::make_shared<std::vector<uint32_t>>(N);
+
+  [self measureBlock:^{
+    std::vector<uint32_t> & randomWords = *sharedRandomWords;
+    uint32_t *inPtr = randomWords.data();
+    std::vector<uint32_t> & dstVec = *sharedDstVec;
+    uint32_t *outPtr = dstVec.data();
+
+    memcpy(outPtr, inPtr, N * sizeof(uint32_t));
+
+    for (unsigned int starti = 0; (starti + runN) <= N; starti += runN) {
+      std::sort(outPtr + starti, outPtr + starti + runN);
+    }
+
+#if defined(DEBUG)
+    for (unsigned int starti = 0; (starti + runN) <= N; starti += runN) {
+      XCTAssert(std::is_sorted(outPtr + starti, outPtr + starti + runN));
+    }
+#endif // DEBUG
+  }];
+}
+
+- (void)testSmallSortPerformance64Network {
+  constexpr unsigned int N = SMALL_PERF_N;
+  constexpr unsigned int runN = 64;
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint32_t>>(N);
+  std::vector<uint32_t> & randomWordsVec = *sharedRandomWords;
+
+  constexpr unsigned int maxU32 = 0xFFFFFFFF;
+  setupRandomSmallSortValues(randomWordsVec, maxU32);
+
+  auto sharedDstVec = std::make_shared<std::vector<uint32_t>>(N);
+
+  [self measureBlock:^{
+    std::vector<uint32_t> & randomWords = *sharedRandomWords;
+    uint32_t *inPtr = randomWords.data();
+    std::vector<uint32_t> & dstVec = *sharedDstVec;
+    uint32_t *outPtr = dstVec.data();
+
+    memcpy(outPtr, inPtr, N * sizeof(uint32_t));
+
+    for (unsigned int starti = 0; (starti + runN) <= N; starti += runN) {
+      smallSortOpt(outPtr, starti, starti + runN);
+    }
+
+#if defined(DEBUG)
+    for (unsigned int starti = 0; (starti + runN) <= N; starti += runN) {
+      XCTAssert(std::is_sorted(outPtr + starti, outPtr + starti + runN));
+    }
+#endif // DEBUG
+  }];
+}
+
+- (void)testSmallSortPerformance128StdSort {
+  constexpr unsigned int N = SMALL_PERF_N;
+  constexpr unsigned int runN = 128;
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint32_t>>(N);
+  std::vector<uint32_t> & randomWordsVec = *sharedRandomWords;
+
+  constexpr unsigned int maxU32 = 0xFFFFFFFF;
+  setupRandomSmallSortValues(randomWordsVec, maxU32);
+
+  auto sharedDstVec = std::make_shared<std::vector<uint32_t>>(N);
+
+  [self measureBlock:^{
+    std::vector<uint32_t> & randomWords = *sharedRandomWords;
+    uint32_t *inPtr = randomWords.data();
+    std::vector<uint32_t> & dstVec = *sharedDstVec;
+    uint32_t *outPtr = dstVec.data();
+
+    memcpy(outPtr, inPtr, N * sizeof(uint32_t));
+
+    for (unsigned int starti = 0; (starti + runN) <= N; starti += runN) {
+      std::sort(outPtr + starti, outPtr + starti + runN);
+    }
+
+#if defined(DEBUG)
+    for (unsigned int starti = 0; (starti + runN) <= N; starti += runN) {
+      XCTAssert(std::is_sorted(outPtr + starti, outPtr + starti + runN));
+    }
+#endif // DEBUG
+  }];
+}
+
+- (void)testSmallSortPerformance128Network {
+  constexpr unsigned int N = SMALL_PERF_N;
+  constexpr unsigned int runN = 128;
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint32_t>>(N);
+  std::vector<uint32_t> & randomWordsVec = *sharedRandomWords;
+
+  constexpr unsigned int maxU32 = 0xFFFFFFFF;
+  setupRandomSmallSortValues(randomWordsVec, maxU32);
+
+  auto sharedDstVec = std::make_shared<std::vector<uint32_t>>(N);
+
+  [self measureBlock:^{
+    std::vector<uint32_t> & randomWords = *sharedRandomWords;
+    uint32_t *inPtr = randomWords.data();
+    std::vector<uint32_t> & dstVec = *sharedDstVec;
+    uint32_t *outPtr = dstVec.data();
+
+    memcpy(outPtr, inPtr, N * sizeof(uint32_t));
+
+    for (unsigned int starti = 0; (starti + runN) <= N; starti += runN) {
+      smallSortOpt(outPtr, starti, starti + runN);
+    }
+
+#if defined(DEBUG)
+    for (unsigned int starti = 0; (starti + runN) <= N; starti += runN) {
+      XCTAssert(std::is_sorted(outPtr + starti, outPtr + starti + runN));
+    }
+#endif // DEBUG
+  }];
+}
+
+@end
@@ -0,0 +1,261 @@
+//
+//  UniqueSortTests.mm
+//
+// Sort + unique and run length (value, count) tests, the performance tests
+// compare to a sort followed by std::unique on duplicate heavy inputs.
+
+#import <XCTest/XCTest.h>
+
+#include <random>
+#include <cmath>
+#include <cstddef>  // For std::ptrdiff_t
+
+#include "in_place_sort_opt.hpp"
+
+@interface UniqueSortTests : XCTestCase
+
+@end
+
+static
+__attribute__((noinline))
+void setupRandomUniqueValues(std::vector<uint32_t> & inputValues, uint32_t maxNum) {
+  const unsigned int nSrcValues = (unsigned int) inputValues.size();
+
+  std::random_device                  rand_dev;
+  std::mt19937                        generator(rand_dev());
+
+  std::uniform_int_distribution<uint32_t>  distr(0, maxNum); // even dist between buckets
+
+  for ( int i = 0 ; i < nSrcValues; i++ ) {
+    inputValues[i] = distr(generator);
+  }
+}
+
+@implementation UniqueSortTests
+
+- (void)testRunLengthSmall {
+  std::vector<uint32_t> inWords{
+    3, 0, 2, 0, 3, 0, 3
+  };
+  std::vector<uint32_t> runCounts(inWords.size());
+  const unsigned int N = (int) inWords.size();
+
+  unsigned int runEnd = countingSortRunLengthOpt<3>(inWords.data(), runCounts.data(), 0, N);
+
+  XCTAssert(runEnd == 3);
+  XCTAssert(inWords[0] == 0 && runCounts[0] == 3);
+  XCTAssert(inWords[1] == 2 && runCounts[1] == 1);
+  XCTAssert(inWords[2] == 3 && runCounts[2] == 3);
+}
+
+- (void)testUniqueAllSame {
+  std::vector<uint32_t> inWords(1000, 7);
+
+  unsigned int uniqueEnd = countingSortUniqueOpt<3>(inWords.data(), 0, 1000);
+
+  XCTAssert(uniqueEnd == 1);
+  XCTAssert(inWords[0] == 7);
+}
+
+- (void)testUniqueStartOffset {
+  std::vector<uint32_t> inWords{
+    9, 2, 1, 2, 1, 9
+  };
+
+  unsigned int uniqueEnd = countingSortUniqueOpt<3>(inWords.data(), 1, 5);
+
+  XCTAssert(uniqueEnd == 3);
+  XCTAssert(inWords[0] == 9 && inWords[1] == 1 && inWords[2] == 2 && inWords[5] == 9);
+}
+
+- (void)testRunLengthRandom {
+  // Each maxNum gives a different number of duplicates per value
+  const unsigned int N = 1000000;
+
+  for (uint32_t maxNum : {0xFFFFFFFFu, 0xFFFFFu, 0xFFFFu, 0xFFu, 3u}) {
+    std::vector<uint32_t> inWords(N);
+    setupRandomUniqueValues(inWords, maxNum);
+
+    // Compare to std::sort + std::unique, the expected counts are the lengths of the sorted runs
+    std::vector<uint32_t> expected = inWords;
+    std::sort(begin(expected), end(expected));
+
+    std::vector<uint32_t> expectedCounts;
+    for (unsigned int i = 0; i < N; ) {
+      unsigned int runEnd = i;
+      while (runEnd < N && expected[runEnd] == expected[i]) {
+        runEnd++;
+      }
+      expectedCounts.push_back(runEnd - i);
+      i = runEnd;
+    }
+    expected.erase(std::unique(begin(expected), end(expected)), end(expected));
+
+    std::vector<uint32_t> uniqueWords = inWords;
+    unsigned int uniqueEnd = countingSortUniqueOpt<3>(uniqueWords.data(), 0, N);
+    uniqueWords.resize(uniqueEnd);
+    XCTAssert(uniqueWords == expected, @"maxNum %x", maxNum);
+
+    std::vector<uint32_t> runCounts(N);
+    unsigned int runEnd = countingSortRunLengthOpt<3>(inWords.data(), runCounts.data(), 0, N);
+    inWords.resize(runEnd);
+    runCounts.resize(runEnd);
+    XCTAssert(inWords == expected, @"maxNum %x", maxNum);
+    XCTAssert(runCounts == expectedCounts, @"maxNum %x", maxNum);
+  }
+}
+
+- (void)testRunLengthRandomSmall {
+  // Most buckets are small enough to be sorted directly
+  const unsigned int N = 1000;
+
+  for (uint32_t maxNum : {0xFFFFFFFFu, 0xFFFFFu, 0xFFFFu, 0xFFu, 3u}) {
+    std::vector<uint32_t> inWords(N);
+    setupRandomUniqueValues(inWords, maxNum);
+
+    // Compare to std::sort + std::unique, the expected counts are the lengths of the sorted runs
+    std::vector<uint32_t> expected = inWords;
+    std::sort(begin(expected), end(expected));
+
+    std::vector<uint32_t> expectedCounts;
+    for (unsigned int i = 0; i < N; ) {
+      unsigned int runEnd = i;
+      while (runEnd < N && expected[runEnd] == expected[i]) {
+        runEnd++;
+      }
+      expectedCounts.push_back(runEnd - i);
+      i = runEnd;
+    }
+    expected.erase(std::unique(begin(expected), end(expected)), end(expected));
+
+    std::vector<uint32_t> uniqueWords = inWords;
+    unsigned int uniqueEnd = countingSortUniqueOpt<3>(uniqueWords.data(), 0, N);
+    uniqueWords.resize(uniqueEnd);
+    XCTAssert(uniqueWords == expected, @"maxNum %x", maxNum);
+
+    std::vector<uint32_t> runCounts(N);
+    unsigned int runEnd = countingSortRunLengthOpt<3>(inWords.data(), runCounts.data(), 0, N);
+    inWords.resize(runEnd);
+    runCounts.resize(runEnd);
+    XCTAssert(inWords == expected, @"maxNum %x", maxNum);
+    XCTAssert(runCounts == expectedCounts, @"maxNum %x", maxNum);
+  }
+}
+
+- (void)testUniqueFloat {
+  // -0.0 and +0.0 are different keys
+  std::vector<float> inWords{
+    1.0f, -0.0f, 0.0f, 1.0f, -2.0f, 0.0f
+  };
+  const unsigned int N = (int) inWords.size();
+
+  unsigned int uniqueEnd = countingSortUniqueOpt<3>(inWords.data(), 0, N);
+
+  XCTAssert(uniqueEnd == 4);
+  XCTAssert(inWords[0] == -2.0f);
+  XCTAssert(inWords[1] == 0.0f && std::signbit(inWords[1]));
+  XCTAssert(inWords[2] == 0.0f && !std::signbit(inWords[2]));
+  XCTAssert(inWords[3] == 1.0f);
+}
+
+//constexpr unsigned int PERF_N = 100000000; // 100 million numbers
+
+constexpr unsigned int PERF_N =   1073741824 / 4; // (2*30)/4 is very very large (1 Gb x 2)
+
+// Values in [0, maxU32], sort + unique in one call or countingSortInPlaceOpt() + std::unique
+
+- (void)testUniquePerformanceU20Opt {
+  constexpr unsigned int N = PERF_N;
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint32_t>>(N);
+  std::vector<uint32_t> & randomWordsVec = *sharedRandomWords;
+
+  constexpr unsigned int maxU32 = 0xFFFFF;
+  setupRandomUniqueValues(randomWordsVec, maxU32);
+
+  auto sharedDstVec = std::make_shared<std::vector<uint32_t>>(N);
+
+  [self measureBlock:^{
+    std::vector<uint32_t> & randomWords = *sharedRandomWords;
+    uint32_t *inPtr = randomWords.data();
+    std::vector<uint32_t> & dstVec = *sharedDstVec;
+    uint32_t *outPtr = dstVec.data();
+
+    memcpy(outPtr, inPtr, N * sizeof(uint32_t));
+
+    countingSortUniqueOpt<3>(outPtr, 0, N);
+  }];
+}
+
+- (void)testUniquePerformanceU20SortThenUnique {
+  constexpr unsigned int N = PERF_N;
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint32_t>>(N);
+  std::vector<uint32_t> & randomWordsVec = *sharedRandomWords;
+
+  constexpr unsigned int maxU32 = 0xFFFFF;
+  setupRandomUniqueValues(randomWordsVec, maxU32);
+
+  auto sharedDstVec = std::make_shared<std::vector<uint32_t>>(N);
+
+  [self measureBlock:^{
+    std::vector<uint32_t> & randomWords = *sharedRandomWords;
+    uint32_t *inPtr = randomWords.data();
+    std::vector<uint32_t> & dstVec = *sharedDstVec;
+    uint32_t *outPtr = dstVec.data();
+
+    memcpy(outPtr, inPtr, N * sizeof(uint32_t));
+
+    countingSortInPlaceOpt<3>(outPtr, 0, N);
+    std::unique(begin(dstVec), end(dstVec));
+  }];
+}
+
+- (void)testUniquePerformanceU32Opt {
+  constexpr unsigned int N = PERF_N;
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint32_t>>(N);
+  std::vector<uint32_t> & randomWordsVec = *sharedRandomWords;
+
+  constexpr unsigned int maxU32 = 0xFFFFFFFF;
+  setupRandomUniqueValues(randomWordsVec, maxU32);
+
+  auto sharedDstVec = std::make_shared<std::vector<uint32_t>>(N);
+
+  [self measureBlock:^{
+    std::vector<uint32_t> & randomWords = *sharedRandomWords;
+    uint32_t *inPtr = randomWords.data();
+    std::vector<uint32_t> & dstVec = *sharedDstVec;
+    uint32_t *outPtr = dstVec.data();
+
+    memcpy(outPtr, inPtr, N * sizeof(uint32_t));
+
+    countingSortUniqueOpt<3>(outPtr, 0, N);
+  }];
+}
+
+- (void)testUniquePerformanceU32SortThenUnique {
+  constexpr unsigned int N = PERF_N;
+
+  auto sharedRandomWords = std::make_shared<std::vector<uint32_t>>(N);
+  std::vector<uint32_t> & randomWordsVec = *sharedRandomWords;
+
+  constexpr unsigned int maxU32 = 0xFFFFFFFF;
+  setupRandomUniqueValues(randomWordsVec, maxU32);
+
+  auto sharedDstVec = std::make_shared<std::vector<uint32_t>>(N);
+
+  [self measureBlock:^{
+    std::vector<uint32_t> & randomWords = *sharedRandomWords;
+    uint32_t *inPtr = randomWords.data();
+    std::vector<uint32_t> & dstVec = *sharedDstVec;
+    uint32_t *outPtr = dstVec.data();
+
+    memcpy(outPtr, inPtr, N * sizeof(uint32_t));
+
+    countingSortInPlaceOpt<3>(outPtr, 0, N);
+    std::unique(begin(dstVec), end(dstVec));
+  }];
+}
+
+@end
@@ -3,6 +3,8 @@
 // A structure of bitset256_t can be allocated on the stack or from heap memory.
 // Note that bitset256Clear() must then be invoked to clear/init the memory.
 
+#pragma once
+
 typedef struct alignas(8*8) {
   uint64_t bits[5];
 } bitset256_t;
@@ -0,0 +1,115 @@
+// Bitset with a single bit for each bucket in the range (0 - 262143) for digits wider
+// than 8 bits. The bucket bits are heap allocated and two summary levels are kept so
+// that finding the first set bit is three count trailing zeros operations no matter
+// how many buckets are empty, the same query as bitset256FindFirstSetOpt().
+//
+// bits    : one bit per bucket
+// summary : bit w of summary[s] is set when bits[(s * 64) + w] is not zero
+// top     : bit s is set when summary[s] is not zero
+//
+// A bitsetWide_t must be initialized with bitsetWideInit() before use.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <bit>
+
+#if defined(DEBUG)
+#include <assert.h>
+#endif
+
+constexpr unsigned int bitsetWideMaxBits = 64 * 64 * 64;
+
+typedef struct {
+  std::vector<uint64_t> bits;
+  uint64_t summary[64];
+  uint64_t top;
+} bitsetWide_t;
+
+// Allocate numBits cleared bits
+
+static inline
+void bitsetWideInit(bitsetWide_t & b, unsigned int numBits)
+{
+#if defined(DEBUG)
+  assert(numBits <= bitsetWideMaxBits);
+#endif
+  b.bits.assign((numBits + 63) / 64, 0);
+  memset(b.summary, 0, sizeof(b.summary));
+  b.top = 0;
+}
+
+// Returns true if no bits are set in the bitset
+
+static inline
+bool bitsetWideIsAllOff(const bitsetWide_t & b)
+{
+  return b.top == 0;
+}
+
+static inline
+void bitsetWideSetBit(bitsetWide_t & b, unsigned int bucket)
+{
+  const unsigned int w = bucket / 64;
+#if defined(DEBUG)
+  assert(w < b.bits.size());
+#endif
+  b.bits[w] |= ((uint64_t) 1) << (bucket % 64);
+  b.summary[w / 64] |= ((uint64_t) 1) << (w % 64);
+  b.top |= ((uint64_t) 1) << (w / 64);
+}
+
+static inline
+bool bitsetWideGetBit(const bitsetWide_t & b, unsigned int bucket)
+{
+  const unsigned int w = bucket / 64;
+#if defined(DEBUG)
+  assert(w < b.bits.size());
+#endif
+  return (b.bits[w] >> (bucket % 64)) & 0x1;
+}
+
+// Clear a bit, the summary levels are only updated when a word becomes zero
+
+static inline
+void bitsetWideClearBit(bitsetWide_t & b, unsigned int bucket)
+{
+  const unsigned int w = bucket / 64;
+#if defined(DEBUG)
+  assert(w < b.bits.size());
+#endif
+  b.bits[w] &= ~(((uint64_t) 1) << (bucket % 64));
+  if (b.bits[w] == 0) {
+    b.summary[w / 64] &= ~(((uint64_t) 1) << (w % 64));
+    if (b.summary[w / 64] == 0) {
+      b.top &= ~(((uint64_t) 1) << (w / 64));
+    }
+  }
+}
+
+// Find the lowest set bit, must not be invoked on an empty bitset
+
+static inline
+unsigned int bitsetWideFindFirstSetOpt(const bitsetWide_t & b)
+{
+#if defined(DEBUG)
+  assert(b.top != 0);
+#endif
+  const unsigned int s = (unsigned int) std::countr_zero(b.top);
+  const unsigned int w = (s * 64) + (unsigned int) std::countr_zero(b.summary[s]);
+  return (w * 64) + (unsigned int) std::countr_zero(b.bits[w]);
+}
+
+// Return a count of the number of bits that are on
+
+static inline
+unsigned int bitsetWidePopCount(const bitsetWide_t & b)
+{
+  unsigned int count = 0;
+  for (uint64_t word : b.bits) {
+    count += (unsigned int) std::popcount(word);
+  }
+  return count;
+}
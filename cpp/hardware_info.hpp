@@ -0,0 +1,299 @@
+// Cache, page and core counts of the machine the sort is running on. The values are
+// probed once on first use and then cached for the life of the process.
+//
+// macOS : sysctlbyname()
+// Linux : sysconf() and /sys/devices/system/cpu/cpu0/cache, /proc/meminfo for the
+//         huge page size and /sys/devices/system/node/online for the NUMA node count
+// x86   : CPUID cache descriptors (Intel leaf 4, AMD leaf 0x8000001D) fill in any
+//         cache size the OS did not report
+//
+// A field that could not be probed is set to a typical value (64 byte lines, 32 KB L1,
+// 4 KB pages) so that tuning code never has to handle zero. Probed L2 and L3 sizes and
+// the huge page size are 0 when not known.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#if defined(__APPLE__)
+#include <sys/sysctl.h>
+#elif defined(__linux__)
+#include <unistd.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HARDWARE_INFO_X86 1
+#include <cpuid.h>
+#endif
+
+typedef struct {
+  size_t l1DataCacheSize;
+  size_t l2CacheSize;
+  size_t l3CacheSize;
+  size_t cacheLineSize;
+  size_t pageSize;
+  size_t hugePageSize;
+  unsigned int numLogicalCores;
+  unsigned int numNumaNodes;
+} hardwareInfo_t;
+
+#if defined(__APPLE__)
+
+static inline
+size_t hardwareInfoSysctl(const char * name) {
+  uint64_t value = 0;
+  size_t sizeofValue = sizeof(value);
+  if (sysctlbyname(name, &value, &sizeofValue, 0, 0) != 0) {
+    return 0;
+  }
+  // Some keys are 32 bit, the value is little endian so the low bits are valid
+  return (sizeofValue == sizeof(uint32_t)) ? (size_t) (uint32_t) value : (size_t) value;
+}
+
+#endif // __APPLE__
+
+#if defined(__linux__)
+
+// Read the first line of a small text file, returns false if the file does not exist
+
+static inline
+bool hardwareInfoReadLine(const char * path, char * line, size_t lineN) {
+  FILE * fp = fopen(path, "r");
+  if (fp == nullptr) {
+    return false;
+  }
+  bool worked = (fgets(line, (int) lineN, fp) != nullptr);
+  fclose(fp);
+  return worked;
+}
+
+// Parse a sysfs cache size like "32K" or "8192K" into bytes
+
+static inline
+size_t hardwareInfoParseSize(const char * str) {
+  char * end = nullptr;
+  unsigned long long value = strtoull(str, &end, 10);
+  if (end != nullptr) {
+    if (*end == 'K') {
+      value *= 1024;
+    } else if (*end == 'M') {
+      value *= 1024 * 1024;
+    } else if (*end == 'G') {
+      value *= 1024 * 1024 * 1024;
+    }
+  }
+  return (size_t) value;
+}
+
+// Count the entries in a sysfs cpu list like "0-3,8-11"
+
+static inline
+unsigned int hardwareInfoCountList(const char * str) {
+  unsigned int count = 0;
+  const char * p = str;
+  while (*p >= '0' && *p <= '9') {
+    char * end = nullptr;
+    unsigned long first = strtoul(p, &end, 10);
+    unsigned long last = first;
+    if (*end == '-') {
+      last = strtoul(end + 1, &end, 10);
+    }
+    count += (unsigned int) (last - first + 1);
+    p = (*end == ',') ? (end + 1) : end;
+  }
+  return count;
+}
+
+static inline
+void hardwareInfoProbeLinux(hardwareInfo_t & info) {
+#if defined(_SC_LEVEL1_DCACHE_SIZE)
+  long value;
+  if ((value = sysconf(_SC_LEVEL1_DCACHE_SIZE)) > 0) {
+    info.l1DataCacheSize = (size_t) value;
+  }
+  if ((value = sysconf(_SC_LEVEL1_DCACHE_LINESIZE)) > 0) {
+    info.cacheLineSize = (size_t) value;
+  }
+  if ((value = sysconf(_SC_LEVEL2_CACHE_SIZE)) > 0) {
+    info.l2CacheSize = (size_t) value;
+  }
+  if ((value = sysconf(_SC_LEVEL3_CACHE_SIZE)) > 0) {
+    info.l3CacheSize = (size_t) value;
+  }
+#endif // _SC_LEVEL1_DCACHE_SIZE
+
+  {
+    long value = sysconf(_SC_PAGESIZE);
+    if (value > 0) {
+      info.pageSize = (size_t) value;
+    }
+  }
+
+  // glibc reports 0 for the cache sizes on some CPUs (ARM64 in particular), sysfs
+  // lists one index directory per cache that cpu0 can use.
+
+  char path[128];
+  char line[128];
+
+  for (unsigned int index = 0; index < 8; index++) {
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%u/level", index);
+    if (!hardwareInfoReadLine(path, line, sizeof(line))) {
+      break;
+    }
+    unsigned int level = (unsigned int) strtoul(line, nullptr, 10);
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%u/type", index);
+    if (!hardwareInfoReadLine(path, line, sizeof(line)) || strncmp(line, "Instruction", 11) == 0) {
+      continue;
+    }
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%u/size", index);
+    size_t size = hardwareInfoReadLine(path, line, sizeof(line)) ? hardwareInfoParseSize(line) : 0;
+
+    if (level == 1) {
+      if (info.l1DataCacheSize == 0) info.l1DataCacheSize = size;
+
+      snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%u/coherency_line_size", index);
+      if (info.cacheLineSize == 0 && hardwareInfoReadLine(path, line, sizeof(line))) {
+        info.cacheLineSize = hardwareInfoParseSize(line);
+      }
+    } else if (level == 2) {
+      if (info.l2CacheSize == 0) info.l2CacheSize = size;
+    } else if (level == 3) {
+      if (info.l3CacheSize == 0) info.l3CacheSize = size;
+    }
+  }
+
+  // Default huge page size, "Hugepagesize:    2048 kB"
+
+  FILE * fp = fopen("/proc/meminfo", "r");
+  if (fp != nullptr) {
+    while (fgets(line, sizeof(line), fp) != nullptr) {
+      if (strncmp(line, "Hugepagesize:", 13) == 0) {
+        info.hugePageSize = (size_t) strtoull(line + 13, nullptr, 10) * 1024;
+        break;
+      }
+    }
+    fclose(fp);
+  }
+
+  if (hardwareInfoReadLine("/sys/devices/system/node/online", line, sizeof(line))) {
+    unsigned int numNodes = hardwareInfoCountList(line);
+    if (numNodes > 0) {
+      info.numNumaNodes = numNodes;
+    }
+  }
+}
+
+#endif // __linux__
+
+#if defined(HARDWARE_INFO_X86)
+
+// Walk the deterministic cache parameters leaf, Intel uses leaf 4 and AMD uses leaf
+// 0x8000001D with the same register layout.
+
+static inline
+void hardwareInfoProbeCPUID(hardwareInfo_t & info) {
+  unsigned int eax, ebx, ecx, edx;
+
+  if (__get_cpuid(0, &eax, &ebx, &ecx, &edx) == 0) {
+    return;
+  }
+
+  const unsigned int maxLeaf = eax;
+  const bool isAMD = (ebx == 0x68747541); // "Auth" of "AuthenticAMD"
+  unsigned int leaf = 4;
+
+  if (isAMD) {
+    if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) == 0 || eax < 0x8000001D) {
+      return;
+    }
+    leaf = 0x8000001D;
+  } else if (maxLeaf < 4) {
+    return;
+  }
+
+  for (unsigned int subleaf = 0; subleaf < 16; subleaf++) {
+    __cpuid_count(leaf, subleaf, eax, ebx, ecx, edx);
+
+    const unsigned int type = eax & 0x1F;
+    if (type == 0) {
+      break;
+    }
+    if (type == 2) {
+      // Instruction cache
+      continue;
+    }
+
+    const unsigned int level = (eax >> 5) & 0x7;
+    const size_t ways = ((ebx >> 22) & 0x3FF) + 1;
+    const size_t partitions = ((ebx >> 12) & 0x3FF) + 1;
+    const size_t lineSize = (ebx & 0xFFF) + 1;
+    const size_t sets = (size_t) ecx + 1;
+    const size_t size = ways * partitions * lineSize * sets;
+
+    if (level == 1) {
+      if (info.l1DataCacheSize == 0) info.l1DataCacheSize = size;
+      if (info.cacheLineSize == 0) info.cacheLineSize = lineSize;
+    } else if (level == 2) {
+      if (info.l2CacheSize == 0) info.l2CacheSize = size;
+    } else if (level == 3) {
+      if (info.l3CacheSize == 0) info.l3CacheSize = size;
+    }
+  }
+}
+
+#endif // HARDWARE_INFO_X86
+
+static inline
+hardwareInfo_t hardwareInfoProbe() {
+  hardwareInfo_t info = {};
+  info.numNumaNodes = 1;
+
+#if defined(__APPLE__)
+  info.l1DataCacheSize = hardwareInfoSysctl("hw.l1dcachesize");
+  info.l2CacheSize = hardwareInfoSysctl("hw.l2cachesize");
+  info.l3CacheSize = hardwareInfoSysctl("hw.l3cachesize");
+  info.cacheLineSize = hardwareInfoSysctl("hw.cachelinesize");
+  info.pageSize = hardwareInfoSysctl("hw.pagesize");
+# if defined(__x86_64__)
+  info.hugePageSize = 2 * 1024 * 1024;
+# endif
+#elif defined(__linux__)
+  hardwareInfoProbeLinux(info);
+#endif
+
+#if defined(HARDWARE_INFO_X86)
+  hardwareInfoProbeCPUID(info);
+#endif
+
+  info.numLogicalCores = std::thread::hardware_concurrency();
+
+  if (info.l1DataCacheSize == 0) {
+    info.l1DataCacheSize = 32 * 1024;
+  }
+  if (info.cacheLineSize == 0) {
+    info.cacheLineSize = 64;
+  }
+  if (info.pageSize == 0) {
+    info.pageSize = 4096;
+  }
+  if (info.numLogicalCores == 0) {
+    info.numLogicalCores = 1;
+  }
+
+  return info;
+}
+
+// Return the cached hardware info, probed on the first call (thread safe)
+
+static inline
+const hardwareInfo_t & hardwareInfo() {
+  static const hardwareInfo_t info = hardwareInfoProbe();
+  return info;
+}
@@ -0,0 +1,351 @@
+// Histogram kernels for 32 bit values, selected once per process at runtime, see
+// histogramKernelDetect(). Each kernel adds the count for digit D of every value in
+// arr[starti, endi) into counts[256]. The selection times the supported kernels, so
+// it can differ from one run to the next when two kernels are close. Define
+// HISTOGRAM_KERNEL as a histogramKernel_t value to always use that kernel.
+//
+// Scalar : 4 way unrolled loop with 4 sub-tables (formerly UNROLL_HISTOGRAMS4),
+//          repeated digits do not serialize on one counter. Also used for 64 bit
+//          and float values, the vector kernels only handle 32 bit integers.
+//
+// AVX2 : 8 lane digit extraction, each lane increments its own sub-table so that
+//        repeated digits in adjacent values do not form a store to load chain.
+//
+// AVX-512 : 16 lane digit extraction, vpconflictd finds lanes with the same digit
+//           so that a single gather / add / scatter updates all 16 counts. Two
+//           sub-tables are used in alternate iterations to break the dependency
+//           between one scatter and the next gather.
+
+#pragma once
+
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HISTOGRAM_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+#include <chrono>
+#include <vector>
+
+typedef enum {
+  HISTOGRAM_KERNEL_SCALAR = 0,
+  HISTOGRAM_KERNEL_AVX2 = 1,
+  HISTOGRAM_KERNEL_AVX512 = 2
+} histogramKernel_t;
+
+// Ranges smaller than this use the simple one table loop since zeroing and
+// summing the sub-tables costs more than the unrolled loop saves.
+
+constexpr unsigned int histogramSimdMinN = 4096;
+
+template <unsigned int D, typename T, typename K>
+__attribute__((noinline))
+void histogramKernelScalar(
+                           const T * arr,
+                           unsigned int starti,
+                           unsigned int endi,
+                           uint32_t * counts,
+                           K && radixKey
+                           )
+{
+  constexpr unsigned int unrollCount = 4;
+  constexpr unsigned int bucketMax = 256;
+
+  uint32_t table1[bucketMax] = {};
+  uint32_t table2[bucketMax] = {};
+  uint32_t table3[bucketMax] = {};
+  uint32_t table4[bucketMax] = {};
+
+  unsigned int readi = starti;
+  const unsigned int unrolledEnd = starti + ((endi - starti) / unrollCount) * unrollCount;
+
+  for (; readi < unrolledEnd; readi += unrollCount) {
+    ++table1[(radixKey(arr[readi+0]) >> (D * 8)) & 0xFF];
+    ++table2[(radixKey(arr[readi+1]) >> (D * 8)) & 0xFF];
+    ++table3[(radixKey(arr[readi+2]) >> (D * 8)) & 0xFF];
+    ++table4[(radixKey(arr[readi+3]) >> (D * 8)) & 0xFF];
+  }
+
+  for (; readi < endi; readi++) {
+    ++table1[(radixKey(arr[readi]) >> (D * 8)) & 0xFF];
+  }
+
+  for (unsigned int bucketi = 0; bucketi < bucketMax; bucketi++) {
+    counts[bucketi] += table1[bucketi] + table2[bucketi] + table3[bucketi] + table4[bucketi];
+  }
+}
+
+// Unsigned keys are histogrammed as is
+
+template <unsigned int D, typename T>
+static inline
+void histogramKernelScalar(
+                           const T * arr,
+                           unsigned int starti,
+                           unsigned int endi,
+                           uint32_t * counts
+                           )
+{
+  histogramKernelScalar<D>(arr, starti, endi, counts, [](T v) {
+    return v;
+  });
+}
+
+#if defined(HISTOGRAM_SIMD_X86)
+
+template <unsigned int D>
+__attribute__((target("avx2")))
+static inline
+__m256i histogramDigitsAVX2(__m256i v)
+{
+  if constexpr (D == 3) {
+    return _mm256_srli_epi32(v, 3 * 8);
+  } else {
+    return _mm256_and_si256(_mm256_srli_epi32(v, D * 8), _mm256_set1_epi32(0xFF));
+  }
+}
+
+template <unsigned int D>
+__attribute__((target("avx2")))
+__attribute__((noinline))
+void histogramKernelAVX2(
+                         const uint32_t * arr,
+                         unsigned int starti,
+                         unsigned int endi,
+                         uint32_t * counts
+                         )
+{
+  constexpr unsigned int numLanes = 8;
+  constexpr unsigned int bucketMax = 256;
+
+  alignas(64) uint32_t tables[numLanes * bucketMax] = {};
+  alignas(32) uint32_t lanes[numLanes];
+
+  // Lane N increments table N, so add N * 256 to the digit in lane N
+  const __m256i laneOffsets = _mm256_setr_epi32(0 * bucketMax, 1 * bucketMax, 2 * bucketMax, 3 * bucketMax,
+                                                4 * bucketMax, 5 * bucketMax, 6 * bucketMax, 7 * bucketMax);
+
+  unsigned int readi = starti;
+  const unsigned int unrolledEnd = starti + ((endi - starti) / numLanes) * numLanes;
+
+  for (; readi < unrolledEnd; readi += numLanes) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) &arr[readi]);
+    __m256i tablei = _mm256_add_epi32(histogramDigitsAVX2<D>(v), laneOffsets);
+    _mm256_store_si256((__m256i *) lanes, tablei);
+
+    ++tables[lanes[0]];
+    ++tables[lanes[1]];
+    ++tables[lanes[2]];
+    ++tables[lanes[3]];
+    ++tables[lanes[4]];
+    ++tables[lanes[5]];
+    ++tables[lanes[6]];
+    ++tables[lanes[7]];
+  }
+
+  for (; readi < endi; readi++) {
+    unsigned int bucketi = (arr[readi] >> (D * 8)) & 0xFF;
+    ++tables[bucketi];
+  }
+
+  for (unsigned int bucketi = 0; bucketi < bucketMax; bucketi += numLanes) {
+    __m256i sum = _mm256_loadu_si256((const __m256i *) &counts[bucketi]);
+    for (unsigned int lanei = 0; lanei < numLanes; lanei++) {
+      sum = _mm256_add_epi32(sum, _mm256_load_si256((const __m256i *) &tables[lanei * bucketMax + bucketi]));
+    }
+    _mm256_storeu_si256((__m256i *) &counts[bucketi], sum);
+  }
+}
+
+template <unsigned int D>
+__attribute__((target("avx512f,avx512cd")))
+static inline
+__m512i histogramDigitsAVX512(__m512i v)
+{
+  if constexpr (D == 3) {
+    return _mm512_srli_epi32(v, 3 * 8);
+  } else {
+    return _mm512_and_si512(_mm512_srli_epi32(v, D * 8), _mm512_set1_epi32(0xFF));
+  }
+}
+
+// For each lane, return 1 + the number of lower lanes with the same digit. After a
+// scatter the highest lane for a digit is the one written last, so that lane must
+// hold the count for all lanes with that digit.
+
+__attribute__((target("avx512f,avx512cd")))
+static inline
+__m512i histogramConflictCountsAVX512(__m512i digits)
+{
+  __m512i x = _mm512_conflict_epi32(digits);
+
+  // popcount of each 32 bit lane
+  x = _mm512_sub_epi32(x, _mm512_and_si512(_mm512_srli_epi32(x, 1), _mm512_set1_epi32(0x55555555)));
+  x = _mm512_add_epi32(_mm512_and_si512(x, _mm512_set1_epi32(0x33333333)),
+                       _mm512_and_si512(_mm512_srli_epi32(x, 2), _mm512_set1_epi32(0x33333333)));
+  x = _mm512_and_si512(_mm512_add_epi32(x, _mm512_srli_epi32(x, 4)), _mm512_set1_epi32(0x0F0F0F0F));
+  x = _mm512_srli_epi32(_mm512_mullo_epi32(x, _mm512_set1_epi32(0x01010101)), 24);
+
+  return _mm512_add_epi32(x, _mm512_set1_epi32(1));
+}
+
+template <unsigned int D>
+__attribute__((target("avx512f,avx512cd")))
+__attribute__((noinline))
+void histogramKernelAVX512(
+                           const uint32_t * arr,
+                           unsigned int starti,
+                           unsigned int endi,
+                           uint32_t * counts
+                           )
+{
+  constexpr unsigned int numLanes = 16;
+  constexpr unsigned int bucketMax = 256;
+
+  alignas(64) uint32_t tables[2 * bucketMax] = {};
+
+  const __m512i table2Offset = _mm512_set1_epi32(bucketMax);
+
+  unsigned int readi = starti;
+  const unsigned int unrolledEnd = starti + ((endi - starti) / (2 * numLanes)) * (2 * numLanes);
+
+  for (; readi < unrolledEnd; readi += 2 * numLanes) {
+    __m512i digits0 = histogramDigitsAVX512<D>(_mm512_loadu_si512((const void *) &arr[readi]));
+    __m512i digits1 = histogramDigitsAVX512<D>(_mm512_loadu_si512((const void *) &arr[readi + numLanes]));
+    digits1 = _mm512_add_epi32(digits1, table2Offset);
+
+    __m512i counts0 = histogramConflictCountsAVX512(digits0);
+    __m512i counts1 = histogramConflictCountsAVX512(digits1);
+
+    __m512i sum0 = _mm512_add_epi32(_mm512_i32gather_epi32(digits0, (const void *) tables, 4), counts0);
+    _mm512_i32scatter_epi32((void *) tables, digits0, sum0, 4);
+
+    __m512i sum1 = _mm512_add_epi32(_mm512_i32gather_epi32(digits1, (const void *) tables, 4), counts1);
+    _mm512_i32scatter_epi32((void *) tables, digits1, sum1, 4);
+  }
+
+  for (; readi < endi; readi++) {
+    unsigned int bucketi = (arr[readi] >> (D * 8)) & 0xFF;
+    ++tables[bucketi];
+  }
+
+  for (unsigned int bucketi = 0; bucketi < bucketMax; bucketi += numLanes) {
+    __m512i sum = _mm512_loadu_si512((const void *) &counts[bucketi]);
+    sum = _mm512_add_epi32(sum, _mm512_load_si512((const void *) &tables[bucketi]));
+    sum = _mm512_add_epi32(sum, _mm512_load_si512((const void *) &tables[bucketMax + bucketi]));
+    _mm512_storeu_si512((void *) &counts[bucketi], sum);
+  }
+}
+
+#endif // HISTOGRAM_SIMD_X86
+
+// Add digit D counts for arr[starti, endi) into counts with the given kernel
+
+template <unsigned int D>
+static inline
+void histogramKernelOpt(
+                        const uint32_t * arr,
+                        unsigned int starti,
+                        unsigned int endi,
+                        uint32_t * counts,
+                        histogramKernel_t kernel
+                        )
+{
+  switch (kernel) {
+#if defined(HISTOGRAM_SIMD_X86)
+    case HISTOGRAM_KERNEL_AVX512: {
+      histogramKernelAVX512<D>(arr, starti, endi, counts);
+      break;
+    }
+    case HISTOGRAM_KERNEL_AVX2: {
+      histogramKernelAVX2<D>(arr, starti, endi, counts);
+      break;
+    }
+#endif
+    default: {
+      histogramKernelScalar<D>(arr, starti, endi, counts);
+      break;
+    }
+  }
+}
+
+// Query CPU features and then time each supported kernel on a synthetic buffer,
+// the fastest kernel is kept. Histogramming is bound by the increments into the
+// tables, so a wider kernel is not always faster. For example, on a Xeon with
+// AVX-512 the scalar 4 table loop measured 0.37 - 0.76 ns per value vs 0.45 - 0.84
+// for AVX2 and 0.80 - 1.00 for the vpconflictd kernel. The timing is a race between
+// kernels, so a kernel that is within the noise of the fastest one can be picked in
+// some runs and not others. Define HISTOGRAM_KERNEL to one of the histogramKernel_t
+// values to skip the timing, a forced kernel the CPU does not support falls back to
+// the scalar kernel.
+
+static inline
+histogramKernel_t histogramKernelDetect()
+{
+  std::vector<histogramKernel_t> kernels;
+  kernels.push_back(HISTOGRAM_KERNEL_SCALAR);
+
+#if defined(HISTOGRAM_SIMD_X86)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    kernels.push_back(HISTOGRAM_KERNEL_AVX2);
+  }
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512cd")) {
+    kernels.push_back(HISTOGRAM_KERNEL_AVX512);
+  }
+#endif
+
+#if defined(HISTOGRAM_KERNEL)
+  for (histogramKernel_t kernel : kernels) {
+    if (kernel == (histogramKernel_t) HISTOGRAM_KERNEL) {
+      return kernel;
+    }
+  }
+  return HISTOGRAM_KERNEL_SCALAR;
+#else
+  if (kernels.size() == 1) {
+    return kernels[0];
+  }
+
+  // Mix of random digits and runs of the same digit, the same value
+  // is used for every kernel so the timing is comparable.
+
+  constexpr unsigned int calibrateN = 1 << 14;
+  std::vector<uint32_t> values(calibrateN);
+  uint32_t state = 0x12345678;
+  for (unsigned int i = 0; i < calibrateN; i++) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    values[i] = ((i / 64) % 2) == 0 ? state : 0x11111111;
+  }
+
+  histogramKernel_t fastestKernel = HISTOGRAM_KERNEL_SCALAR;
+  auto fastestTime = std::chrono::steady_clock::duration::max();
+
+  for (histogramKernel_t kernel : kernels) {
+    auto bestTime = std::chrono::steady_clock::duration::max();
+    for (int run = 0; run < 5; run++) {
+      uint32_t counts[256] = {};
+      auto startTime = std::chrono::steady_clock::now();
+      histogramKernelOpt<1>(values.data(), 0, calibrateN, counts, kernel);
+      auto elapsed = std::chrono::steady_clock::now() - startTime;
+      bestTime = std::min(bestTime, elapsed);
+    }
+    if (bestTime < fastestTime) {
+      fastestTime = bestTime;
+      fastestKernel = kernel;
+    }
+  }
+
+  return fastestKernel;
+#endif // HISTOGRAM_KERNEL
+}
+
+static inline
+histogramKernel_t histogramKernel()
+{
+  static const histogramKernel_t kernel = histogramKernelDetect();
+  return kernel;
+}
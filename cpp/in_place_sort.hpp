@@ -5,6 +5,8 @@
 #include <assert.h>
 #endif
 
+#include "small_sort_simd.hpp"
+
 // Given a 32 bit integer, extract a specific digit.
 //
 // uint32_t digit = extractDigit<0>(v, digitOffset);
@@ -62,7 +64,7 @@ void countingSortInPlace(
   constexpr bool debugDumpInOutValues = false;
   constexpr bool debugDumpHistogram = false;
   constexpr bool debugDumpPrefixSum = false;
-  int n = endi - starti;
+  unsigned int n = endi - starti;
     
   // if (n < 2) {
   //   std::cout << "countingSortInPlace early return from recursion " << starti << " up to " << endi << std::endl;
@@ -96,7 +98,7 @@ void countingSortInPlace(
         }
         case 3 ... 128: {
           // Small bucket subrange can be sorted without recursion
-          std::sort(arr+starti, arr+endi);
+          smallSortOpt(arr, starti, endi);
           break;
         }
         default: {
@@ -114,7 +116,7 @@ void countingSortInPlace(
     std::cout << "endi " << endi << std::endl;
 
     if (debugDumpInOutValues) {
-      for (int i = starti; i < endi; i++) {
+      for (unsigned int i = starti; i < endi; i++) {
         std::cout << (unsigned int) arr[i] << std::endl;
       }
     }
@@ -320,7 +322,7 @@ void countingSortInPlace(
     std::cout << "endi " << endi << std::endl;
     
     if (debugDumpInOutValues) {
-      for (int i = starti; i < endi; i++) {
+      for (unsigned int i = starti; i < endi; i++) {
         std::cout << (unsigned int) arr[i] << std::endl;
       }
     }
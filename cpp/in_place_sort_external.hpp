@@ -0,0 +1,461 @@
+// External sort for binary files of unsigned integer records that are larger than the
+// memory available for sorting. The input is radix partitioned by its top digit into
+// 256 spill files with buffered sequential writes. The spill files come out in key
+// order, so each one that fits in memory is loaded, sorted with the in-place engine
+// and appended to the output, no k-way merge is needed. A spill file that is still
+// too large (skewed keys) is partitioned again by the next digit.
+//
+// I/O overlaps with work: the partition pass reads the next input block on a reader
+// thread while the current block is scattered, and a partition is written to the
+// output on another thread while the next partition is loaded and sorted.
+//
+// The sort buffers, spill buffers and read blocks are all sized from memoryBytes, and
+// the sort buffers are freed before a partition pass so that only one set of them is
+// allocated at a time.
+
+#pragma once
+
+#include <cstdio>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <unistd.h>
+
+#include "in_place_sort_opt.hpp"
+
+// Values are collected per spill file until this many bytes can be written at once,
+// less when 256 buffers of this size do not fit in half of memoryBytes
+
+constexpr size_t externalSortSpillBufferBytes = 1 << 16;
+
+// Input is read in blocks of this many bytes in the partition pass, less when two
+// blocks do not fit in the other half of memoryBytes
+
+constexpr size_t externalSortReadBlockBytes = 1 << 24;
+
+// Spill file names include the pid and a per call number, so concurrent sorts in one
+// process or in different processes do not share a spill file
+
+inline std::atomic<unsigned int> externalSortCallNum(0);
+
+template <typename T>
+struct ExternalSortState {
+  FILE * out = nullptr;
+
+  size_t memoryBytes = 0;
+
+  // Largest partition that is sorted in memory, there are two buffers of this size
+  // so that one can be written while the next is sorted.
+  size_t maxInMemoryN = 0;
+
+  std::vector<T> buffers[2];
+  unsigned int bufferi = 0;
+
+  std::thread writer;
+  bool writeFailed = false;
+  int writeErrno = 0;
+};
+
+// Wait for the pending output write, returns false if it failed
+
+template <typename T>
+static inline
+bool externalSortJoinWriter(ExternalSortState<T> & state)
+{
+  if (state.writer.joinable()) {
+    state.writer.join();
+  }
+  if (state.writeFailed) {
+    errno = state.writeErrno;
+    return false;
+  }
+  return true;
+}
+
+// Read n values from in, sort them and append them to the output on the writer thread
+
+template <typename T>
+static inline
+bool externalSortInMemory(
+  ExternalSortState<T> & state,
+  FILE * in,
+  size_t n)
+{
+  constexpr unsigned int D = sizeof(T) - 1;
+
+  // The writer is never using this buffer, a write is joined before the next one starts
+  std::vector<T> & buffer = state.buffers[state.bufferi];
+  buffer.resize(n);
+
+  // A short read at EOF does not set errno, clear it so a stale value is not reported
+  errno = 0;
+  if (fread(buffer.data(), sizeof(T), n, in) != n) {
+    if (errno == 0) {
+      errno = EIO;
+    }
+    return false;
+  }
+
+  if (n <= largeSortMaxSubrangeN) {
+    countingSortInPlaceOpt<D>(buffer.data(), 0, (unsigned int) n);
+  } else {
+    countingSortInPlaceOptLarge<D>(buffer.data(), 0, n);
+  }
+
+  if (!externalSortJoinWriter(state)) {
+    return false;
+  }
+
+  state.writer = std::thread([&state, &buffer, n]() {
+    if (fwrite(buffer.data(), sizeof(T), n, state.out) != n) {
+      state.writeFailed = true;
+      state.writeErrno = (errno != 0) ? errno : EIO;
+    }
+  });
+
+  state.bufferi ^= 1;
+
+  return true;
+}
+
+template <typename T>
+static inline
+bool externalSortStream(
+  ExternalSortState<T> & state,
+  FILE * in,
+  size_t n,
+  int digit,
+  const std::string & spillName);
+
+// Partition the n values in by digit into 256 spill files and then sort each spill
+// file in key order.
+
+template <typename T>
+static inline
+bool externalSortPartition(
+  ExternalSortState<T> & state,
+  FILE * in,
+  size_t n,
+  unsigned int digit,
+  const std::string & spillName)
+{
+  constexpr unsigned int bucketMax = 256;
+
+  const size_t spillBufferN = std::max((size_t) 1, std::min(externalSortSpillBufferBytes, state.memoryBytes / (2 * bucketMax)) / sizeof(T));
+  const size_t readBlockN = std::max((size_t) 1, std::min(externalSortReadBlockBytes, state.memoryBytes / 4) / sizeof(T));
+
+  const unsigned int shift = digit * 8;
+
+  // The sort buffers are not used again until the spill files are sorted, the pending
+  // write must finish before they are freed
+  if (!externalSortJoinWriter(state)) {
+    return false;
+  }
+  state.buffers[0] = std::vector<T>();
+  state.buffers[1] = std::vector<T>();
+
+  std::vector<std::string> spillNames(bucketMax);
+  std::vector<std::string> spillPaths(bucketMax);
+  std::vector<FILE *> spillFiles(bucketMax, nullptr);
+  std::vector<size_t> spillCounts(bucketMax, 0);
+
+  std::vector<T> spillBuffers(bucketMax * spillBufferN);
+  size_t spillBufferCounts[bucketMax] = {};
+
+  bool worked = true;
+
+  auto removeSpills = [&]() {
+    for (unsigned int bucketi = 0; bucketi < bucketMax; bucketi++) {
+      if (spillFiles[bucketi] != nullptr) {
+        fclose(spillFiles[bucketi]);
+        spillFiles[bucketi] = nullptr;
+      }
+      if (!spillPaths[bucketi].empty()) {
+        unlink(spillPaths[bucketi].c_str());
+      }
+    }
+  };
+
+  auto flushSpill = [&](unsigned int bucketi) -> bool {
+    if (spillFiles[bucketi] == nullptr) {
+      char suffix[8];
+      snprintf(suffix, sizeof(suffix), "_%02x", bucketi);
+      spillNames[bucketi] = spillName + suffix;
+      spillPaths[bucketi] = spillNames[bucketi] + ".bin";
+      spillFiles[bucketi] = fopen(spillPaths[bucketi].c_str(), "w+bx");
+      if (spillFiles[bucketi] == nullptr) {
+        spillPaths[bucketi].clear();
+        return false;
+      }
+      // Writes and reads are already done in large pieces, a stdio buffer for each
+      // of the 256 files would not be counted in memoryBytes
+      setvbuf(spillFiles[bucketi], nullptr, _IONBF, 0);
+    }
+    size_t count = spillBufferCounts[bucketi];
+    if (fwrite(&spillBuffers[bucketi * spillBufferN], sizeof(T), count, spillFiles[bucketi]) != count) {
+      return false;
+    }
+    spillCounts[bucketi] += count;
+    spillBufferCounts[bucketi] = 0;
+    return true;
+  };
+
+  // Scatter each block into the spill buffers while the reader thread reads the next
+  // one. blockFilled[i] is set by the reader once block i is read and cleared when it
+  // has been scattered. The errno of a failed read is saved with the block, since
+  // errno is per thread.
+
+  {
+    std::vector<T> blocks[2];
+    blocks[0].resize(std::min(n, readBlockN));
+    blocks[1].resize(blocks[0].size());
+
+    size_t blockNs[2] = {};
+    int blockErrnos[2] = {};
+    bool blockFilled[2] = {};
+    bool stopReading = false;
+
+    std::mutex mutex;
+    std::condition_variable cond;
+
+    std::thread reader([&]() {
+      size_t remaining = n;
+      for (unsigned int blocki = 0; remaining > 0; blocki ^= 1) {
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          cond.wait(lock, [&]() { return !blockFilled[blocki] || stopReading; });
+          if (stopReading) {
+            return;
+          }
+        }
+
+        const size_t blockN = std::min(remaining, blocks[blocki].size());
+        errno = 0;
+        const size_t numRead = fread(blocks[blocki].data(), sizeof(T), blockN, in);
+        const int err = (numRead == blockN) ? 0 : ((errno != 0) ? errno : EIO);
+        remaining -= blockN;
+
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          blockNs[blocki] = numRead;
+          blockErrnos[blocki] = err;
+          blockFilled[blocki] = true;
+        }
+        cond.notify_all();
+
+        if (err != 0) {
+          return;
+        }
+      }
+    });
+
+    size_t remaining = n;
+
+    for (unsigned int blocki = 0; worked && remaining > 0; blocki ^= 1) {
+      size_t blockN;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [&]() { return blockFilled[blocki]; });
+        blockN = blockNs[blocki];
+        if (blockErrnos[blocki] != 0) {
+          errno = blockErrnos[blocki];
+          worked = false;
+          break;
+        }
+      }
+
+      const T * block = blocks[blocki].data();
+
+      for (size_t i = 0; i < blockN; i++) {
+        T v = block[i];
+        unsigned int bucketi = (unsigned int) (v >> shift) & (bucketMax - 1);
+        spillBuffers[(bucketi * spillBufferN) + spillBufferCounts[bucketi]] = v;
+        if (++spillBufferCounts[bucketi] == spillBufferN) {
+          if (!flushSpill(bucketi)) {
+            worked = false;
+            break;
+          }
+        }
+      }
+
+      remaining -= blockN;
+
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        blockFilled[blocki] = false;
+      }
+      cond.notify_all();
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopReading = true;
+    }
+    cond.notify_all();
+    reader.join();
+  }
+
+  for (unsigned int bucketi = 0; worked && bucketi < bucketMax; bucketi++) {
+    if (spillBufferCounts[bucketi] > 0) {
+      worked = flushSpill(bucketi);
+    }
+  }
+
+  if (!worked) {
+    int err = (errno != 0) ? errno : EIO;
+    removeSpills();
+    errno = err;
+    return false;
+  }
+
+  spillBuffers = std::vector<T>();
+
+  // Spill files are in key order, sort each one and append it to the output
+
+  for (unsigned int bucketi = 0; worked && bucketi < bucketMax; bucketi++) {
+    if (spillFiles[bucketi] == nullptr) {
+      continue;
+    }
+
+    FILE * spill = spillFiles[bucketi];
+    rewind(spill);
+
+    worked = externalSortStream(state, spill, spillCounts[bucketi], ((int) digit) - 1, spillNames[bucketi]);
+
+    fclose(spill);
+    spillFiles[bucketi] = nullptr;
+    unlink(spillPaths[bucketi].c_str());
+    spillPaths[bucketi].clear();
+  }
+
+  if (!worked) {
+    int err = (errno != 0) ? errno : EIO;
+    removeSpills();
+    errno = err;
+  }
+
+  return worked;
+}
+
+// Sort the n values read from in and append them to the output. digit is the digit to
+// partition by when the values do not fit in memory, -1 means that every digit has been
+// partitioned and so all the values are equal.
+
+template <typename T>
+static inline
+bool externalSortStream(
+  ExternalSortState<T> & state,
+  FILE * in,
+  size_t n,
+  int digit,
+  const std::string & spillName)
+{
+  if (n <= state.maxInMemoryN) {
+    return externalSortInMemory(state, in, n);
+  }
+
+  if (digit >= 0) {
+    return externalSortPartition(state, in, n, (unsigned int) digit, spillName);
+  }
+
+  // All values are equal, copy through in memory sized pieces
+  while (n > 0) {
+    size_t pieceN = std::min(n, state.maxInMemoryN);
+    if (!externalSortInMemory(state, in, pieceN)) {
+      return false;
+    }
+    n -= pieceN;
+  }
+
+  return true;
+}
+
+// Sort the records in inPath into outPath (which must be a different file) using at most
+// about memoryBytes of buffers, spill files are created in spillDir and removed as
+// they are consumed. Records are 32 or 64 bit unsigned integers in native byte order.
+// Returns false with errno set on failure, EINVAL if the input size is not a multiple
+// of sizeof(T).
+
+template <typename T>
+bool countingSortExternalOpt(
+  const char * inPath,
+  const char * outPath,
+  const char * spillDir,
+  size_t memoryBytes)
+{
+  static_assert(std::is_unsigned<T>::value && (sizeof(T) == sizeof(uint32_t) || sizeof(T) == sizeof(uint64_t)), "records must be 32 or 64 bit unsigned integers");
+
+  constexpr int D = sizeof(T) - 1;
+
+  FILE * in = fopen(inPath, "rb");
+  if (in == nullptr) {
+    return false;
+  }
+
+  if (fseeko(in, 0, SEEK_END) != 0) {
+    int err = errno;
+    fclose(in);
+    errno = err;
+    return false;
+  }
+
+  const off_t endOffset = ftello(in);
+  if (endOffset < 0) {
+    int err = errno;
+    fclose(in);
+    errno = err;
+    return false;
+  }
+
+  const size_t numBytes = (size_t) endOffset;
+  rewind(in);
+
+  if ((numBytes % sizeof(T)) != 0) {
+    fclose(in);
+    errno = EINVAL;
+    return false;
+  }
+
+  FILE * out = fopen(outPath, "wb");
+  if (out == nullptr) {
+    int err = errno;
+    fclose(in);
+    errno = err;
+    return false;
+  }
+
+  ExternalSortState<T> state;
+  state.out = out;
+  state.memoryBytes = memoryBytes;
+  state.maxInMemoryN = std::max((size_t) 1, memoryBytes / (2 * sizeof(T)));
+
+  const std::string spillName = std::string(spillDir) + "/radix_spill_" + std::to_string(getpid()) + "_" + std::to_string(externalSortCallNum++);
+
+  errno = 0;
+  bool worked = externalSortStream(state, in, numBytes / sizeof(T), D, spillName);
+  int err = errno;
+
+  if (!externalSortJoinWriter(state)) {
+    if (worked) {
+      err = errno;
+    }
+    worked = false;
+  }
+
+  fclose(in);
+
+  if (fclose(out) != 0 && worked) {
+    err = errno;
+    worked = false;
+  }
+
+  if (!worked) {
+    errno = err;
+  }
+
+  return worked;
+}
@@ -0,0 +1,205 @@
+// Sort a binary file of unsigned integer records in place. The file is mapped with
+// mmap() and the hybrid in-place sort runs directly on the mapping, so there is no
+// read into a buffer and no write back, the kernel pages the file in and out as the
+// sort touches it. A file larger than free RAM is paged in a predictable order:
+//
+// leading digits : the scan for digits that are the same in every value is one
+//                  sequential pass (MADV_SEQUENTIAL), random keys stop after a block
+// partition      : a range of blockPermuteMinBytes or more is classified and written
+//                  back as blocks in sequential passes (MADV_SEQUENTIAL), a smaller
+//                  range is permuted with swaps that land anywhere (MADV_RANDOM)
+// buckets        : each top digit bucket is contiguous, it is paged in with
+//                  MADV_WILLNEED just before the bucket is sorted
+//
+// The file is flushed with msync() before the mapping is removed.
+
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+
+#include "in_place_sort_opt.hpp"
+
+// madvise() a range of the mapping, the start is rounded down to a page boundary.
+// Advice is only a hint, so errors are ignored.
+
+static inline
+void fileSortAdvise(void * ptr, size_t numBytes, int advice)
+{
+  const uintptr_t pageMask = (uintptr_t) page_size() - 1;
+  uintptr_t start = ((uintptr_t) ptr) & ~pageMask;
+  uintptr_t end = ((uintptr_t) ptr) + numBytes;
+  if (end > start) {
+    (void) madvise((void *) start, end - start, advice);
+  }
+}
+
+// Partition the mapped records arr[0, n) by digit D and sort each bucket by the digits
+// below D. The partition does its own histogram or classification pass, so a large
+// range takes the block permutation path.
+
+template <unsigned int D, typename I, typename T>
+static inline
+void countingSortMappedPartitionOpt(
+  T * arr,
+  I n)
+{
+  const size_t numBytes = (size_t) n * sizeof(T);
+  const bool blocks = (blockPermuteBlockBytes > 0) && (numBytes >= blockPermuteMinBytes);
+
+  fileSortAdvise(arr, numBytes, blocks ? MADV_SEQUENTIAL : MADV_RANDOM);
+
+  auto recurse = [](
+                    T *arr,
+                    I starti,
+                    I endi
+                    )
+  {
+    fileSortAdvise(arr + starti, (size_t) (endi - starti) * sizeof(T), MADV_NORMAL);
+    fileSortAdvise(arr + starti, (size_t) (endi - starti) * sizeof(T), MADV_WILLNEED);
+
+    if constexpr (sizeof(I) > sizeof(uint32_t)) {
+      recurseBucketOptLarge<D>(arr, starti, endi);
+    } else {
+      recurseBucketOpt<D>(arr, starti, endi);
+    }
+  };
+
+  countingSortInPlaceOptPartition<D, I>(arr, 0, n, recurse);
+}
+
+template <unsigned int D, typename I, typename T>
+static inline
+void countingSortMappedFromDigitOpt(
+  T * arr,
+  I n,
+  unsigned int digit)
+{
+  if constexpr (D > 0) {
+    if (digit < D) {
+      countingSortMappedFromDigitOpt<D-1, I>(arr, n, digit);
+      return;
+    }
+  }
+
+  countingSortMappedPartitionOpt<D, I>(arr, n);
+}
+
+// Sort the mapped records arr[0, n), D is the top digit of T. Same top level steps as
+// countingSortInPlaceOpt(), but each bucket of the first partitioned digit is paged in
+// before it is sorted.
+
+template <unsigned int D, typename I, typename T>
+static inline
+void countingSortMappedOpt(
+  T * arr,
+  I n)
+{
+  fileSortAdvise(arr, (size_t) n * sizeof(T), MADV_SEQUENTIAL);
+
+  auto diffBits = radixDiffBitsOpt(arr, 0, n);
+
+  if (diffBits == 0) {
+    // All values are the same
+    return;
+  }
+
+  unsigned int firstDigit = radixFirstVaryingDigitOpt(diffBits);
+
+  if constexpr (sizeof(I) == sizeof(uint32_t)) {
+    // Small value domains are regenerated from counts in sequential passes
+
+    if (firstDigit == 0) {
+      countingSortRegenerateOpt<8>(arr, 0, n);
+      return;
+    } else if (firstDigit == 1 && n >= regenerate16MinN) {
+      countingSortRegenerateOpt<16>(arr, 0, n);
+      return;
+    }
+  }
+
+  if constexpr (blockPermuteBlockBytes > 0) {
+    if (firstDigit == D) {
+      const unsigned int topBits = radixTopDigitBitsOpt(n);
+
+      if (topBits > 8) {
+        countingSortInPlaceOptWide(arr, (I) 0, n, topBits);
+        return;
+      }
+    }
+  }
+
+  countingSortMappedFromDigitOpt<D, I>(arr, n, firstDigit);
+}
+
+// Sort the file at path as an array of T records in native byte order. Returns false
+// with errno set if the file cannot be opened or mapped, or EINVAL if the file size is
+// not a multiple of sizeof(T). The file is not modified on failure.
+
+template <typename T>
+bool countingSortFileOpt(
+  const char * path)
+{
+  static_assert(std::is_unsigned<T>::value && (sizeof(T) == sizeof(uint32_t) || sizeof(T) == sizeof(uint64_t)), "file records must be 32 or 64 bit unsigned integers");
+
+  constexpr unsigned int D = sizeof(T) - 1;
+
+  int fd = open(path, O_RDWR);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return false;
+  }
+
+  const size_t numBytes = (size_t) st.st_size;
+
+  if ((numBytes % sizeof(T)) != 0) {
+    close(fd);
+    errno = EINVAL;
+    return false;
+  }
+
+  const size_t n = numBytes / sizeof(T);
+
+  if (n < 2) {
+    close(fd);
+    return true;
+  }
+
+  void * ptr = mmap(nullptr, numBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (ptr == MAP_FAILED) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return false;
+  }
+
+  T * arr = (T *) ptr;
+
+  if (n <= largeSortMaxSubrangeN) {
+    countingSortMappedOpt<D, unsigned int>(arr, (unsigned int) n);
+  } else {
+    countingSortMappedOpt<D, size_t>(arr, n);
+  }
+
+  bool worked = (msync(ptr, numBytes, MS_SYNC) == 0);
+  int err = errno;
+
+  munmap(ptr, numBytes);
+  close(fd);
+
+  if (!worked) {
+    errno = err;
+  }
+
+  return worked;
+}
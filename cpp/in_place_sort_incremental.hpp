@@ -0,0 +1,208 @@
+// Incremental sorter for keys that arrive as a stream from many producer threads.
+// Each producer scatters its keys by top digit into a private buffer per bucket as
+// they arrive, and a full buffer is handed to the shared bucket as one chunk under
+// a per-bucket lock. So the top level partition is done while the stream is being
+// ingested, and finish() only has to copy each bucket into the output and sort it
+// by the remaining digits. finish() keeps one copied chunk per bucket on a free
+// list, so a sorter that is reused does not start by allocating a chunk for each
+// bucket, while the rest of the copied keys are released.
+//
+// IncrementalSorter<uint32_t> sorter;
+//
+// // on each producer thread
+// IncrementalSorter<uint32_t>::Producer producer(sorter);
+// producer.append(batch, batchN);
+// producer.flush(); // or let the producer go out of scope
+//
+// // once all producers are flushed
+// std::vector<uint32_t> sorted(sorter.size());
+// sorter.finish(sorted.data());
+
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+
+#include "in_place_sort_parallel.hpp"
+
+template <typename T>
+class IncrementalSorter {
+public:
+  static constexpr unsigned int bucketMax = 256;
+
+  // Keys collected per bucket by a producer before the chunk is handed off
+  static constexpr size_t producerChunkN = 4096 / sizeof(T);
+
+  static constexpr unsigned int D = sizeof(T) - 1;
+
+  // Per thread handle, a Producer must only be used by one thread at a time
+
+  class Producer {
+  public:
+    explicit Producer(IncrementalSorter & sorter)
+      : sorter(sorter), buffers(bucketMax * producerChunkN)
+    {
+    }
+
+    ~Producer() {
+      flush();
+    }
+
+    Producer(const Producer &) = delete;
+    Producer & operator=(const Producer &) = delete;
+
+    void append(const T * values, size_t n) {
+      for (size_t i = 0; i < n; i++) {
+        T v = values[i];
+        unsigned int bucketi = extractDigitOpt<D>(v);
+        buffers[(bucketi * producerChunkN) + bufferN[bucketi]] = v;
+        if (++bufferN[bucketi] == producerChunkN) {
+          handOff(bucketi);
+        }
+      }
+    }
+
+    // Hand off the partial chunks, keys appended so far are then visible to finish()
+
+    void flush() {
+      for (unsigned int bucketi = 0; bucketi < bucketMax; bucketi++) {
+        if (bufferN[bucketi] > 0) {
+          handOff(bucketi);
+        }
+      }
+    }
+
+  private:
+    void handOff(unsigned int bucketi) {
+      sorter.appendChunk(bucketi, &buffers[bucketi * producerChunkN], bufferN[bucketi]);
+      bufferN[bucketi] = 0;
+    }
+
+    IncrementalSorter & sorter;
+    std::vector<T> buffers;
+    size_t bufferN[bucketMax] = {};
+  };
+
+  IncrementalSorter() = default;
+
+  IncrementalSorter(const IncrementalSorter &) = delete;
+  IncrementalSorter & operator=(const IncrementalSorter &) = delete;
+
+  // Number of keys handed off by producers
+
+  size_t size() {
+    size_t n = 0;
+    for (unsigned int bucketi = 0; bucketi < bucketMax; bucketi++) {
+      std::lock_guard<std::mutex> lock(buckets[bucketi].mutex);
+      n += buckets[bucketi].n;
+    }
+    return n;
+  }
+
+  // Write all keys to out in sorted order, out must hold size() keys. All producers
+  // must be flushed first. Buckets are sorted on numThreads threads, 0 means all
+  // hardware threads. The sorter is empty afterwards and can be reused.
+
+  void finish(T * out, unsigned int numThreads = 1) {
+    size_t bucketStart[bucketMax + 1];
+
+    size_t psum = 0;
+    for (unsigned int bucketi = 0; bucketi < bucketMax; bucketi++) {
+      bucketStart[bucketi] = psum;
+      psum += buckets[bucketi].n;
+    }
+    bucketStart[bucketMax] = psum;
+
+    if (numThreads == 0) {
+      numThreads = hardwareInfo().numLogicalCores;
+    }
+    numThreads = (unsigned int) std::max((size_t) 1, std::min((size_t) numThreads, psum / parallelSortMinTaskN));
+
+    // Buckets are handed out largest first, so that a large bucket is not left
+    // until the end while the other threads are idle
+
+    uint8_t bucketOrder[bucketMax];
+    for (unsigned int bucketi = 0; bucketi < bucketMax; bucketi++) {
+      bucketOrder[bucketi] = bucketi;
+    }
+    std::sort(bucketOrder, bucketOrder + bucketMax, [&](uint8_t b0, uint8_t b1) {
+      return buckets[b0].n > buckets[b1].n;
+    });
+
+    std::atomic<unsigned int> nextOrderi(0);
+
+    // The calling thread runs as threadi = 0
+    bool wasEnabled = histogramOptThreadsEnabled();
+
+    parallelForThreadsOpt(numThreads, [&](unsigned int threadi) {
+      (void) threadi;
+
+      // All threads are busy with buckets, so large buckets must not start histogram threads
+      histogramOptThreadsEnabled() = false;
+
+      for (unsigned int orderi = nextOrderi++; orderi < bucketMax; orderi = nextOrderi++) {
+        unsigned int bucketi = bucketOrder[orderi];
+        Bucket & bucket = buckets[bucketi];
+        T * bucketOut = out + bucketStart[bucketi];
+
+        for (auto & chunk : bucket.chunks) {
+          memcpy(bucketOut, chunk.data(), chunk.size() * sizeof(T));
+          bucketOut += chunk.size();
+        }
+
+        // Keep one chunk for the next handoff, the others are released
+        if (bucket.freeChunks.empty() && !bucket.chunks.empty()) {
+          bucket.chunks.front().clear();
+          bucket.freeChunks.push_back(std::move(bucket.chunks.front()));
+        }
+
+        std::vector<std::vector<T>>().swap(bucket.chunks);
+        bucket.n = 0;
+
+        // The bucket is sorted by the digits below D, the bucket is still in cache
+        // from the copy
+        recurseBucketOptLarge<D>(out, bucketStart[bucketi], bucketStart[bucketi + 1]);
+      }
+    });
+
+    histogramOptThreadsEnabled() = wasEnabled;
+  }
+
+private:
+  // Copy n keys into a chunk from the bucket free list, a chunk is only allocated
+  // when the free list is empty. The keys are copied without holding the lock.
+
+  void appendChunk(unsigned int bucketi, const T * values, size_t n) {
+    Bucket & bucket = buckets[bucketi];
+    std::vector<T> chunk;
+
+    {
+      std::lock_guard<std::mutex> lock(bucket.mutex);
+      if (!bucket.freeChunks.empty()) {
+        chunk = std::move(bucket.freeChunks.back());
+        bucket.freeChunks.pop_back();
+      }
+    }
+
+    if (chunk.capacity() == 0) {
+      chunk.reserve(producerChunkN);
+    }
+    chunk.assign(values, values + n);
+
+    std::lock_guard<std::mutex> lock(bucket.mutex);
+    bucket.chunks.push_back(std::move(chunk));
+    bucket.n += n;
+  }
+
+  struct alignas(64) Bucket {
+    std::mutex mutex;
+    std::vector<std::vector<T>> chunks;
+    std::vector<std::vector<T>> freeChunks;
+    size_t n = 0;
+  };
+
+  Bucket buckets[bucketMax];
+};
@@ -1,813 +1,3184 @@
+#pragma once
+
 #include <iostream>
 #include <cstdint>
+#include <thread>
+#include <vector>
+#include <type_traits>
+#include <utility>
+#include <cstring>
+#include <bit>
 
 #if defined(DEBUG)
 #include <assert.h>
 #endif
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "bit_set_256.hpp"
+#include "bit_set_wide.hpp"
+#include "histogram_simd.hpp"
+#include "small_sort_simd.hpp"
 
-#include <sys/sysctl.h>
+#include "hardware_info.hpp"
 
 static inline
 size_t cache_line_size() {
-    size_t line_size = 0;
-    size_t sizeof_line_size = sizeof(line_size);
-    sysctlbyname("hw.cachelinesize", &line_size, &sizeof_line_size, 0, 0);
-    return line_size;
+    return hardwareInfo().cacheLineSize;
 }
 
 static inline
 size_t l1_data_cache_size() {
-    size_t l1_size = 0;
-    size_t sizeof_l1_size = sizeof(l1_size);
-    sysctlbyname("hw.l1dcachesize", &l1_size, &sizeof_l1_size, 0, 0);
-    return l1_size;
+    return hardwareInfo().l1DataCacheSize;
 }
 
 // Return number of bytes in one memory page
 
 static inline
 size_t page_size() {
-    size_t page_size = 0;
-    size_t sizeof_page_size = sizeof(page_size);
-    sysctlbyname("hw.pagesize", &page_size, &sizeof_page_size, 0, 0);
-    return page_size;
+    return hardwareInfo().pageSize;
+}
+
+// Largest bucket that is sorted with a small sort instead of another partition level.
+// 128 values was tuned on an Intel Core i5 with a 32 KB L1, the cutoff scales with the
+// L1 size and is capped at the size of the small sort buffer.
+
+static inline
+unsigned int smallBucketMaxN() {
+  static const unsigned int maxN = (unsigned int) std::min<size_t>(std::max<size_t>(l1_data_cache_size() / 256, 16), smallSortMaxN);
+  return maxN;
+}
+
+// Largest range that is LSD sorted through a thread local scratch buffer instead of
+// being partitioned, see countingSortMidOpt(). A range of 64 bit keys and its scratch
+// buffer fit in half of the L2 cache. Define MID_BUCKET_MAX_N to override, 0 disables.
+
+static inline
+unsigned int midBucketMaxN() {
+#if defined(MID_BUCKET_MAX_N)
+  return MID_BUCKET_MAX_N;
+#else
+  static const unsigned int maxN = (unsigned int) std::min<size_t>(std::max<size_t>(hardwareInfo().l2CacheSize, 256 * 1024) / 32, 1 << 14);
+  return maxN;
+#endif // MID_BUCKET_MAX_N
 }
 
-// Given a 32 bit integer, extract a specific digit.
+// Map a key to an unsigned integer of the same width that orders the same way, so that
+// the radix digits of signed and floating point keys can be extracted directly from
+// each value as it is read (no pre and post pass over the array).
+//
+// unsigned : unchanged
+// signed   : flip the sign bit so that negative values order before positive values
+// float    : IEEE-754 bits, negative values have all bits flipped while positive
+//            values have just the sign bit flipped
 //
-// uint32_t digit = extractDigitOpt<0>(v, digitOffset);
+// Float ordering is the total order of the bits: -NaN < -inf < ... < -0.0 < +0.0
+// < ... < +inf < +NaN. Note that -0.0 sorts before +0.0 even though they compare
+// equal, and NaN values with the sign bit set sort before all other values.
 
-template <unsigned int D>
+template <typename T>
 static inline
-unsigned int extractDigitOpt(uint32_t v) {
-  if constexpr (D == 3) {
-    return v >> (3 * 8);
-  } else if constexpr (D == 2) {
-    return (v >> (2 * 8)) & 0xFF;
-  } else if constexpr (D == 1) {
-    return (v >> (1 * 8)) & 0xFF;
+auto radixKeyOpt(T v) {
+  if constexpr (std::is_floating_point<T>::value) {
+    typedef typename std::conditional<sizeof(T) == sizeof(uint32_t), uint32_t, uint64_t>::type U;
+    static_assert(sizeof(T) == sizeof(U), "float key must be 32 or 64 bits");
+    U bits;
+    memcpy(&bits, &v, sizeof(bits));
+    constexpr U signBit = ((U) 1) << (sizeof(U) * 8 - 1);
+    U mask = ((U) 0 - (bits >> (sizeof(U) * 8 - 1))) | signBit;
+    return (U) (bits ^ mask);
+  } else if constexpr (std::is_signed<T>::value) {
+    typedef typename std::make_unsigned<T>::type U;
+    constexpr U signBit = ((U) 1) << (sizeof(U) * 8 - 1);
+    return (U) (((U) v) ^ signBit);
+  } else {
+    return v;
+  }
+}
+
+// Inverse of radixKeyOpt(), returns the original key
+
+template <typename T, typename U>
+static inline
+T radixKeyInverseOpt(U key) {
+  if constexpr (std::is_floating_point<T>::value) {
+    constexpr U signBit = ((U) 1) << (sizeof(U) * 8 - 1);
+    U bits = (key & signBit) ? (key ^ signBit) : (U) ~key;
+    T v;
+    memcpy(&v, &bits, sizeof(v));
+    return v;
+  } else if constexpr (std::is_signed<T>::value) {
+    constexpr U signBit = ((U) 1) << (sizeof(U) * 8 - 1);
+    return (T) (key ^ signBit);
+  } else {
+    return (T) key;
+  }
+}
+
+// Given a 32 or 64 bit key, extract a specific digit of radixKeyOpt(v). D ranges
+// from 0 up to 3 for 32 bit values and up to 7 for 64 bit values.
+//
+// uint32_t digit = extractDigitOpt<0>(v);
+
+template <unsigned int D, typename T>
+static inline
+unsigned int extractDigitOpt(T v) {
+  constexpr unsigned int topDigit = sizeof(T) - 1;
+  static_assert(D <= topDigit, "digit D is larger than the key type");
+  
+  auto key = radixKeyOpt(v);
+  
+  if constexpr (D == topDigit) {
+    return (unsigned int) (key >> (D * 8));
   } else if constexpr (D == 0) {
-    return v & 0xFF;
+    return (unsigned int) (key & 0xFF);
+  } else {
+    return (unsigned int) ((key >> (D * 8)) & 0xFF);
+  }
+}
+
+// Ranges with at least this many values are histogrammed by multiple threads,
+// a single core cannot saturate memory bandwidth on a full read pass.
+
+constexpr unsigned int parallelHistogramMinN = 1 << 22;
+
+// Parallel histogram is only used when enabled for the calling thread. Threads
+// that are already part of a parallel sort disable it so that a large bucket
+// does not start yet another set of threads.
+
+static inline
+bool & histogramOptThreadsEnabled() {
+  static thread_local bool enabled = true;
+  return enabled;
+}
+
+static inline
+unsigned int histogramOptNumThreads() {
+  static const unsigned int numThreads = hardwareInfo().numLogicalCores;
+  return numThreads;
+}
+
+template <unsigned int D, unsigned int M, typename T>
+static inline
+void histogramOpt(
+                  T * arr,
+                  unsigned int starti,
+                  unsigned int endi,
+                  unsigned int & bucketi,
+                  uint32_t * table1
+                  );
+
+// Split arr[starti, endi) into one chunk per thread, each thread fills a cache line
+// aligned private table and the private tables are then summed into counts. On return
+// bucketi is the bucket of the last value, the same as the single threaded histogram.
+// parallelFor(fn) must invoke fn(threadi) for each threadi in [0, numThreads) and
+// return once all have finished, so a caller can run the chunks on threads it owns.
+
+template <unsigned int D, unsigned int M, typename T, typename F>
+static inline
+void histogramParallelOpt(
+                  T * arr,
+                  unsigned int starti,
+                  unsigned int endi,
+                  unsigned int & bucketi,
+                  uint32_t * counts,
+                  unsigned int numThreads,
+                  F && parallelFor
+                  )
+{
+  typedef struct alignas(64) {
+    uint32_t table1[M];
+  } threadTables_t;
+
+  const unsigned int n = endi - starti;
+
+  std::vector<threadTables_t> threadTables(numThreads, threadTables_t{});
+
+  auto histogramChunk = [&](unsigned int threadi) {
+    const unsigned int chunkStarti = starti + (unsigned int) (((uint64_t) n * threadi) / numThreads);
+    const unsigned int chunkEndi = starti + (unsigned int) (((uint64_t) n * (threadi+1)) / numThreads);
+
+    bool wasEnabled = histogramOptThreadsEnabled();
+    histogramOptThreadsEnabled() = false;
+    unsigned int chunkBucketi = M;
+    histogramOpt<D, M>(arr, chunkStarti, chunkEndi, chunkBucketi, threadTables[threadi].table1);
+    histogramOptThreadsEnabled() = wasEnabled;
+  };
+
+  parallelFor(histogramChunk);
+
+  for (unsigned int threadi = 0; threadi < numThreads; threadi++) {
+    for (unsigned int tablei = 0; tablei < M; tablei++) {
+      counts[tablei] += threadTables[threadi].table1[tablei];
+    }
+  }
+
+  if (n > 0) {
+    bucketi = extractDigitOpt<D>(arr[endi - 1]);
   }
 }
 
+// Parallel histogram on numThreads - 1 new threads plus the calling thread
+
+template <unsigned int D, unsigned int M, typename T>
+static inline
+void histogramParallelOpt(
+                  T * arr,
+                  unsigned int starti,
+                  unsigned int endi,
+                  unsigned int & bucketi,
+                  uint32_t * counts,
+                  unsigned int numThreads
+                  )
+{
+  histogramParallelOpt<D, M>(arr, starti, endi, bucketi, counts, numThreads, [numThreads](auto & histogramChunk) {
+    std::vector<std::thread> threads;
+    threads.reserve(numThreads - 1);
+    for (unsigned int threadi = 1; threadi < numThreads; threadi++) {
+      threads.emplace_back(histogramChunk, threadi);
+    }
+    histogramChunk(0);
+    for (auto & thread : threads) {
+      thread.join();
+    }
+  });
+}
+
 // Extract histogram logic into util method so profiling visibility.
 // Note that bucketi writes back into caller stack because of
-// special case of all values in same bucket.
+// special case of all values in same bucket. Large ranges are
+// split across threads, see parallelHistogramMinN, and ranges of
+// at least histogramSimdMinN use the kernel from histogram_simd.hpp.
 
-template <unsigned int D, unsigned int M>
+template <unsigned int D, unsigned int M, typename T>
 static inline
 void histogramOpt(
-                  uint32_t * arr,
+                  T * arr,
                   unsigned int starti,
                   unsigned int endi,
                   unsigned int & bucketi,
-                  uint32_t * table1,
-                  uint32_t * table2
+                  uint32_t * table1
                   )
 {
-//#define UNROLL_HISTOGRAMS2
-//#define UNROLL_HISTOGRAMS4
-
-  constexpr unsigned int bucketMax = M;
-  
-#if !defined(UNROLL_HISTOGRAMS2) && !defined(UNROLL_HISTOGRAMS4)
-  for (auto readi = starti; readi < endi; readi++) {
-    auto readVal = arr[readi];
-    bucketi = extractDigitOpt<D>(readVal);
-#if defined(DEBUG)
-    assert(bucketi < bucketMax);
-#endif
-    ++table1[bucketi];
+  if ((endi - starti) >= parallelHistogramMinN && histogramOptThreadsEnabled()) {
+    const unsigned int numThreads = histogramOptNumThreads();
+    if (numThreads > 1) {
+      histogramParallelOpt<D, M>(arr, starti, endi, bucketi, table1, numThreads);
+      return;
+    }
   }
-#elif defined(UNROLL_HISTOGRAMS2)
-  constexpr size_t unroll_count = 2;
-  unsigned int unrolledLoops = (endi - starti) / unroll_count;
-  unsigned int unrolledEnd = unrolledLoops * unroll_count;
   
-  unsigned int readi = starti;
-  for (; readi < unrolledEnd; readi += unroll_count) {
-    unsigned int bucketi0 = extractDigitOpt<D>(arr[readi+0]);
-    unsigned int bucketi1 = extractDigitOpt<D>(arr[readi+1]);
+  constexpr unsigned int bucketMax = M;
 
+  if constexpr (bucketMax == 256) {
+    if ((endi - starti) >= histogramSimdMinN) {
+      if constexpr (std::is_same<T, uint32_t>::value) {
+        histogramKernelOpt<D>(arr, starti, endi, table1, histogramKernel());
+      } else if constexpr (std::is_integral<T>::value && std::is_signed<T>::value && sizeof(T) == sizeof(uint32_t)) {
+        // The sign flip only changes the top digit, so count the unsigned
+        // digits and then move each count to the flipped digit.
+        uint32_t unsignedCounts[bucketMax] = {};
+        histogramKernelOpt<D>((const uint32_t *) arr, starti, endi, unsignedCounts, histogramKernel());
+        constexpr unsigned int flip = (D == 3) ? 0x80 : 0;
+        for (unsigned int digit = 0; digit < bucketMax; digit++) {
+          table1[digit ^ flip] += unsignedCounts[digit];
+        }
+      } else {
+        histogramKernelScalar<D>(arr, starti, endi, table1, [](T v) {
+          return radixKeyOpt(v);
+        });
+      }
+      bucketi = extractDigitOpt<D>(arr[endi - 1]);
 #if defined(DEBUG)
-    assert(bucketi0 < bucketMax);
-    assert(bucketi1 < bucketMax);
-#endif
-    
-    ++table1[bucketi0];
-    ++table2[bucketi1];
-  }
-  for (; readi < endi; readi++) {
-    bucketi = extractDigitOpt<D>(arr[readi]);
-#if defined(DEBUG)
-    assert(bucketi < bucketMax);
+      assert(bucketi < bucketMax);
 #endif
-    ++table1[bucketi];
+      return;
+    }
   }
   
-  for (unsigned int bucketi = 0; bucketi < bucketMax; bucketi++) {
-    table1[bucketi] = table1[bucketi] + table2[bucketi];
-  }
-
-  if (bucketi == bucketMax) {
-    // Wacky case of no cleanup loops, grab last bucketi explicitly
-    readi -= 1;
+  for (auto readi = starti; readi < endi; readi++) {
     auto readVal = arr[readi];
     bucketi = extractDigitOpt<D>(readVal);
 #if defined(DEBUG)
     assert(bucketi < bucketMax);
 #endif
+    ++table1[bucketi];
+  }
+}
+
+// Histogram of a range that can hold more than UINT32_MAX values. Each chunk is
+// counted into a 32 bit table with histogramOpt() and then added to the 64 bit counts.
+
+template <unsigned int D, typename T>
+static inline
+void histogramLargeOpt(
+                       T * arr,
+                       size_t starti,
+                       size_t endi,
+                       unsigned int & bucketi,
+                       size_t * counts
+                       )
+{
+  constexpr size_t chunkMaxN = ((size_t) 1) << 30;
+
+  for (size_t chunkStarti = starti; chunkStarti < endi; chunkStarti += chunkMaxN) {
+    const unsigned int chunkN = (unsigned int) std::min(chunkMaxN, endi - chunkStarti);
+
+    uint32_t chunkCounts[256] = {};
+    histogramOpt<D, 256>(arr + chunkStarti, 0, chunkN, bucketi, chunkCounts);
+
+    for (unsigned int digit = 0; digit < 256; digit++) {
+      counts[digit] += chunkCounts[digit];
+    }
   }
-#else // UNROLL_HISTOGRAMS4
-  uint32_t table3[bucketMax] = {};
-  uint32_t table4[bucketMax] = {};
+}
+
+// OR of (v ^ arr[starti]) over the raw bits of all values, a zero bit means that bit is
+// the same in every value. The radixKeyOpt() transform does not need to be applied
+// since keys with the same sign are transformed with the same mask and keys with
+// different signs already differ in the top bit. The scan stops early once the top
+// digit is known to vary, so random inputs only read the first block.
+
+template <typename T>
+static inline
+auto radixDiffBitsOpt(
+                      const T * arr,
+                      size_t starti,
+                      size_t endi
+                      )
+{
+  typedef decltype(radixKeyOpt(arr[starti])) U;
   
-  constexpr size_t unroll_count = 4;
-  unsigned int unrolledLoops = (endi - starti) / unroll_count;
-  unsigned int unrolledEnd = unrolledLoops * unroll_count;
+  constexpr unsigned int blockN = 1024;
+  constexpr U topDigitMask = ((U) 0xFF) << ((sizeof(U) - 1) * 8);
   
-  unsigned int readi = starti;
-  for (; readi < unrolledEnd; readi += unroll_count) {
-    unsigned int bucketi0 = extractDigitOpt<D>(arr[readi+0]);
-    unsigned int bucketi1 = extractDigitOpt<D>(arr[readi+1]);
-    unsigned int bucketi2 = extractDigitOpt<D>(arr[readi+2]);
-    unsigned int bucketi3 = extractDigitOpt<D>(arr[readi+3]);
-
-#if defined(DEBUG)
-    assert(bucketi0 < bucketMax);
-    assert(bucketi1 < bucketMax);
-    assert(bucketi2 < bucketMax);
-    assert(bucketi3 < bucketMax);
-#endif
+  U first;
+  memcpy(&first, &arr[starti], sizeof(U));
+  
+  U diff0 = 0;
+  U diff1 = 0;
+  U diff2 = 0;
+  U diff3 = 0;
+  
+  size_t readi = starti;
+  
+  while ((endi - readi) >= blockN) {
+    for (size_t blockEnd = readi + blockN; readi < blockEnd; readi += 4) {
+      U v[4];
+      memcpy(v, &arr[readi], sizeof(v));
+      diff0 |= v[0] ^ first;
+      diff1 |= v[1] ^ first;
+      diff2 |= v[2] ^ first;
+      diff3 |= v[3] ^ first;
+    }
     
-    ++table1[bucketi0];
-    ++table2[bucketi1];
-    ++table3[bucketi2];
-    ++table4[bucketi3];
-  }
-  for (; readi < endi; readi++) {
-    bucketi = extractDigitOpt<D>(arr[readi]);
-#if defined(DEBUG)
-    assert(bucketi < bucketMax);
-#endif
-    ++table1[bucketi];
+    if (((diff0 | diff1 | diff2 | diff3) & topDigitMask) != 0) {
+      return (U) (diff0 | diff1 | diff2 | diff3);
+    }
   }
   
-  for (unsigned int bucketi = 0; bucketi < bucketMax; bucketi++) {
-    table1[bucketi] = table1[bucketi] + table2[bucketi] + table3[bucketi] + table4[bucketi];
-  }
-
-  if (bucketi == bucketMax) {
-    // Wacky case of no cleanup loops, grab last bucketi explicitly
-    readi -= 1;
-    auto readVal = arr[readi];
-    bucketi = extractDigitOpt<D>(readVal);
-#if defined(DEBUG)
-    assert(bucketi < bucketMax);
-#endif
+  for ( ; readi < endi; readi++) {
+    U v;
+    memcpy(&v, &arr[readi], sizeof(U));
+    diff0 |= v ^ first;
   }
-#endif // UNROLL_HISTOGRAMS4
+  
+  return (U) (diff0 | diff1 | diff2 | diff3);
 }
 
-// D is digit 3,2,1,0 for 32 bit unsigned int inputs. This hybrid of American Flag sort and SkaSort
-// significantly outperforms both earlier implementations.
+// Index of the first digit (from the top) that is not the same in all values, the
+// diffBits value must not be zero.
 
-template <unsigned int D>
-__attribute__((noinline))
+template <typename U>
+static inline
+unsigned int radixFirstVaryingDigitOpt(U diffBits)
+{
+  return (unsigned int) ((std::bit_width(diffBits) - 1) / 8);
+}
+
+template <unsigned int D, typename T>
 void countingSortInPlaceOpt(
-  uint32_t * arr,
+  T * arr,
   unsigned int starti,
-  unsigned int endi)
+  unsigned int endi,
+  bool upperDigitsEqual = false);
+
+template <unsigned int D, typename T>
+void countingSortInPlaceOptKnownCounts(
+  T * arr,
+  unsigned int starti,
+  unsigned int endi,
+  const unsigned int * counts);
+
+template <unsigned int D, typename T>
+bool countingSortMidOpt(
+  T * arr,
+  unsigned int starti,
+  unsigned int endi);
+
+template <unsigned int D, typename T, typename U>
+bool countingSortMidOpt(
+  T * arr,
+  unsigned int starti,
+  unsigned int endi,
+  U diffBits);
+
+template <typename I, typename T>
+void countingSortInPlaceOptWide(
+  T * arr,
+  I starti,
+  I endi,
+  unsigned int bits);
+
+// Output ranges of at least this many bytes are written with non-temporal stores
+// since the output would not fit in the cache anyway and the stores then do not
+// need to read each cache line before it is written.
+
+constexpr size_t regenerateStreamMinBytes = 1 << 23;
+
+// Ranges with a 16 bit domain and fewer values are sorted by digit instead
+
+constexpr unsigned int regenerate16MinN = 1 << 16;
+
+// Write count copies of v starting at out. With streaming the aligned middle of the
+// run is written with non-temporal stores, the caller must issue an sfence when done.
+
+template <typename T>
+static inline
+void regenerateRunOpt(
+                      T * out,
+                      T v,
+                      unsigned int count,
+                      bool streaming
+                      )
 {
-  constexpr bool debugOut = false;
-  constexpr bool debugDumpInOutValues = false;
-  constexpr bool debugDumpHistogram = false;
-  constexpr bool debugDumpPrefixSum = false;
-  int n = endi - starti;
+#if defined(__SSE2__)
+  if (streaming) {
+    while (count > 0 && (((uintptr_t) out) & 15) != 0) {
+      *out++ = v;
+      --count;
+    }
     
-  // if (n < 2) {
-  //   std::cout << "countingSortInPlace early return from recursion " << starti << " up to " << endi << std::endl;
-  //   std::cout << "n " << n << std::endl;
-  //   return;
-  // }
-  
-  auto recurse = [](
-                    uint32_t *arr,
-                    unsigned int starti,
-                    unsigned int endi
-                    )
-  {
-    if constexpr (D > 0) {
-      unsigned int n = endi - starti;
-      switch (n) {
-        case 1: {
-          // nop
-          break;
-        }
-        case 2: {
-          // Trivial in-place swap if needed
-          auto v0 = arr[starti];
-          auto v1 = arr[starti+1];
-          if (v0 > v1) {
-            std::swap(v0, v1);
-          }
-          arr[starti] = v0;
-          arr[starti+1] = v1;
-          break;
-        }
-        case 3 ... 128: {
-          // Small bucket subrange can be sorted without recursion
-          std::sort(arr+starti, arr+endi);
-          break;
-        }
-        default: {
-          countingSortInPlaceOpt<D-1>(arr, starti, endi);
-          break;
-        }
-      }
+    __m128i vec;
+    if constexpr (sizeof(T) == sizeof(uint32_t)) {
+      uint32_t bits;
+      memcpy(&bits, &v, sizeof(bits));
+      vec = _mm_set1_epi32((int) bits);
+    } else {
+      uint64_t bits;
+      memcpy(&bits, &v, sizeof(bits));
+      vec = _mm_set1_epi64x((long long) bits);
     }
-  };
-	
-  if (debugOut) {
-    std::cout << "countingSortInPlace D = " << D << " input:" << std::endl;
-    std::cout << "n " << n << std::endl;
-    std::cout << "starti " << starti << std::endl;
-    std::cout << "endi " << endi << std::endl;
-
-    if (debugDumpInOutValues) {
-      for (int i = starti; i < endi; i++) {
-        std::cout << (unsigned int) arr[i] << std::endl;
-      }
+    
+    constexpr unsigned int perVec = sizeof(__m128i) / sizeof(T);
+    
+    for ( ; count >= perVec; count -= perVec, out += perVec) {
+      _mm_stream_si128((__m128i *) out, vec);
     }
-    std::cout << "-------- " << std::endl;
   }
-    
-  constexpr unsigned int bucketMax = 256;
+#endif // __SSE2__
+  
+  std::fill_n(out, count, v);
+}
 
-  // counts and offsets can both be used for bucket counts and then start/end offsets.
-  // Init both to zero to support multiple uses.
+// Count each key by the low DomainBits bits of radixKeyOpt(v), all keys must have the
+// same high bits. Returns the high bits, counts must hold (1 << DomainBits) zeroed entries.
 
-  uint32_t counts[bucketMax] = {};
-  uint32_t offsets[bucketMax] = {};
+template <unsigned int DomainBits, typename T>
+static inline
+auto regenerateCountsOpt(
+                         T * arr,
+                         unsigned int starti,
+                         unsigned int endi,
+                         uint32_t * counts
+                         )
+{
+  typedef decltype(radixKeyOpt(arr[starti])) U;
   
-  // Histogram counts
-  unsigned int histogramBucketi = bucketMax;
+  constexpr unsigned int domainN = 1 << DomainBits;
   
-  histogramOpt<D, bucketMax>(arr, starti, endi, histogramBucketi, counts, offsets);
+  const U prefix = radixKeyOpt(arr[starti]) & ~((U) (domainN - 1));
   
-  if (debugDumpHistogram) {
-    std::cout << "countingSortInPlace D = " << D << " counts:" << std::endl;
-    
-    for (unsigned int bucketi = 0; bucketi < bucketMax; bucketi++) {
-      auto count = counts[bucketi];
-      if (count != 0) {
-        std::cout << "[" << bucketi << "] = " << count << std::endl;
-      }
+  if constexpr (domainN == 256) {
+    unsigned int bucketi = domainN;
+    histogramOpt<0, 256>(arr, starti, endi, bucketi, counts);
+  } else {
+    for (unsigned int readi = starti; readi < endi; readi++) {
+      U key = radixKeyOpt(arr[readi]);
+#if defined(DEBUG)
+      assert((key & ~((U) (domainN - 1))) == prefix);
+#endif
+      ++counts[key & (domainN - 1)];
     }
-    std::cout << "-------- " << std::endl;
   }
   
-  // Special case where all values map to the same bucket.
-  // The count logic needs to be done, but prefix sum and
-  // looping over all the values to calculate buckets will
-  // result in no reordering.
+  return prefix;
+}
+
+// Counting sort for keys that only differ in the low DomainBits bits. The keys are
+// counted and then the output is regenerated from the counts, so there is one read
+// pass and one sequential write pass instead of a swap for each value.
+
+template <unsigned int DomainBits, typename T>
+static inline
+void countingSortRegenerateOpt(
+                               T * arr,
+                               unsigned int starti,
+                               unsigned int endi
+                               )
+{
+  typedef decltype(radixKeyOpt(arr[starti])) U;
   
-  if (histogramBucketi != bucketMax) {
-    auto count = counts[histogramBucketi];
-    if (count == n) {
-      // Special case where all values scan into a single bucket.
-      if (debugOut) {
-        std::cout << "all " << n << " values in same bucket " << histogramBucketi << std::endl;
-      }
-      
-      recurse(arr, starti, endi);
-      
-      return;
+  constexpr unsigned int domainN = 1 << DomainBits;
+  
+  uint32_t smallCounts[(domainN <= 256) ? domainN : 1] = {};
+  std::vector<uint32_t> largeCounts((domainN <= 256) ? 0 : domainN);
+  uint32_t * counts = (domainN <= 256) ? smallCounts : largeCounts.data();
+  
+  const U prefix = regenerateCountsOpt<DomainBits>(arr, starti, endi, counts);
+  
+  const bool streaming = ((size_t) (endi - starti) * sizeof(T)) >= regenerateStreamMinBytes;
+  
+  T * out = arr + starti;
+  
+  for (unsigned int digit = 0; digit < domainN; digit++) {
+    unsigned int count = counts[digit];
+    if (count > 0) {
+      regenerateRunOpt(out, radixKeyInverseOpt<T>((U) (prefix | digit)), count, streaming);
+      out += count;
     }
   }
   
+#if defined(__SSE2__)
+  if (streaming) {
+    _mm_sfence();
+  }
+#endif // __SSE2__
+  
 #if defined(DEBUG)
-  // Double check bucket start/end offsets as as they become empty (before recursion)
-  uint32_t checkBucketStart[bucketMax] = {};
-  uint32_t checkBucketEnd[bucketMax] = {};
-  bool checkBucketRecursion[bucketMax] = {};
+  assert(out == (arr + endi));
 #endif
-  
-  // Prefix Sum (given starting offset), note that after this loop is completed the
-  // counts field is converted to an end of bucket offset.
-  
-  unsigned int psum = starti;
-  for (unsigned int bucketi = 0; bucketi < bucketMax; bucketi++) {
-    auto count = counts[bucketi];
-    offsets[bucketi] = psum;
-    psum += count;
-    
+}
+
+// Sort a small range of keys in radixKeyOpt() order. Unsigned keys are sorted directly,
+// other 32 bit keys are mapped to unsigned keys in a stack buffer so that the sorting
+// network can be used and so that float NaN values have a well defined order.
+
+template <typename T>
+static inline
+void smallSortRadixKeyOpt(
+                          T * arr,
+                          unsigned int starti,
+                          unsigned int endi
+                          )
+{
+  if constexpr (std::is_unsigned<T>::value) {
+    smallSortOpt(arr, starti, endi);
+  } else if constexpr (sizeof(T) == sizeof(uint32_t)) {
+    const unsigned int n = endi - starti;
 #if defined(DEBUG)
-    checkBucketStart[bucketi] = offsets[bucketi];
-    checkBucketEnd[bucketi] = offsets[bucketi] + counts[bucketi];
+    assert(n <= smallSortMaxN);
 #endif
-    
-    counts[bucketi] = psum;
+    uint32_t keys[smallSortMaxN];
+    for (unsigned int i = 0; i < n; i++) {
+      keys[i] = radixKeyOpt(arr[starti + i]);
+    }
+    smallSortOpt(keys, 0, n);
+    for (unsigned int i = 0; i < n; i++) {
+      arr[starti + i] = radixKeyInverseOpt<T>(keys[i]);
+    }
+  } else {
+    std::sort(arr+starti, arr+endi, [](T v0, T v1) {
+      return radixKeyOpt(v0) < radixKeyOpt(v1);
+    });
   }
-  
-  if (debugDumpPrefixSum) {
-    std::cout << "countingSortInPlace D = " << D << " prefix sum:" << std::endl;
-    
-    for (unsigned int bucketi = 0; bucketi < bucketMax; bucketi++) {
-      auto count = counts[bucketi] - offsets[bucketi];
-      auto offset = offsets[bucketi];
-      if (count != 0) {
-        std::cout << "[" << bucketi << "] = " << offset << std::endl;
+}
+
+// Sort the values in a single bucket once the digit D partition is known
+// to be complete. Small buckets are sorted directly, larger buckets recurse
+// into the next digit. Note that D = 0 buckets are already fully sorted.
+// When childCounts is not null it holds the digit D-1 histogram of the bucket.
+
+template <unsigned int D, typename T>
+static inline
+void recurseBucketOpt(
+                      T *arr,
+                      unsigned int starti,
+                      unsigned int endi,
+                      const unsigned int * childCounts = nullptr
+                      )
+{
+  if constexpr (D > 0) {
+    unsigned int n = endi - starti;
+    switch (n) {
+      case 1: {
+        // nop
+        break;
+      }
+      case 2: {
+        // Trivial in-place swap if needed
+        auto v0 = arr[starti];
+        auto v1 = arr[starti+1];
+        if (radixKeyOpt(v0) > radixKeyOpt(v1)) {
+          std::swap(v0, v1);
+        }
+        arr[starti] = v0;
+        arr[starti+1] = v1;
+        break;
+      }
+      default: {
+        if (n <= smallBucketMaxN()) {
+          // Small bucket subrange can be sorted without recursion
+          smallSortRadixKeyOpt(arr, starti, endi);
+        } else if constexpr (D == 1) {
+          // Only the last digit differs, so the bucket can be regenerated from counts.
+          // A direct call on a low digit with varying digits above never gets here,
+          // see countingSortInPlaceOpt().
+          countingSortRegenerateOpt<8>(arr, starti, endi);
+        } else if (childCounts != nullptr) {
+          countingSortInPlaceOptKnownCounts<D-1>(arr, starti, endi, childCounts);
+        } else {
+          countingSortInPlaceOpt<D-1>(arr, starti, endi, true);
+        }
+        break;
       }
     }
-    std::cout << "-------- " << std::endl;
   }
-  
-  // This nonEmptyBuckets bitset contains a flag for each bucket that starts out as
-  // non-empty. When a bucket is discovered to be fully processed, the bit is cleared.
+}
 
-  bitset256_t nonEmptyBuckets;
-  bitset256Clear(nonEmptyBuckets);
+template <unsigned int D, typename T, typename V>
+void countingSortInPlaceOptKV(
+  T * keys,
+  V * values,
+  unsigned int starti,
+  unsigned int endi);
+
+// Sort a small key + value range by copying pairs into a stack buffer. A 32 bit key and
+// 32 bit value are packed into one 64 bit word with the key in the high bits so that
+// the comparison is a single integer compare.
+
+template <typename T, typename V>
+static inline
+void smallSortKVOpt(
+                    T * keys,
+                    V * values,
+                    unsigned int starti,
+                    unsigned int endi
+                    )
+{
+  const unsigned int n = endi - starti;
   
-  for (unsigned int bucketi = 0; bucketi < bucketMax; bucketi++) {
-    auto count = counts[bucketi] - offsets[bucketi];
-    if (count > 0) {
-      bitset256SetBit(nonEmptyBuckets, bucketi);
+#if defined(DEBUG)
+  assert(n <= smallSortMaxN);
+#endif
+  
+  if constexpr (sizeof(T) == sizeof(uint32_t) && sizeof(V) == sizeof(uint32_t)) {
+    uint64_t pairs[smallSortMaxN];
+    for (unsigned int i = 0; i < n; i++) {
+      uint32_t value;
+      memcpy(&value, &values[starti + i], sizeof(value));
+      pairs[i] = (((uint64_t) radixKeyOpt(keys[starti + i])) << 32) | value;
+    }
+    std::sort(pairs, pairs + n);
+    for (unsigned int i = 0; i < n; i++) {
+      uint32_t value = (uint32_t) pairs[i];
+      keys[starti + i] = radixKeyInverseOpt<T>((uint32_t) (pairs[i] >> 32));
+      memcpy(&values[starti + i], &value, sizeof(value));
+    }
+  } else {
+    std::pair<T, V> pairs[smallSortMaxN];
+    for (unsigned int i = 0; i < n; i++) {
+      pairs[i] = std::make_pair(keys[starti + i], values[starti + i]);
+    }
+    std::sort(pairs, pairs + n, [](const std::pair<T, V> & p0, const std::pair<T, V> & p1) {
+      return radixKeyOpt(p0.first) < radixKeyOpt(p1.first);
+    });
+    for (unsigned int i = 0; i < n; i++) {
+      keys[starti + i] = pairs[i].first;
+      values[starti + i] = pairs[i].second;
     }
   }
-  
-  if (debugDumpPrefixSum) {
-    std::cout << "countingSortInPlace D = " << D << " non-empty buckets:" << std::endl;
+}
 
-    bitset256_t copy;
-    bitset256CopyBits(nonEmptyBuckets, copy);
-    
-    for ( ; !bitset256IsAllOff(copy) ; ) {
-      auto bucketi = bitset256FindFirstSetOpt(copy);
-      bitset256ClearBit(copy, bucketi);
-      
-      std::cout << "[" << bucketi << "] = " << " true" << std::endl;
+// Same as recurseBucketOpt() except that values are moved along with the keys
+
+template <unsigned int D, typename T, typename V>
+static inline
+void recurseBucketOptKV(
+                        T *keys,
+                        V *values,
+                        unsigned int starti,
+                        unsigned int endi
+                        )
+{
+  if constexpr (D > 0) {
+    unsigned int n = endi - starti;
+    switch (n) {
+      case 1: {
+        // nop
+        break;
+      }
+      case 2: {
+        if (radixKeyOpt(keys[starti]) > radixKeyOpt(keys[starti+1])) {
+          std::swap(keys[starti], keys[starti+1]);
+          std::swap(values[starti], values[starti+1]);
+        }
+        break;
+      }
+      default: {
+        if (n <= smallBucketMaxN()) {
+          smallSortKVOpt(keys, values, starti, endi);
+        } else {
+          countingSortInPlaceOptKV<D-1>(keys, values, starti, endi);
+        }
+        break;
+      }
     }
-    
-    std::cout << "-------- " << std::endl;
   }
+}
+
+// Lookahead distance in slots for the key + value permutation loops. The digit of the
+// value this many slots ahead is read and the write position in its bucket is prefetched,
+// so that the scatter write is less likely to stall on a cache miss once the range no
+// longer fits in the cache. Off by default, define PERMUTE_PREFETCH_DISTANCE (16 was the
+// best distance) to enable. Key only ranges of 16 MB or more use the block permutation,
+// and for the smaller key only and the key + value partitions measured on a single core
+// x86 VM the lookahead was 5 - 15% slower, e.g. a 2^21 uint32_t key + value partition
+// took 7.2 ns per value with it and 6.2 without. From 2^22 to 2^28 key + value pairs it
+// was within the run to run noise (9.2 - 10.9 ns per value either way), see the
+// testKVPartitionPerformance tests in KeyValueSortTests.
+
+#if defined(PERMUTE_PREFETCH_DISTANCE)
+constexpr size_t permutePrefetchDistance = PERMUTE_PREFETCH_DISTANCE;
+#else
+constexpr size_t permutePrefetchDistance = 0;
+#endif // PERMUTE_PREFETCH_DISTANCE
+
+// Ranges smaller than this are mostly cache resident, the extra digit reads cost more
+// than the prefetch saves.
+
+constexpr size_t permutePrefetchMinBytes = 1 << 23;
+
+// Block buffered permutation for large ranges, in the style of IPS4o / IPS2Ra (Axtmann,
+// Witt, Ferizovic, Sanders "In-place Parallel Super Scalar Samplesort"). Values are first
+// collected in a small buffer per bucket and each full buffer is written back to the front
+// of the range as one block, then whole blocks are swapped into the block aligned region
+// of their bucket and finally the partial blocks at bucket edges are filled in from the
+// buffers. Each value is moved as part of a sequential block write instead of a 4 or 8
+// byte write to a random cache line, the extra memory is 256 blocks. Set
+// BLOCK_PERMUTE_BLOCK_BYTES to 0 to disable.
+
+#if defined(BLOCK_PERMUTE_BLOCK_BYTES)
+constexpr size_t blockPermuteBlockBytes = BLOCK_PERMUTE_BLOCK_BYTES;
+#else
+constexpr size_t blockPermuteBlockBytes = 256;
+#endif // BLOCK_PERMUTE_BLOCK_BYTES
+
+// Define FUSED_CHILD_HISTOGRAM as 1 to count the next digit histogram of each bucket in
+// the block classification pass, see countingSortInPlaceOptBlockPartition(). Off by
+// default since the scattered increments into the 256 x 256 table cost more than the
+// child histogram pass saves on the machines this was measured on.
+
+#if defined(FUSED_CHILD_HISTOGRAM)
+constexpr bool fusedChildHistogram = FUSED_CHILD_HISTOGRAM;
+#else
+constexpr bool fusedChildHistogram = false;
+#endif // FUSED_CHILD_HISTOGRAM
+
+// Ranges with at least this many bytes are partitioned with blocks
+
+constexpr size_t blockPermuteMinBytes = 1 << 24;
+
+// Ranges with at least this many values are partitioned by a top digit wider than 8 bits,
+// see radixTopDigitBitsOpt(). Off by default, the gain that was measured is within the
+// run to run noise. Define WIDE_TOP_DIGIT_MIN_N (for example as 1 << 28) to enable.
+
+#if defined(WIDE_TOP_DIGIT_MIN_N)
+constexpr size_t wideTopDigitMinN = WIDE_TOP_DIGIT_MIN_N;
+#else
+constexpr size_t wideTopDigitMinN = 0;
+#endif // WIDE_TOP_DIGIT_MIN_N
+
+// Digit width schedule for a range of n values: the top digit is 8, 11, 12 or 16 bits and
+// every level below it is an 8 bit digit (where ranges that fit in L2 are LSD sorted, see
+// countingSortMidOpt()). A wider top digit means that each top bucket needs fewer levels
+// below it, but its block buffers (one block per bucket) have to stay in L2 or the block
+// moves miss the cache. The widest digit whose buffers fit in a quarter of L2 is used.
+// For 2^28 random uint32_t with a 2 MB L2, 11 bits was about 5% faster than 8 bits
+// (close to the run to run noise) while 16 bits was 1.5 - 2x slower.
+
+static inline
+unsigned int radixTopDigitBitsOpt(size_t n) {
+  if (wideTopDigitMinN == 0 || blockPermuteBlockBytes == 0 || n < wideTopDigitMinN) {
+    return 8;
+  }
+
+  static const unsigned int topBits = []() -> unsigned int {
+    const size_t l2 = std::max<size_t>(hardwareInfo().l2CacheSize, 256 * 1024);
+    for (unsigned int bits : { 16, 12, 11 }) {
+      if ((blockPermuteBlockBytes << bits) <= (l2 / 4)) {
+        return bits;
+      }
+    }
+    return 8;
+  }();
+
+  return topBits;
+}
+
+// Partition arr[starti, endi) by digit D with block moves and then invoke recurse for each
+// bucket in order. The classification pass reads every value once, so when recurse also
+// accepts a counts pointer the digit D-1 histogram of each bucket is counted in the same
+// pass and handed to recurse, the child partition then skips its own histogram pass.
+// When Bits is wider than 8 the buckets are the top Bits bits of the key (D must be the
+// top digit) and the tables are allocated on the heap, see countingSortInPlaceOptWide().
+// Ranges of parallelHistogramMinN or more 8 bit digits are classified by multiple threads,
+// since this pass replaces the histogram pass that would otherwise be split.
+
+template <unsigned int D, unsigned int Bits, typename I, typename T, typename F>
+static inline
+void countingSortInPlaceOptBlockPartition(
+  T * arr,
+  I starti,
+  I endi,
+  F && recurse)
+{
+  constexpr unsigned int bucketMax = 1u << Bits;
+  constexpr I blockN = blockPermuteBlockBytes / sizeof(T);
   
-#if defined(DEBUG)
-  bitset256_t nonEmptyBucketsCopy;
-  bitset256CopyBits(nonEmptyBuckets, nonEmptyBucketsCopy);
-#endif
-  
-  auto isBucketEmpty = [](
-                          unsigned int bucketi,
-                          uint32_t * offsets,
-                          uint32_t * counts
-                          ) {
-    return offsets[bucketi] == counts[bucketi];
-  };
+  static_assert(blockN > 0 && (blockPermuteBlockBytes % sizeof(T)) == 0, "block must hold whole values");
+  static_assert(Bits == 8 || (Bits <= 16 && D == (sizeof(T) - 1)), "wide buckets are the top bits of the key");
   
-  auto dump = [
-               &arr,
-               &starti,
-               &endi
-               ]()
-  {
-    for ( unsigned int i = starti ; i < endi ; i++ ) {
-      if (arr[i] == 0xFFFFFFFF) {
-        std::cout << "-";
-      } else {
-        std::cout << arr[i];
-      }
-      if (i <= (endi - 1)) {
-        std::cout << " ";
-      }
+  auto bucketOf = [](T v) -> unsigned int {
+    if constexpr (Bits == 8) {
+      return extractDigitOpt<D>(v);
+    } else {
+      return (unsigned int) (radixKeyOpt(v) >> ((sizeof(T) * 8) - Bits));
     }
-    std::cout << std::endl;
   };
-
-  // Setup initial conditions and loop over all values in range
   
-  constexpr bool debugDumpIterations = false;
+  // D = 1 buckets are regenerated from their own counts, so only count for D > 1
   
-  constexpr bool debugDumpAllValuesOnIterations = false;
+  constexpr bool countChildren = fusedChildHistogram && (Bits == 8) && (D > 1) && std::is_invocable<F, T *, I, I, const I *>::value;
   
-  constexpr bool debugDumpBucketBounds = false;
+  // Each thread classifies one block aligned stripe of the range with its own buffers,
+  // as in IPS4o. Wide buckets and fused child counts stay on one thread, their tables
+  // are too large to allocate per thread.
   
-  constexpr bool debugDumpReloadedBucketN = false;
+  unsigned int numThreads = 1;
   
-  if (debugDumpAllValuesOnIterations) {
-    dump();
+  if constexpr (Bits == 8 && !countChildren) {
+    if (((size_t) (endi - starti)) >= parallelHistogramMinN && histogramOptThreadsEnabled()) {
+      numThreads = histogramOptNumThreads();
+    }
   }
   
-  // foreach bucket, iterate over the elements in the bucket. When elements are swapped into
-  // other buckets the iteration moves ahead so that processing need not wait for the result
-  // of each swap operation. As a result, one bucket can be iterated over and become empty or
-  // it may be defered and iterated over again after all buckets have been iterated over.
-
-#if defined(DEBUG)
-  unsigned int slotWrites = 0;
-#endif
+  std::vector<T> buffers(numThreads * bucketMax * blockN);
+  std::vector<I> bufferN(numThreads * bucketMax);
+  std::vector<I> blocksN(numThreads * bucketMax);
   
-  bitset256_t bucketsThisIteration;
-  bitset256CopyBits(nonEmptyBuckets, bucketsThisIteration);
+  std::vector<I> childCounts(countChildren ? (bucketMax * bucketMax) : 0);
   
-  size_t bucketsThisIterationNum = bitset256PopCount(bucketsThisIteration);
+  std::vector<I> stripeStart(numThreads + 1);
+  std::vector<I> stripeFilledEnd(numThreads);
   
-#if defined(DEBUG)
-  size_t totalNumberOfReloads = 0;
-#endif
+  for (unsigned int threadi = 0; threadi < numThreads; threadi++) {
+    const uint64_t numBlocks = (uint64_t) ((endi - starti) / blockN);
+    stripeStart[threadi] = starti + (I) (((numBlocks * threadi) / numThreads) * blockN);
+  }
+  stripeStart[numThreads] = endi;
   
-  // Reaload into bits by starting with the non-empty bits and keeping buckets that are not empty now
+  // Classify each value into the buffer for its bucket. A full buffer is written at
+  // filledEndi, which never passes readi since every value of the stripe before readi
+  // is either in a buffer or already written.
+  
+  auto classifyStripe = [&](unsigned int threadi) {
+    T * threadBuffers = &buffers[threadi * bucketMax * blockN];
+    I * threadBufferN = &bufferN[threadi * bucketMax];
+    I * threadBlocksN = &blocksN[threadi * bucketMax];
     
-  auto reloadBuckets = [&]() {
-    bitset256CopyBits(nonEmptyBuckets, bucketsThisIteration);
-    bucketsThisIterationNum = bitset256PopCount(bucketsThisIteration);
+    const I stripeEndi = stripeStart[threadi + 1];
+    I filledEndi = stripeStart[threadi];
+    
+    for (I readi = stripeStart[threadi]; readi < stripeEndi; readi++) {
+      T v = arr[readi];
+      unsigned int digit = bucketOf(v);
+      if constexpr (countChildren) {
+        childCounts[(digit * bucketMax) + extractDigitOpt<D-1>(v)] += 1;
+      }
+      T * buffer = &threadBuffers[digit * blockN];
+      buffer[threadBufferN[digit]++] = v;
+      if (threadBufferN[digit] == blockN) {
+        memcpy(&arr[filledEndi], buffer, sizeof(T) * blockN);
+        filledEndi += blockN;
+        threadBufferN[digit] = 0;
+        threadBlocksN[digit] += 1;
+      }
+    }
+    
+    stripeFilledEnd[threadi] = filledEndi;
+  };
+  
+  if (numThreads == 1) {
+    classifyStripe(0);
+  } else {
+    std::vector<std::thread> threads;
+    threads.reserve(numThreads - 1);
+    for (unsigned int threadi = 1; threadi < numThreads; threadi++) {
+      threads.emplace_back(classifyStripe, threadi);
+    }
+    classifyStripe(0);
+    for (auto & thread : threads) {
+      thread.join();
+    }
+  }
+  
+  I filledEndi = stripeFilledEnd[0];
+  
+  if (numThreads > 1) {
+    // Move the full blocks past the end of the filled region into the empty slots at
+    // the end of each stripe before it. A stripe has fewer than bucketMax empty slots,
+    // so this moves at most that many blocks per thread.
+    
+    filledEndi = starti;
+    for (unsigned int threadi = 0; threadi < numThreads; threadi++) {
+      filledEndi += stripeFilledEnd[threadi] - stripeStart[threadi];
+    }
+    
+    std::vector<I> emptySlots;
+    std::vector<I> fullSlots;
+    
+    for (unsigned int threadi = 0; threadi < numThreads; threadi++) {
+      for (I slot = stripeFilledEnd[threadi]; slot < std::min(stripeStart[threadi + 1], filledEndi); slot += blockN) {
+        emptySlots.push_back(slot);
+      }
+      for (I slot = std::max(stripeStart[threadi], filledEndi); slot < stripeFilledEnd[threadi]; slot += blockN) {
+        fullSlots.push_back(slot);
+      }
+    }
     
 #if defined(DEBUG)
-    totalNumberOfReloads += 1;
+    assert(emptySlots.size() == fullSlots.size());
 #endif
     
-    if (debugDumpReloadedBucketN) {
-      std::cout << "reload reset numNonEmptyBuckets " << bucketsThisIterationNum << std::endl;
+    for (size_t sloti = 0; sloti < emptySlots.size(); sloti++) {
+      memcpy(&arr[emptySlots[sloti]], &arr[fullSlots[sloti]], sizeof(T) * blockN);
     }
-
-    if (debugDumpReloadedBucketN) {
-      // Dump an histogram count for each bucket that is not empty
-      
+    
+    // Merge the buffers of the other threads into the thread 0 buffers, each buffer
+    // that fills is written as a block at filledEndi. There is room since every
+    // buffered value has a slot at or past filledEndi.
+    
+    for (unsigned int threadi = 1; threadi < numThreads; threadi++) {
       for (unsigned int bucketi = 0; bucketi < bucketMax; bucketi++) {
-        auto count = counts[bucketi] - offsets[bucketi];
+        const T * threadBuffer = &buffers[((threadi * bucketMax) + bucketi) * blockN];
+        I threadBufferN = bufferN[(threadi * bucketMax) + bucketi];
+        T * buffer = &buffers[bucketi * blockN];
         
-        if (count > 0) {
-          std::cout << "(reloaded) hist [" << bucketi << "] = " << count << std::endl;
+        blocksN[bucketi] += blocksN[(threadi * bucketMax) + bucketi];
+        
+        while (threadBufferN > 0) {
+          const I copyN = std::min<I>(threadBufferN, blockN - bufferN[bucketi]);
+          memcpy(&buffer[bufferN[bucketi]], threadBuffer, sizeof(T) * copyN);
+          bufferN[bucketi] += copyN;
+          threadBuffer += copyN;
+          threadBufferN -= copyN;
+          
+          if (bufferN[bucketi] == blockN) {
+            memcpy(&arr[filledEndi], buffer, sizeof(T) * blockN);
+            filledEndi += blockN;
+            bufferN[bucketi] = 0;
+            blocksN[bucketi] += 1;
+          }
         }
       }
     }
-    
-    return;
+  }
+  
+  // Bucket d owns the block slots that begin in [roundUp(bucketStart[d]), roundUp(bucketStart[d+1])),
+  // which is enough slots for all of its full blocks.
+  
+  auto roundUp = [starti](I offset) -> I {
+    return starti + (((offset - starti) + (blockN - 1)) / blockN) * blockN;
   };
-    
+  
+  std::vector<I> bucketStart(bucketMax + 1);
+  std::vector<I> blockWrite(bucketMax);
+  std::vector<I> blockRead(bucketMax);
+  
+  {
+    I psum = starti;
+    for (unsigned int bucketi = 0; bucketi < bucketMax; bucketi++) {
+      bucketStart[bucketi] = psum;
+      psum += (blocksN[bucketi] * blockN) + bufferN[bucketi];
+    }
+    bucketStart[bucketMax] = psum;
 #if defined(DEBUG)
-  size_t totalCountDown = endi - starti;
+    assert(psum == endi);
 #endif
+  }
   
-  while ( bucketsThisIterationNum != 0 ) {
-#if defined(DEBUG)
-    if (debugDumpBucketBounds) {
-      std::cout << "totalNumberOfReloads " << totalNumberOfReloads << std::endl;
-      std::cout << "bucketsThisIterationNum " << bucketsThisIterationNum << std::endl;
-      std::cout << "numLeft " << totalCountDown << std::endl;
+  // Buckets that still have unmoved block slots, a bucket that is filled while the
+  // blocks of another bucket are moved is cleared so that it is not visited
+  
+  bitsetWide_t pendingBuckets;
+  bitsetWideInit(pendingBuckets, bucketMax);
+  
+  for (unsigned int bucketi = 0; bucketi < bucketMax; bucketi++) {
+    blockWrite[bucketi] = roundUp(bucketStart[bucketi]);
+    blockRead[bucketi] = std::max(blockWrite[bucketi], std::min(roundUp(bucketStart[bucketi + 1]), filledEndi));
+    if (blockWrite[bucketi] < blockRead[bucketi]) {
+      bitsetWideSetBit(pendingBuckets, bucketi);
     }
-#endif
+  }
+  
+  // Slots in [blockWrite[d], blockRead[d]) hold blocks that have not been moved yet. A
+  // block is taken from the read end of a bucket and swapped into the first slot of its
+  // own bucket that does not already hold a block of that bucket. Once a bucket has no
+  // unmoved slots left, the slot at blockWrite is empty. A block that would extend past
+  // endi is held in overflow.
+  
+  alignas(64) T swapBuffer0[blockN];
+  alignas(64) T swapBuffer1[blockN];
+  alignas(64) T overflow[blockN];
+  
+  auto writeBlock = [&](I offset, const T * block) {
+    if ((offset + blockN) > endi) {
+      memcpy(overflow, block, sizeof(T) * blockN);
+    } else {
+      memcpy(&arr[offset], block, sizeof(T) * blockN);
+    }
+  };
+  
+  while (!bitsetWideIsAllOff(pendingBuckets)) {
+    const unsigned int bucketi = bitsetWideFindFirstSetOpt(pendingBuckets);
     
-    unsigned int currentBucketi = bitset256FindFirstSetOpt(bucketsThisIteration);
+    while (blockWrite[bucketi] < blockRead[bucketi]) {
+      T * block = swapBuffer0;
+      T * nextBlock = swapBuffer1;
+      
+      blockRead[bucketi] -= blockN;
+      memcpy(block, &arr[blockRead[bucketi]], sizeof(T) * blockN);
+      
+      while (true) {
+        unsigned int digit = bucketOf(block[0]);
+        
+        while (blockWrite[digit] < blockRead[digit] && bucketOf(arr[blockWrite[digit]]) == digit) {
+          blockWrite[digit] += blockN;
+        }
+        
+        if (blockWrite[digit] < blockRead[digit]) {
+          memcpy(nextBlock, &arr[blockWrite[digit]], sizeof(T) * blockN);
+          memcpy(&arr[blockWrite[digit]], block, sizeof(T) * blockN);
+          blockWrite[digit] += blockN;
+          std::swap(block, nextBlock);
+          
+          if (blockWrite[digit] >= blockRead[digit]) {
+            bitsetWideClearBit(pendingBuckets, digit);
+          }
+        } else {
+          writeBlock(blockWrite[digit], block);
+          blockWrite[digit] += blockN;
+          break;
+        }
+      }
+    }
     
-    unsigned int currentBucketOffset = offsets[currentBucketi];
-    unsigned int currentBucketEndOffset = counts[currentBucketi];
-    unsigned int currentBucketN = currentBucketEndOffset - currentBucketOffset;
+    bitsetWideClearBit(pendingBuckets, bucketi);
+  }
+  
+  // In bucket order, the part of the last block that extends past the end of a bucket
+  // is moved to the start of the bucket (the slot before the first block is owned by an
+  // earlier bucket) and the remaining gaps are filled from the buffer.
+  
+  for (unsigned int bucketi = 0; bucketi < bucketMax; bucketi++) {
+    const I bucketStarti = bucketStart[bucketi];
+    const I bucketEndi = bucketStart[bucketi + 1];
     
-    if (debugDumpBucketBounds) {
-      std::cout << "process bucket [" << currentBucketi << "] at offset " << currentBucketOffset << " has N = " << currentBucketN << std::endl;
+    if (bucketStarti == bucketEndi) {
+      continue;
     }
     
-    size_t bucketIterN = currentBucketN;
-        
-    constexpr size_t doubleMinSize = 64;
+    const T * buffer = &buffers[bucketi * blockN];
+    I headStarti = bucketStarti;
+    I headEndi = bucketEndi;
+    I tailStarti = bucketEndi;
     
-    while (bucketIterN >= doubleMinSize) {
-      // Split the range in half and then iterate downward over each half.
-      // This iteration is imperfect, but it is very fast. What appears to
-      // be going on here is that two cachelines are being predicted as the
-      // loop iterates from right to left over each half. Performance testing
-      // on Intel Core i5 (3GHz) showed that sizes below 64 did not help
-      // performance while sizes above 64 hurt performance.
-
-      size_t midOffset = currentBucketOffset + (bucketIterN/2) - 1;
-      size_t endOffset = currentBucketEndOffset - 1;
-      
-      if (debugDumpBucketBounds) {
-        std::cout << "bucket [" << currentBucketi << "] pairs range : ";
-        std::cout << "( " << currentBucketOffset << ", " << midOffset << " ) ";
-        std::cout << "( " << (midOffset+1) << ", " << endOffset << " ) ";
-        std::cout << " for N = " << bucketIterN << std::endl;
-      }
+    if (blocksN[bucketi] > 0) {
+      const I blocksStarti = roundUp(bucketStarti);
+      const I blocksEndi = blocksStarti + (blocksN[bucketi] * blockN);
       
-      size_t minMidOffset = currentBucketOffset + 1;
+      headEndi = blocksStarti;
       
-      // no loop unrolling seems to perform the best
-      #pragma nounroll
-      for ( ; minMidOffset < midOffset; --midOffset, --endOffset) {
-        if (debugDumpBucketBounds) {
-          std::cout << "midOffset: " << midOffset << std::endl;
-          std::cout << "endOffset: " << endOffset << std::endl;
-        }
-        
-        uint32_t midVal = arr[midOffset];
-        uint32_t endVal = arr[endOffset];
+      if (blocksEndi > bucketEndi) {
+        const I overflowN = blocksEndi - bucketEndi;
+        const I lastBlocki = blocksEndi - blockN;
         
-        uint32_t digit0 = extractDigitOpt<D>(midVal);
-        uint32_t digit1 = extractDigitOpt<D>(endVal);
+        if (blocksEndi > endi) {
+          memcpy(&arr[lastBlocki], overflow, sizeof(T) * (endi - lastBlocki));
+          memcpy(&arr[bucketStarti], &overflow[endi - lastBlocki], sizeof(T) * overflowN);
+        } else {
+          memcpy(&arr[bucketStarti], &arr[bucketEndi], sizeof(T) * overflowN);
+        }
         
+        headStarti += overflowN;
+      } else {
+        tailStarti = blocksEndi;
+      }
+    }
+    
 #if defined(DEBUG)
-        if (offsets[digit0] == counts[digit0]) { assert(0); }
-        if (offsets[digit1] == counts[digit1]) { assert(0); }
+    assert(((headEndi - headStarti) + (bucketEndi - tailStarti)) == bufferN[bucketi]);
 #endif
-        
-        uint32_t writei0 = offsets[digit0]++;
-        uint32_t writei1 = offsets[digit1]++;
-        
+    
+    memcpy(&arr[headStarti], buffer, sizeof(T) * (headEndi - headStarti));
+    buffer += (headEndi - headStarti);
+    memcpy(&arr[tailStarti], buffer, sizeof(T) * (bucketEndi - tailStarti));
+  }
+  
 #if defined(DEBUG)
-        assert(writei0 != writei1);
-
-        auto assertOffset = [&](uint32_t offset) -> void
-        {
-          // Must not read write to one of the iteration pointers (self swap)
-          if ((offset == midOffset) || (offset == endOffset)) {
-            assert(0);
-          }
-          assert(offset >= starti);
-          assert(offset < endi);
-        };
-        assertOffset(writei0);
-        assertOffset(writei1);
+  for (unsigned int bucketi = 0; bucketi < bucketMax; bucketi++) {
+    for (I i = bucketStart[bucketi]; i < bucketStart[bucketi + 1]; i++) {
+      assert(bucketOf(arr[i]) == bucketi);
+    }
+  }
 #endif
-        
-        // This logic looks a little odd since currentBucketOffset is
-        // being updated even when digit0 and digit1 are not the current
-        // bucket. The goal here is the keep the inner loop branchless
-        // as this results in the best performance.
-        
-        currentBucketOffset = offsets[currentBucketi];
-        minMidOffset = currentBucketOffset + 1;
-                
-        if (debugDumpIterations) {
-          std::cout << "reshuffle(2) [" << midOffset << "] <-> [" << writei0 << "] via swap( " << midVal << " <-> " << arr[writei0] << " ) into bucket " << digit0 << std::endl;
-          std::cout << "reshuffle(2) [" << endOffset << "] <-> [" << writei1 << "] via swap( " << endVal << " <-> " << arr[writei1] << " ) into bucket " << digit1 << std::endl;
-        }
+  
+  for (unsigned int bucketi = 0; bucketi < bucketMax; bucketi++) {
+    if (bucketStart[bucketi] < bucketStart[bucketi + 1]) {
+      if constexpr (countChildren) {
+        recurse(arr, bucketStart[bucketi], bucketStart[bucketi + 1], (const I *) &childCounts[bucketi * bucketMax]);
+      } else {
+        recurse(arr, bucketStart[bucketi], bucketStart[bucketi + 1]);
+      }
+    }
+  }
+}
 
-        // Gather read from ends of buckets. Note that this gather depends on
-        // the loop iteration to ensure there is never a self-swap as that would mean
-        // the read/write to writei0 would need to complete before the
-        // read/write to writei1.
-        
-        uint32_t gather0 = arr[writei0];
-        uint32_t gather1 = arr[writei1];
+// Partition arr[starti, endi) into buckets by digit D and invoke recurse(arr, bucketStart, bucketEnd)
+// as soon as each bucket is complete. The recurse callback decides how a bucket is sorted,
+// countingSortInPlaceOpt() recurses directly while the parallel sort can hand buckets to other threads.
+// When values is not a void pointer, values[i] is moved along with arr[i] on every swap.
+// I is the index type of the counts and offsets tables, see countingSortInPlaceOptLarge().
+// When knownCounts is not null it holds the digit D histogram of the range and the
+// histogram pass is skipped.
 
-        // Scatter write to ends of sorted buckets
-        
-        arr[writei0] = midVal;
-        arr[writei1] = endVal;
-        
-        arr[midOffset] = gather0;
-        arr[endOffset] = gather1;
+template <unsigned int D, typename I = unsigned int, typename T, typename V, typename F>
+static inline
+void countingSortInPlaceOptPartitionKV(
+  T * arr,
+  V * values,
+  std::type_identity_t<I> starti,
+  std::type_identity_t<I> endi,
+  F && recurse,
+  const std::type_identity_t<I> * knownCounts = nullptr)
+{
+  constexpr bool hasValues = !std::is_void<V>::value;
 
-#if defined(DEBUG)
-        slotWrites += 2;
-#endif
-      } // end loop countdown
-      
-      // Reset to end of sorted area in bucket
-      currentBucketOffset = offsets[currentBucketi];
-#if defined(DEBUG)
-      assert(currentBucketOffset < currentBucketEndOffset);
-#endif
-      bucketIterN = currentBucketEndOffset - currentBucketOffset;
+  constexpr bool debugOut = false;
+  constexpr bool debugDumpInOutValues = false;
+  constexpr bool debugDumpHistogram = false;
+  constexpr bool debugDumpPrefixSum = false;
+  I n = endi - starti;
+  
+  // The block partition classifies values in its own pass, so it is not used when
+  // the caller already paid for a histogram pass.
+  
+  if constexpr (!hasValues && blockPermuteBlockBytes > 0) {
+    if (knownCounts == nullptr && ((size_t) n * sizeof(T)) >= blockPermuteMinBytes) {
+      countingSortInPlaceOptBlockPartition<D, 8, I>(arr, starti, endi, recurse);
+      return;
     }
+  }
     
-    while ( bucketIterN != 0 ) {
-      if (debugDumpBucketBounds) {
-        std::cout << "bucket [" << currentBucketi << "] inner loop over N = " << bucketIterN << " slots " << std::endl;
-      }
+  // if (n < 2) {
+  //   std::cout << "countingSortInPlace early return from recursion " << starti << " up to " << endi << std::endl;
+  //   std::cout << "n " << n << std::endl;
+  //   return;
+  // }
+	
+  if (debugOut) {
+    std::cout << "countingSortInPlace D = " << D << " input:" << std::endl;
+    std::cout << "n " << n << std::endl;
+    std::cout << "starti " << starti << std::endl;
+    std::cout << "endi " << endi << std::endl;
 
-      size_t loopCountDown = bucketIterN;
-      
-      // Iterate over the values in the current bucket (max bucketCountDown number of loops)
-      
-      // In the self swap special case, offsets[currentBucketi] is incremented by one and
-      // currentBucketOffset would then match the offset.
-      
-      // In the write to other bucket case, offsets[currentBucketi] does not get incremented
-      // but currentBucketOffset does, so the next inner loop reads a value to swap from
-      // from the slot after the one in the previous loop (avoids data stall in next loop).
-      
-      // no loop unrolling seems to perform the best
-      #pragma nounroll
-      for ( ; loopCountDown != 0; --loopCountDown) {
-        if (debugDumpAllValuesOnIterations) {
-          dump();
-        }
-        
-#if defined(DEBUG)
-        assert(currentBucketOffset < currentBucketEndOffset);
-        assert(currentBucketOffset >= offsets[currentBucketi]);
-#endif
-        
-        unsigned int writeBucketi = extractDigitOpt<D>(arr[currentBucketOffset]);
+    if (debugDumpInOutValues) {
+      for (I i = starti; i < endi; i++) {
+        std::cout << (unsigned int) arr[i] << std::endl;
+      }
+    }
+    std::cout << "-------- " << std::endl;
+  }
     
-    #if defined(DEBUG)
-        assert(writeBucketi < bucketMax);
-        if (offsets[writeBucketi] == counts[writeBucketi]) { assert(0); }
-    #endif
-        
-        unsigned int writei = offsets[writeBucketi]++; // increment offsets[writeBucketi] either way
-    #if defined(DEBUG)
-        assert(writei >= starti);
-        assert(writei < endi);
-    #endif
-        
-    #if defined(DEBUG)
-        slotWrites += 1;
-    #endif
+  constexpr unsigned int bucketMax = 256;
 
-        if (debugDumpIterations) {
-          std::cout << "reshuffle(1) [" << currentBucketOffset << "] <-> [" << writei << "] via swap( " << arr[currentBucketOffset] << " <-> " << arr[writei] << " ) into bucket " << writeBucketi << std::endl;
-        }
+  // counts and offsets can both be used for bucket counts and then start/end offsets.
+  // Init both to zero to support multiple uses.
 
-        std::iter_swap(&arr[currentBucketOffset], &arr[writei]);
-        
-#if defined(DEBUG)
-        bool selfSwap = currentBucketOffset == writei;
-#endif
-        
-        ++currentBucketOffset;
-        
+  I counts[bucketMax] = {};
+  I offsets[bucketMax] = {};
+  
+  // Histogram counts
+  unsigned int histogramBucketi = bucketMax;
+  
+  if (knownCounts != nullptr) {
+    memcpy(counts, knownCounts, sizeof(counts));
+    histogramBucketi = extractDigitOpt<D>(arr[endi - 1]);
 #if defined(DEBUG)
-        if (selfSwap) {
-          assert(currentBucketOffset == offsets[currentBucketi]);
-        } else {
-          assert(currentBucketOffset > offsets[currentBucketi]);
-        }
+    I checkCounts[bucketMax] = {};
+    for (I i = starti; i < endi; i++) {
+      checkCounts[extractDigitOpt<D>(arr[i])] += 1;
+    }
+    assert(memcmp(counts, checkCounts, sizeof(counts)) == 0);
 #endif
-      } // while ( loopCountDown != 0 )
-
-#if defined(DEBUG)
-      if (bucketIterN > 0) {
-        assert(totalCountDown > 0);
+  } else if constexpr (sizeof(I) > sizeof(uint32_t)) {
+    histogramLargeOpt<D>(arr, starti, endi, histogramBucketi, counts);
+  } else if constexpr (sizeof(I) < sizeof(uint32_t)) {
+    // The histogram kernels count into 32 bit tables
+    uint32_t wideCounts[bucketMax] = {};
+    histogramOpt<D, bucketMax>(arr, starti, endi, histogramBucketi, wideCounts);
+    for (unsigned int bucketi = 0; bucketi < bucketMax; bucketi++) {
+      counts[bucketi] = (I) wideCounts[bucketi];
+    }
+  } else {
+    histogramOpt<D, bucketMax>(arr, starti, endi, histogramBucketi, counts);
+  }
+  
+  if (debugDumpHistogram) {
+    std::cout << "countingSortInPlace D = " << D << " counts:" << std::endl;
+    
+    for (unsigned int bucketi = 0; bucketi < bucketMax; bucketi++) {
+      auto count = counts[bucketi];
+      if (count != 0) {
+        std::cout << "[" << bucketi << "] = " << count << std::endl;
+      }
+    }
+    std::cout << "-------- " << std::endl;
+  }
+  
+  // Special case where all values map to the same bucket.
+  // The count logic needs to be done, but prefix sum and
+  // looping over all the values to calculate buckets will
+  // result in no reordering.
+  
+  if (histogramBucketi != bucketMax) {
+    auto count = counts[histogramBucketi];
+    if (count == n) {
+      // Special case where all values scan into a single bucket.
+      if (debugOut) {
+        std::cout << "all " << n << " values in same bucket " << histogramBucketi << std::endl;
       }
-      assert(totalCountDown >= bucketIterN);
-      totalCountDown -= bucketIterN; // consumed bucketCountdown slots in inner loop
-#endif
       
-      // After the inner loop, the bucket iteration has advanced currentBucketOffset
-      // to the end of the bucket. Start the bucket iteration over again since this
-      // bucket can continue to be processed.
+      recurse(arr, starti, endi);
       
+      return;
+    }
+  }
+  
 #if defined(DEBUG)
-        assert(currentBucketOffset <= currentBucketEndOffset);
+  // Double check bucket start/end offsets as as they become empty (before recursion)
+  I checkBucketStart[bucketMax] = {};
+  I checkBucketEnd[bucketMax] = {};
+  bool checkBucketRecursion[bucketMax] = {};
 #endif
-      
-      currentBucketOffset = offsets[currentBucketi];
-      bucketIterN = currentBucketEndOffset - currentBucketOffset;
-      
-      if (debugDumpBucketBounds) {
-        std::cout << "bucket [" << currentBucketi << "] inner loop over N = " << bucketIterN << " slots done" << std::endl;
-        std::cout << "";
-      }
-      
-      switch (bucketIterN) {
-        case 0: {
-          // nop
-          break;
-        }
-        case 1: {
-          // The bucket contains a single item, so it is no longer possible
-          // to invoke the inner loop.
-          
-          if (debugDumpBucketBounds) {
-            std::cout << "bucket [" << currentBucketi << "] clear current iter bucket bit to move forward to next bucket" << std::endl;
-          }
-
-          bitset256ClearBit(bucketsThisIteration, currentBucketi);
-          --bucketsThisIterationNum;
-          bucketIterN = 0;
-          
-          break;
+  
+  // Prefix Sum (given starting offset), note that after this loop is completed the
+  // counts field is converted to an end of bucket offset.
+  
+  I psum = starti;
+  for (unsigned int bucketi = 0; bucketi < bucketMax; bucketi++) {
+    auto count = counts[bucketi];
+    offsets[bucketi] = psum;
+    psum += count;
+    
+#if defined(DEBUG)
+    checkBucketStart[bucketi] = offsets[bucketi];
+    checkBucketEnd[bucketi] = offsets[bucketi] + counts[bucketi];
+#endif
+    
+    counts[bucketi] = psum;
+  }
+  
+  if (debugDumpPrefixSum) {
+    std::cout << "countingSortInPlace D = " << D << " prefix sum:" << std::endl;
+    
+    for (unsigned int bucketi = 0; bucketi < bucketMax; bucketi++) {
+      auto count = counts[bucketi] - offsets[bucketi];
+      auto offset = offsets[bucketi];
+      if (count != 0) {
+        std::cout << "[" << bucketi << "] = " << offset << std::endl;
+      }
+    }
+    std::cout << "-------- " << std::endl;
+  }
+  
+  // This nonEmptyBuckets bitset contains a flag for each bucket that starts out as
+  // non-empty. When a bucket is discovered to be fully processed, the bit is cleared.
+
+  bitset256_t nonEmptyBuckets;
+  bitset256Clear(nonEmptyBuckets);
+  
+  for (unsigned int bucketi = 0; bucketi < bucketMax; bucketi++) {
+    auto count = counts[bucketi] - offsets[bucketi];
+    if (count > 0) {
+      bitset256SetBit(nonEmptyBuckets, bucketi);
+    }
+  }
+  
+  if (debugDumpPrefixSum) {
+    std::cout << "countingSortInPlace D = " << D << " non-empty buckets:" << std::endl;
+
+    bitset256_t copy;
+    bitset256CopyBits(nonEmptyBuckets, copy);
+    
+    for ( ; !bitset256IsAllOff(copy) ; ) {
+      auto bucketi = bitset256FindFirstSetOpt(copy);
+      bitset256ClearBit(copy, bucketi);
+      
+      std::cout << "[" << bucketi << "] = " << " true" << std::endl;
+    }
+    
+    std::cout << "-------- " << std::endl;
+  }
+  
+#if defined(DEBUG)
+  bitset256_t nonEmptyBucketsCopy;
+  bitset256CopyBits(nonEmptyBuckets, nonEmptyBucketsCopy);
+#endif
+  
+  auto isBucketEmpty = [](
+                          unsigned int bucketi,
+                          I * offsets,
+                          I * counts
+                          ) {
+    return offsets[bucketi] == counts[bucketi];
+  };
+  
+  auto dump = [
+               &arr,
+               &starti,
+               &endi
+               ]()
+  {
+    for ( I i = starti ; i < endi ; i++ ) {
+      if (radixKeyOpt(arr[i]) == 0xFFFFFFFF) {
+        std::cout << "-";
+      } else {
+        std::cout << arr[i];
+      }
+      if (i <= (endi - 1)) {
+        std::cout << " ";
+      }
+    }
+    std::cout << std::endl;
+  };
+
+  // Setup initial conditions and loop over all values in range
+  
+  const bool prefetchAhead = hasValues && (permutePrefetchDistance > 0) && ((size_t) n * sizeof(T)) >= permutePrefetchMinBytes;
+  
+  // Buckets with at least this many values are iterated as two halves. 64 values was tuned
+  // on an Intel Core i5, that is four 64 byte cache lines of 32 bit values.
+  
+  const size_t doubleMinSize = (4 * cache_line_size()) / sizeof(T);
+  
+  constexpr bool debugDumpIterations = false;
+  
+  constexpr bool debugDumpAllValuesOnIterations = false;
+  
+  constexpr bool debugDumpBucketBounds = false;
+  
+  constexpr bool debugDumpReloadedBucketN = false;
+  
+  if (debugDumpAllValuesOnIterations) {
+    dump();
+  }
+  
+  // foreach bucket, iterate over the elements in the bucket. When elements are swapped into
+  // other buckets the iteration moves ahead so that processing need not wait for the result
+  // of each swap operation. As a result, one bucket can be iterated over and become empty or
+  // it may be defered and iterated over again after all buckets have been iterated over.
+
+#if defined(DEBUG)
+  I slotWrites = 0;
+#endif
+  
+  bitset256_t bucketsThisIteration;
+  bitset256CopyBits(nonEmptyBuckets, bucketsThisIteration);
+  
+  size_t bucketsThisIterationNum = bitset256PopCount(bucketsThisIteration);
+  
+#if defined(DEBUG)
+  size_t totalNumberOfReloads = 0;
+#endif
+  
+  // Reaload into bits by starting with the non-empty bits and keeping buckets that are not empty now
+    
+  auto reloadBuckets = [&]() {
+    bitset256CopyBits(nonEmptyBuckets, bucketsThisIteration);
+    bucketsThisIterationNum = bitset256PopCount(bucketsThisIteration);
+    
+#if defined(DEBUG)
+    totalNumberOfReloads += 1;
+#endif
+    
+    if (debugDumpReloadedBucketN) {
+      std::cout << "reload reset numNonEmptyBuckets " << bucketsThisIterationNum << std::endl;
+    }
+
+    if (debugDumpReloadedBucketN) {
+      // Dump an histogram count for each bucket that is not empty
+      
+      for (unsigned int bucketi = 0; bucketi < bucketMax; bucketi++) {
+        auto count = counts[bucketi] - offsets[bucketi];
+        
+        if (count > 0) {
+          std::cout << "(reloaded) hist [" << bucketi << "] = " << count << std::endl;
         }
-        default: {
-          // N > 1
-          
-          if (debugDumpBucketBounds) {
-            std::cout << "bucket [" << currentBucketi << "] keep going" << std::endl;
-            std::cout << "";
+      }
+    }
+    
+    return;
+  };
+    
+#if defined(DEBUG)
+  size_t totalCountDown = endi - starti;
+#endif
+  
+  while ( bucketsThisIterationNum != 0 ) {
+#if defined(DEBUG)
+    if (debugDumpBucketBounds) {
+      std::cout << "totalNumberOfReloads " << totalNumberOfReloads << std::endl;
+      std::cout << "bucketsThisIterationNum " << bucketsThisIterationNum << std::endl;
+      std::cout << "numLeft " << totalCountDown << std::endl;
+    }
+#endif
+    
+    unsigned int currentBucketi = bitset256FindFirstSetOpt(bucketsThisIteration);
+    
+    I currentBucketOffset = offsets[currentBucketi];
+    I currentBucketEndOffset = counts[currentBucketi];
+    I currentBucketN = currentBucketEndOffset - currentBucketOffset;
+    
+    if (debugDumpBucketBounds) {
+      std::cout << "process bucket [" << currentBucketi << "] at offset " << currentBucketOffset << " has N = " << currentBucketN << std::endl;
+    }
+    
+    size_t bucketIterN = currentBucketN;
+        
+    while (bucketIterN >= doubleMinSize) {
+      // Split the range in half and then iterate downward over each half.
+      // This iteration is imperfect, but it is very fast. What appears to
+      // be going on here is that two cachelines are being predicted as the
+      // loop iterates from right to left over each half. Performance testing
+      // on Intel Core i5 (3GHz) showed that sizes below 64 did not help
+      // performance while sizes above 64 hurt performance.
+
+      size_t midOffset = currentBucketOffset + (bucketIterN/2) - 1;
+      size_t endOffset = currentBucketEndOffset - 1;
+      
+      if (debugDumpBucketBounds) {
+        std::cout << "bucket [" << currentBucketi << "] pairs range : ";
+        std::cout << "( " << currentBucketOffset << ", " << midOffset << " ) ";
+        std::cout << "( " << (midOffset+1) << ", " << endOffset << " ) ";
+        std::cout << " for N = " << bucketIterN << std::endl;
+      }
+      
+      size_t minMidOffset = currentBucketOffset + 1;
+      
+      // no loop unrolling seems to perform the best
+      #pragma nounroll
+      for ( ; minMidOffset < midOffset; --midOffset, --endOffset) {
+        if (debugDumpBucketBounds) {
+          std::cout << "midOffset: " << midOffset << std::endl;
+          std::cout << "endOffset: " << endOffset << std::endl;
+        }
+        
+        if constexpr (hasValues && permutePrefetchDistance > 0) {
+          if (prefetchAhead && midOffset >= (minMidOffset + permutePrefetchDistance)) {
+            unsigned int aheadDigit0 = extractDigitOpt<D>(arr[midOffset - permutePrefetchDistance]);
+            unsigned int aheadDigit1 = extractDigitOpt<D>(arr[endOffset - permutePrefetchDistance]);
+            __builtin_prefetch(&arr[offsets[aheadDigit0]], 1);
+            __builtin_prefetch(&arr[offsets[aheadDigit1]], 1);
           }
+        }
+        
+        T midVal = arr[midOffset];
+        T endVal = arr[endOffset];
+        
+        uint32_t digit0 = extractDigitOpt<D>(midVal);
+        uint32_t digit1 = extractDigitOpt<D>(endVal);
+        
+#if defined(DEBUG)
+        if (offsets[digit0] == counts[digit0]) { assert(0); }
+        if (offsets[digit1] == counts[digit1]) { assert(0); }
+#endif
+        
+        I writei0 = offsets[digit0]++;
+        I writei1 = offsets[digit1]++;
+        
+#if defined(DEBUG)
+        assert(writei0 != writei1);
 
-          break;
+        auto assertOffset = [&](I offset) -> void
+        {
+          // Must not read write to one of the iteration pointers (self swap)
+          if ((offset == midOffset) || (offset == endOffset)) {
+            assert(0);
+          }
+          assert(offset >= starti);
+          assert(offset < endi);
+        };
+        assertOffset(writei0);
+        assertOffset(writei1);
+#endif
+        
+        // This logic looks a little odd since currentBucketOffset is
+        // being updated even when digit0 and digit1 are not the current
+        // bucket. The goal here is the keep the inner loop branchless
+        // as this results in the best performance.
+        
+        currentBucketOffset = offsets[currentBucketi];
+        minMidOffset = currentBucketOffset + 1;
+                
+        if (debugDumpIterations) {
+          std::cout << "reshuffle(2) [" << midOffset << "] <-> [" << writei0 << "] via swap( " << midVal << " <-> " << arr[writei0] << " ) into bucket " << digit0 << std::endl;
+          std::cout << "reshuffle(2) [" << endOffset << "] <-> [" << writei1 << "] via swap( " << endVal << " <-> " << arr[writei1] << " ) into bucket " << digit1 << std::endl;
         }
+
+        // Gather read from ends of buckets. Note that this gather depends on
+        // the loop iteration to ensure there is never a self-swap as that would mean
+        // the read/write to writei0 would need to complete before the
+        // read/write to writei1.
+        
+        T gather0 = arr[writei0];
+        T gather1 = arr[writei1];
+
+        // Scatter write to ends of sorted buckets
+        
+        arr[writei0] = midVal;
+        arr[writei1] = endVal;
+        
+        arr[midOffset] = gather0;
+        arr[endOffset] = gather1;
+        
+        if constexpr (hasValues) {
+          V midValue = values[midOffset];
+          V endValue = values[endOffset];
+          
+          V gatherValue0 = values[writei0];
+          V gatherValue1 = values[writei1];
+          
+          values[writei0] = midValue;
+          values[writei1] = endValue;
+          
+          values[midOffset] = gatherValue0;
+          values[endOffset] = gatherValue1;
+        }
+
+#if defined(DEBUG)
+        slotWrites += 2;
+#endif
+      } // end loop countdown
+      
+      // Reset to end of sorted area in bucket
+      currentBucketOffset = offsets[currentBucketi];
+#if defined(DEBUG)
+      assert(currentBucketOffset < currentBucketEndOffset);
+#endif
+      bucketIterN = currentBucketEndOffset - currentBucketOffset;
+    }
+    
+    while ( bucketIterN != 0 ) {
+      if (debugDumpBucketBounds) {
+        std::cout << "bucket [" << currentBucketi << "] inner loop over N = " << bucketIterN << " slots " << std::endl;
+      }
+
+      size_t loopCountDown = bucketIterN;
+      
+      // Iterate over the values in the current bucket (max bucketCountDown number of loops)
+      
+      // In the self swap special case, offsets[currentBucketi] is incremented by one and
+      // currentBucketOffset would then match the offset.
+      
+      // In the write to other bucket case, offsets[currentBucketi] does not get incremented
+      // but currentBucketOffset does, so the next inner loop reads a value to swap from
+      // from the slot after the one in the previous loop (avoids data stall in next loop).
+      
+      // no loop unrolling seems to perform the best
+      #pragma nounroll
+      for ( ; loopCountDown != 0; --loopCountDown) {
+        if (debugDumpAllValuesOnIterations) {
+          dump();
+        }
+        
+#if defined(DEBUG)
+        assert(currentBucketOffset < currentBucketEndOffset);
+        assert(currentBucketOffset >= offsets[currentBucketi]);
+#endif
+        
+        if constexpr (hasValues && permutePrefetchDistance > 0) {
+          if (prefetchAhead && (currentBucketOffset + permutePrefetchDistance) < currentBucketEndOffset) {
+            unsigned int aheadDigit = extractDigitOpt<D>(arr[currentBucketOffset + permutePrefetchDistance]);
+            __builtin_prefetch(&arr[offsets[aheadDigit]], 1);
+          }
+        }
+        
+        unsigned int writeBucketi = extractDigitOpt<D>(arr[currentBucketOffset]);
+    
+    #if defined(DEBUG)
+        assert(writeBucketi < bucketMax);
+        if (offsets[writeBucketi] == counts[writeBucketi]) { assert(0); }
+    #endif
+        
+        I writei = offsets[writeBucketi]++; // increment offsets[writeBucketi] either way
+    #if defined(DEBUG)
+        assert(writei >= starti);
+        assert(writei < endi);
+    #endif
+        
+    #if defined(DEBUG)
+        slotWrites += 1;
+    #endif
+
+        if (debugDumpIterations) {
+          std::cout << "reshuffle(1) [" << currentBucketOffset << "] <-> [" << writei << "] via swap( " << arr[currentBucketOffset] << " <-> " << arr[writei] << " ) into bucket " << writeBucketi << std::endl;
+        }
+
+        std::iter_swap(&arr[currentBucketOffset], &arr[writei]);
+        
+        if constexpr (hasValues) {
+          std::iter_swap(&values[currentBucketOffset], &values[writei]);
+        }
+        
+#if defined(DEBUG)
+        bool selfSwap = currentBucketOffset == writei;
+#endif
+        
+        ++currentBucketOffset;
+        
+#if defined(DEBUG)
+        if (selfSwap) {
+          assert(currentBucketOffset == offsets[currentBucketi]);
+        } else {
+          assert(currentBucketOffset > offsets[currentBucketi]);
+        }
+#endif
+      } // while ( loopCountDown != 0 )
+
+#if defined(DEBUG)
+      if (bucketIterN > 0) {
+        assert(totalCountDown > 0);
+      }
+      assert(totalCountDown >= bucketIterN);
+      totalCountDown -= bucketIterN; // consumed bucketCountdown slots in inner loop
+#endif
+      
+      // After the inner loop, the bucket iteration has advanced currentBucketOffset
+      // to the end of the bucket. Start the bucket iteration over again since this
+      // bucket can continue to be processed.
+      
+#if defined(DEBUG)
+        assert(currentBucketOffset <= currentBucketEndOffset);
+#endif
+      
+      currentBucketOffset = offsets[currentBucketi];
+      bucketIterN = currentBucketEndOffset - currentBucketOffset;
+      
+      if (debugDumpBucketBounds) {
+        std::cout << "bucket [" << currentBucketi << "] inner loop over N = " << bucketIterN << " slots done" << std::endl;
+        std::cout << "";
+      }
+      
+      switch (bucketIterN) {
+        case 0: {
+          // nop
+          break;
+        }
+        case 1: {
+          // The bucket contains a single item, so it is no longer possible
+          // to invoke the inner loop.
+          
+          if (debugDumpBucketBounds) {
+            std::cout << "bucket [" << currentBucketi << "] clear current iter bucket bit to move forward to next bucket" << std::endl;
+          }
+
+          bitset256ClearBit(bucketsThisIteration, currentBucketi);
+          --bucketsThisIterationNum;
+          bucketIterN = 0;
+          
+          break;
+        }
+        default: {
+          // N > 1
+          
+          if (debugDumpBucketBounds) {
+            std::cout << "bucket [" << currentBucketi << "] keep going" << std::endl;
+            std::cout << "";
+          }
+
+          break;
+        }
+      }
+       
+    } // end while (bucketIterN != 0)
+    
+    // After a bucket iteration, the bucket may be empty. Once a bucket is empty, it will be recursed into
+    // and it will be ignored in future iterations. Note the case where a bucket is ignored in one iteration
+    // and then it becomes empty due to a different bucket writing into it, that bucket will still be processed here.
+    
+    if (isBucketEmpty(currentBucketi, offsets, counts)) {
+      // All bucket slots consumed by inner loop, remove bucket from bucketsThisIteration and nonEmptyBuckets
+      
+      if (debugDumpBucketBounds) {
+        std::cout << "bucket [" << currentBucketi << "] bit cleared" << std::endl;
+      }
+      
+      bitset256ClearBit(bucketsThisIteration, currentBucketi);
+      --bucketsThisIterationNum;
+      
+      {
+        I currentBucketStartOffset = ((currentBucketi == 0) ? starti : counts[currentBucketi - 1]);
+        I currentBucketEndOffset = counts[currentBucketi];
+        
+#if defined(DEBUG)
+        {
+          auto expectedStart = checkBucketStart[currentBucketi];
+          auto expectedEnd = checkBucketEnd[currentBucketi];
+          
+          assert(currentBucketStartOffset == expectedStart);
+          assert(currentBucketEndOffset == expectedEnd);
+        }
+#endif
+        // Once bucket recursion has been executed, clear bit in nonEmptyBuckets
+        
+#if defined(DEBUG)
+        {
+          // This isBucketEmpty() check is the only place where a nonEmptyBuckets
+          // bit can be flipped off and this can only happen once for a bucket.
+          auto inNonEmpty = bitset256GetBit(nonEmptyBuckets, currentBucketi);
+          assert(inNonEmpty == true);
+        }
+#endif
+        
+        if (1) {
+          if (debugDumpBucketBounds) {
+            std::cout << "recurse into bucket " << currentBucketi << std::endl;
+          }
+          
+#if defined(DEBUG)
+          auto recursedAlready = checkBucketRecursion[currentBucketi];
+          assert(recursedAlready == false);
+          checkBucketRecursion[currentBucketi] = true;
+#endif
+          
+          bitset256ClearBit(nonEmptyBuckets, currentBucketi);
+          
+          recurse(arr, currentBucketStartOffset, currentBucketEndOffset);
+        }
+      }
+    } // end isBucketEmpty()
+    
+    if (bucketsThisIterationNum == 0) {
+      if (debugDumpBucketBounds) {
+        std::cout << "buckets reloaded since bucketsThisIterationNum is zero" << std::endl;
+      }
+
+      reloadBuckets();
+    }
+
+  } // end while ( numNonEmptyBuckets != 0 )
+  
+#if defined(DEBUG)
+    if (debugDumpBucketBounds) {
+      std::cout << "all buckets now empty totalNumberOfReloads " << totalNumberOfReloads << std::endl;
+    }
+#endif
+
+  // All buckets must be empty at this point
+  
+#if defined(DEBUG)
+  {
+    for (unsigned int bucketi = 0; bucketi < bucketMax; bucketi++) {
+      auto count = counts[bucketi] - offsets[bucketi];
+      assert (count == 0);
+      
+      auto wasNonEmpty = bitset256GetBit(nonEmptyBucketsCopy, bucketi);
+      
+      if (wasNonEmpty) {
+        auto recursedAlready = checkBucketRecursion[bucketi];
+        assert(recursedAlready == true);
+        
+        auto bitSet = bitset256GetBit(nonEmptyBuckets, bucketi);
+        assert(bitSet == false);
+      }
+    }
+  }
+#endif
+  
+  if (debugOut) {
+    std::cout << "countingSortInPlace D = " << D << " returns:" << std::endl;
+    std::cout << "n " << n << std::endl;
+    std::cout << "starti " << starti << std::endl;
+    std::cout << "endi " << endi << std::endl;
+    
+    if (debugDumpInOutValues) {
+      for (I i = starti; i < endi; i++) {
+        std::cout << (unsigned int) arr[i] << std::endl;
+      }
+    }
+    
+    std::cout << "-------- " << std::endl;
+  }
+  
+#if defined(DEBUG)
+  // A bug would cause these two to not match
+  assert(n == slotWrites);
+#endif
+}
+
+template <unsigned int D, typename I = unsigned int, typename T, typename F>
+static inline
+void countingSortInPlaceOptPartition(
+  T * arr,
+  std::type_identity_t<I> starti,
+  std::type_identity_t<I> endi,
+  F && recurse,
+  const std::type_identity_t<I> * knownCounts = nullptr)
+{
+  countingSortInPlaceOptPartitionKV<D, I>(arr, (void *) nullptr, starti, endi, recurse, knownCounts);
+}
+
+// Start the sort at a runtime digit, D is the largest digit to consider.
+
+template <unsigned int D, typename T>
+static inline
+void countingSortInPlaceOptFromDigit(
+  T * arr,
+  unsigned int starti,
+  unsigned int endi,
+  unsigned int digit)
+{
+  if constexpr (D > 0) {
+    if (digit < D) {
+      countingSortInPlaceOptFromDigit<D-1>(arr, starti, endi, digit);
+      return;
+    }
+  }
+  
+  countingSortInPlaceOpt<D>(arr, starti, endi, true);
+}
+
+// Subranges of at most this many values are partitioned with 16 bit counts and offsets
+// (rebased so that the subrange starts at offset 0), which halves the size of the
+// tables that are read and written for every value in the permutation loop. Define
+// COMPACT_TABLE_MAX_N as 65535 to enable, off by default since the 2 KB tables already
+// fit in L1 and the 16 bit updates measured slightly slower on an x86-64 machine.
+
+#if defined(COMPACT_TABLE_MAX_N)
+constexpr unsigned int compactTableMaxN = COMPACT_TABLE_MAX_N;
+#else
+constexpr unsigned int compactTableMaxN = 0;
+#endif // COMPACT_TABLE_MAX_N
+
+static_assert(compactTableMaxN <= 0xFFFF, "compact tables hold 16 bit offsets");
+
+// D is digit 3,2,1,0 for 32 bit inputs or 7 down to 0 for 64 bit inputs. This hybrid of American
+// Flag sort and SkaSort significantly outperforms both earlier implementations. Keys can be unsigned,
+// signed or floating point, see radixKeyOpt() for the order of float NaN and -0.0 values.
+// A direct call with D below the top digit sorts by digits D down to 0 and checks whether
+// the digits above D vary, the recursion passes upperDigitsEqual = true to skip the check.
+
+template <unsigned int D, typename T>
+__attribute__((noinline))
+void countingSortInPlaceOpt(
+  T * arr,
+  unsigned int starti,
+  unsigned int endi,
+  bool upperDigitsEqual)
+{
+  if constexpr (D == (sizeof(T) - 1)) {
+    // Top level call, skip the leading digits that are the same in all values
+    // so that no histogram pass is wasted on a single bucket.
+    
+    if ((endi - starti) < 2) {
+      return;
+    }
+    
+    auto diffBits = radixDiffBitsOpt(arr, starti, endi);
+    
+    if (diffBits == 0) {
+      // All values are the same
+      return;
+    }
+    
+    unsigned int firstDigit = radixFirstVaryingDigitOpt(diffBits);
+    
+    // Small value domains are regenerated from counts instead of permuted, a 16 bit
+    // domain is only worth the 65536 entry table once there are as many values.
+    
+    if (firstDigit == 0) {
+      countingSortRegenerateOpt<8>(arr, starti, endi);
+      return;
+    } else if (firstDigit == 1 && (endi - starti) >= regenerate16MinN) {
+      countingSortRegenerateOpt<16>(arr, starti, endi);
+      return;
+    }
+    
+    if (firstDigit < D) {
+      countingSortInPlaceOptFromDigit<D-1>(arr, starti, endi, firstDigit);
+      return;
+    }
+    
+    if constexpr (blockPermuteBlockBytes > 0) {
+      const unsigned int topBits = radixTopDigitBitsOpt(endi - starti);
+      
+      if (topBits > 8) {
+        countingSortInPlaceOptWide(arr, starti, endi, topBits);
+        return;
+      }
+    }
+    
+    const unsigned int n = endi - starti;
+    if (n > smallBucketMaxN() && n <= midBucketMaxN() && countingSortMidOpt<D>(arr, starti, endi, diffBits)) {
+      // Cache resident range, LSD sorted through scratch with the diffBits from above
+      return;
+    }
+  } else if constexpr (D == 0) {
+    // Direct call for the last digit, regenerate when the digits above are all
+    // the same. Otherwise this only partitions by the last digit.
+    
+    if ((endi - starti) >= 2 && (radixDiffBitsOpt(arr, starti, endi) >> 8) == 0) {
+      countingSortRegenerateOpt<8>(arr, starti, endi);
+      return;
+    }
+  } else {
+    // Direct call below the top digit. When the digits above D vary, the digit 1 buckets
+    // can not be regenerated from counts, so each bucket is sorted with another direct
+    // call that checks again, down to the D = 0 check above.
+    
+    if (!upperDigitsEqual && (endi - starti) >= 2 && (radixDiffBitsOpt(arr, starti, endi) >> (8 * (D + 1))) != 0) {
+      auto recurseDirect = [](
+                              T *arr,
+                              unsigned int starti,
+                              unsigned int endi
+                              )
+      {
+        if ((endi - starti) >= 2) {
+          countingSortInPlaceOpt<D-1>(arr, starti, endi);
+        }
+      };
+      
+      countingSortInPlaceOptPartition<D>(arr, starti, endi, recurseDirect);
+      return;
+    }
+  }
+  
+  if constexpr (D > 0 && D != (sizeof(T) - 1)) {
+    const unsigned int n = endi - starti;
+    if (n > smallBucketMaxN() && n <= midBucketMaxN() && countingSortMidOpt<D>(arr, starti, endi)) {
+      // Cache resident range, LSD sorted the remaining digits through scratch
+      return;
+    }
+  }
+  
+  auto recurse = [](
+                    T *arr,
+                    unsigned int starti,
+                    unsigned int endi,
+                    const unsigned int * childCounts = nullptr
+                    )
+  {
+    recurseBucketOpt<D>(arr, starti, endi, childCounts);
+  };
+  
+  if constexpr (std::is_integral<T>::value && std::is_signed<T>::value && D == (sizeof(T) - 1)) {
+    // The sign flip only changes the top digit, so the buckets of a signed integer
+    // range are sorted as the unsigned type of the same size (which may alias T) and
+    // the flip is not applied to the lower digits. Float buckets are sorted as T, the
+    // lower digits of a negative float are inverted by radixKeyOpt() so that the
+    // bucket comes out in ascending order without a reverse pass.
+    
+    auto recurseUnsigned = [](
+                              T *arr,
+                              unsigned int starti,
+                              unsigned int endi
+                              )
+    {
+      typedef std::make_unsigned_t<T> U;
+      
+      recurseBucketOpt<D>((U *) arr, starti, endi);
+    };
+    
+    if ((endi - starti) <= compactTableMaxN) {
+      countingSortInPlaceOptPartition<D, uint16_t>(arr + starti, 0, endi - starti, recurseUnsigned);
+    } else {
+      countingSortInPlaceOptPartition<D>(arr, starti, endi, recurseUnsigned);
+    }
+  } else {
+    if ((endi - starti) <= compactTableMaxN) {
+      countingSortInPlaceOptPartition<D, uint16_t>(arr + starti, 0, endi - starti, recurse);
+    } else {
+      countingSortInPlaceOptPartition<D>(arr, starti, endi, recurse);
+    }
+  }
+}
+
+// Same as countingSortInPlaceOpt() below the top digit, counts is the digit D histogram of
+// arr[starti, endi) that was counted by the parent partition.
+
+template <unsigned int D, typename T>
+__attribute__((noinline))
+void countingSortInPlaceOptKnownCounts(
+  T * arr,
+  unsigned int starti,
+  unsigned int endi,
+  const unsigned int * counts)
+{
+  auto recurse = [](
+                    T *arr,
+                    unsigned int starti,
+                    unsigned int endi,
+                    const unsigned int * childCounts = nullptr
+                    )
+  {
+    recurseBucketOpt<D>(arr, starti, endi, childCounts);
+  };
+  
+  countingSortInPlaceOptPartition<D>(arr, starti, endi, recurse, counts);
+}
+
+// Work item for countingSortInPlaceOptStack(), sort arr[starti, endi) from digit down
+
+typedef struct {
+  unsigned int starti;
+  unsigned int endi;
+  unsigned int digit;
+} countingSortStackItem_t;
+
+// Partition one work item by digit D. Small buckets are sorted right away and buckets
+// that need another partition level are pushed onto the work stack.
+
+template <unsigned int D, typename T>
+__attribute__((noinline))
+void countingSortInPlaceOptStackPartition(
+  T * arr,
+  countingSortStackItem_t item,
+  std::vector<countingSortStackItem_t> & stack)
+{
+  auto pushBucket = [arr, &stack](
+                                  T *bucketArr,
+                                  unsigned int bucketStarti,
+                                  unsigned int bucketEndi
+                                  )
+  {
+    // bucketArr is arr rebased to the subrange start when compact tables are used
+    const unsigned int starti = (unsigned int) (bucketArr - arr) + bucketStarti;
+    const unsigned int endi = (unsigned int) (bucketArr - arr) + bucketEndi;
+    const unsigned int n = endi - starti;
+    
+    if constexpr (D > 0) {
+      if (n <= smallBucketMaxN()) {
+        smallSortRadixKeyOpt(arr, starti, endi);
+      } else if (D == 1 && (radixDiffBitsOpt(arr, starti, endi) >> 8) == 0) {
+        // Only the last digit differs, see recurseBucketOpt()
+        countingSortRegenerateOpt<8>(arr, starti, endi);
+      } else {
+        stack.push_back({ starti, endi, D - 1 });
+      }
+    }
+  };
+  
+  if ((item.endi - item.starti) <= compactTableMaxN) {
+    countingSortInPlaceOptPartition<D, uint16_t>(arr + item.starti, 0, item.endi - item.starti, pushBucket);
+  } else {
+    countingSortInPlaceOptPartition<D>(arr, item.starti, item.endi, pushBucket);
+  }
+}
+
+template <unsigned int D, typename T>
+static inline
+void countingSortInPlaceOptStackStep(
+  T * arr,
+  countingSortStackItem_t item,
+  std::vector<countingSortStackItem_t> & stack)
+{
+  if constexpr (D > 0) {
+    if (item.digit < D) {
+      countingSortInPlaceOptStackStep<D-1>(arr, item, stack);
+      return;
+    }
+  }
+  
+  countingSortInPlaceOptStackPartition<D>(arr, item, stack);
+}
+
+// Same result as countingSortInPlaceOpt(), but a bucket that needs another partition level
+// is pushed onto a heap allocated work stack instead of being sorted with a recursive call.
+// Only one partition frame is live at a time, so the native stack use does not grow with
+// the number of digits and the sort can run on threads or fibers with a 64 KB stack.
+// Signed and float keys are partitioned by radixKeyOpt() digits at every level.
+
+template <unsigned int D, typename T>
+__attribute__((noinline))
+void countingSortInPlaceOptStack(
+  T * arr,
+  unsigned int starti,
+  unsigned int endi)
+{
+  if ((endi - starti) < 2) {
+    return;
+  }
+  
+  auto diffBits = radixDiffBitsOpt(arr, starti, endi);
+  
+  if (diffBits == 0) {
+    return;
+  }
+  
+  const unsigned int firstDigit = radixFirstVaryingDigitOpt(diffBits);
+  
+  if (firstDigit == 0) {
+    // Only the last digit differs
+    countingSortRegenerateOpt<8>(arr, starti, endi);
+    return;
+  }
+  
+  // A direct call on a low digit D starts at D even when a digit above it varies
+  
+  std::vector<countingSortStackItem_t> stack;
+  stack.push_back({ starti, endi, std::min(D, firstDigit) });
+  
+  while (!stack.empty()) {
+    countingSortStackItem_t item = stack.back();
+    stack.pop_back();
+    countingSortInPlaceOptStackStep<D>(arr, item, stack);
+  }
+}
+
+// Largest subrange that is sorted with 32 bit indices and counts
+
+constexpr size_t largeSortMaxSubrangeN = 0xFFFFFFFF;
+
+template <unsigned int D, typename T>
+void countingSortInPlaceOptLarge(
+  T * arr,
+  size_t starti,
+  size_t endi);
+
+// Same as recurseBucketOpt() for a bucket that may hold more than UINT32_MAX values.
+// A bucket that fits is rebased so that arr[0] is the first value in the bucket.
+
+template <unsigned int D, typename T>
+static inline
+void recurseBucketOptLarge(
+                           T *arr,
+                           size_t starti,
+                           size_t endi
+                           )
+{
+  if ((endi - starti) <= largeSortMaxSubrangeN) {
+    recurseBucketOpt<D>(arr + starti, 0, (unsigned int) (endi - starti));
+  } else if constexpr (D > 0) {
+    countingSortInPlaceOptLarge<D-1>(arr, starti, endi);
+  }
+}
+
+// Partition arr[starti, endi) by the top Bits bits of the key with block moves and then
+// sort each bucket from the highest 8 bit digit that still has varying bits. Signed and
+// float buckets are partitioned by radixKeyOpt() digits below the top digit.
+
+template <unsigned int Bits, typename I, typename T>
+__attribute__((noinline))
+void countingSortInPlaceOptWideBits(
+  T * arr,
+  I starti,
+  I endi)
+{
+  constexpr unsigned int D = sizeof(T) - 1;
+  constexpr unsigned int nextD = ((sizeof(T) * 8) - Bits - 1) / 8;
+  
+  auto recurse = [](
+                    T *arr,
+                    I starti,
+                    I endi
+                    )
+  {
+    if constexpr (sizeof(I) > sizeof(uint32_t)) {
+      recurseBucketOptLarge<nextD + 1>(arr, starti, endi);
+    } else {
+      recurseBucketOpt<nextD + 1>(arr, starti, endi);
+    }
+  };
+  
+  countingSortInPlaceOptBlockPartition<D, Bits, I>(arr, starti, endi, recurse);
+}
+
+// Sort arr[starti, endi) with a top digit of bits (11, 12 or 16) bits, see
+// radixTopDigitBitsOpt(). Wide buckets are only partitioned with block moves, so
+// with BLOCK_PERMUTE_BLOCK_BYTES defined as 0 the range is sorted by 8 bit digits.
+
+template <typename I, typename T>
+void countingSortInPlaceOptWide(
+  T * arr,
+  I starti,
+  I endi,
+  unsigned int bits)
+{
+  if constexpr (blockPermuteBlockBytes == 0) {
+    if constexpr (sizeof(I) > sizeof(uint32_t)) {
+      countingSortInPlaceOptLarge<sizeof(T) - 1>(arr, starti, endi);
+    } else {
+      countingSortInPlaceOpt<sizeof(T) - 1>(arr, starti, endi);
+    }
+  } else {
+    switch (bits) {
+      case 11: {
+        countingSortInPlaceOptWideBits<11, I>(arr, starti, endi);
+        break;
+      }
+      case 12: {
+        countingSortInPlaceOptWideBits<12, I>(arr, starti, endi);
+        break;
+      }
+      case 16: {
+        countingSortInPlaceOptWideBits<16, I>(arr, starti, endi);
+        break;
+      }
+      default: {
+#if defined(DEBUG)
+        assert(bits == 8);
+#endif
+        countingSortInPlaceOptWideBits<8, I>(arr, starti, endi);
+        break;
+      }
+    }
+  }
+}
+
+template <unsigned int D, typename T>
+static inline
+void countingSortInPlaceOptLargeFromDigit(
+  T * arr,
+  size_t starti,
+  size_t endi,
+  unsigned int digit)
+{
+  if constexpr (D > 0) {
+    if (digit < D) {
+      countingSortInPlaceOptLargeFromDigit<D-1>(arr, starti, endi, digit);
+      return;
+    }
+  }
+
+  countingSortInPlaceOptLarge<D>(arr, starti, endi);
+}
+
+// Sort with size_t indices so that a range can hold more than 4G values. Only partitions
+// over more than largeSortMaxSubrangeN values use 64 bit counts and offsets, any subrange
+// that fits (the whole range in the common case) is sorted with countingSortInPlaceOpt()
+// so that small bucket recursion does not pay for the wider tables.
+
+template <unsigned int D, typename T>
+__attribute__((noinline))
+void countingSortInPlaceOptLarge(
+  T * arr,
+  size_t starti,
+  size_t endi)
+{
+  if ((endi - starti) <= largeSortMaxSubrangeN) {
+    countingSortInPlaceOpt<D>(arr + starti, 0, (unsigned int) (endi - starti));
+    return;
+  }
+
+  if constexpr (D == (sizeof(T) - 1)) {
+    auto diffBits = radixDiffBitsOpt(arr, starti, endi);
+
+    if (diffBits == 0) {
+      return;
+    }
+
+    unsigned int firstDigit = radixFirstVaryingDigitOpt(diffBits);
+
+    if (firstDigit < D) {
+      countingSortInPlaceOptLargeFromDigit<D-1>(arr, starti, endi, firstDigit);
+      return;
+    }
+
+    if constexpr (blockPermuteBlockBytes > 0) {
+      const unsigned int topBits = radixTopDigitBitsOpt(endi - starti);
+
+      if (topBits > 8) {
+        countingSortInPlaceOptWide(arr, starti, endi, topBits);
+        return;
+      }
+    }
+  }
+
+  auto recurse = [](
+                    T *arr,
+                    size_t starti,
+                    size_t endi
+                    )
+  {
+    recurseBucketOptLarge<D>(arr, starti, endi);
+  };
+
+  if constexpr (std::is_integral<T>::value && std::is_signed<T>::value && D == (sizeof(T) - 1)) {
+    // See countingSortInPlaceOpt()
+
+    auto recurseUnsigned = [](
+                              T *arr,
+                              size_t starti,
+                              size_t endi
+                              )
+    {
+      typedef std::make_unsigned_t<T> U;
+
+      recurseBucketOptLarge<D>((U *) arr, starti, endi);
+    };
+
+    countingSortInPlaceOptPartition<D, size_t>(arr, starti, endi, recurseUnsigned);
+  } else {
+    countingSortInPlaceOptPartition<D, size_t>(arr, starti, endi, recurse);
+  }
+}
+
+// Key + value sort, values[i] is moved along with keys[i] so that a row id or any other
+// payload ends up in the sorted position of its key. The order of values with equal keys
+// is not defined since the sort is not stable.
+
+template <unsigned int D, typename T, typename V>
+__attribute__((noinline))
+void countingSortInPlaceOptKV(
+  T * keys,
+  V * values,
+  unsigned int starti,
+  unsigned int endi)
+{
+  auto recurse = [values](
+                    T *keys,
+                    unsigned int starti,
+                    unsigned int endi
+                    )
+  {
+    recurseBucketOptKV<D>(keys, values, starti, endi);
+  };
+  
+  countingSortInPlaceOptPartitionKV<D>(keys, values, starti, endi, recurse);
+}
+
+// Sort keys in place and write the original index of each sorted key into indices,
+// so that keys[i] after the sort was keys[indices[i]] before the sort.
+
+template <unsigned int D, typename T>
+static inline
+void argsortInPlaceOpt(
+  T * keys,
+  uint32_t * indices,
+  unsigned int n)
+{
+  for (unsigned int i = 0; i < n; i++) {
+    indices[i] = i;
+  }
+  
+  if (n > 1) {
+    countingSortInPlaceOptKV<D>(keys, indices, 0, n);
+  }
+}
+
+// Selection by radix partition, only the bucket that holds rank k is partitioned by the
+// next digit and all other buckets are left as is. Each level reads and permutes only the
+// values in one bucket, so the expected cost is O(n) instead of a full sort.
+
+template <unsigned int D, typename T>
+void radixSelectOpt(
+  T * arr,
+  unsigned int starti,
+  unsigned int endi,
+  unsigned int k);
+
+template <unsigned int D, typename T>
+static inline
+void radixSelectOptFromDigit(
+  T * arr,
+  unsigned int starti,
+  unsigned int endi,
+  unsigned int k,
+  unsigned int digit)
+{
+  if constexpr (D > 0) {
+    if (digit < D) {
+      radixSelectOptFromDigit<D-1>(arr, starti, endi, k, digit);
+      return;
+    }
+  }
+  
+  radixSelectOpt<D>(arr, starti, endi, k);
+}
+
+// Reorder arr[starti, endi) so that arr[k] is the value that would be at k after a sort,
+// values before k are <= arr[k] and values after k are >= arr[k] (like std::nth_element).
+// Keys are compared in radixKeyOpt() order.
+
+template <unsigned int D, typename T>
+__attribute__((noinline))
+void radixSelectOpt(
+  T * arr,
+  unsigned int starti,
+  unsigned int endi,
+  unsigned int k)
+{
+#if defined(DEBUG)
+  assert(k >= starti && k < endi);
+#endif
+  
+  if ((endi - starti) <= smallBucketMaxN()) {
+    smallSortRadixKeyOpt(arr, starti, endi);
+    return;
+  }
+  
+  if constexpr (D == (sizeof(T) - 1)) {
+    auto diffBits = radixDiffBitsOpt(arr, starti, endi);
+    
+    if (diffBits == 0) {
+      return;
+    }
+    
+    unsigned int firstDigit = radixFirstVaryingDigitOpt(diffBits);
+    
+    if (firstDigit < D) {
+      radixSelectOptFromDigit<D-1>(arr, starti, endi, k, firstDigit);
+      return;
+    }
+  }
+  
+  auto recurse = [k](
+                    T *arr,
+                    unsigned int starti,
+                    unsigned int endi
+                    )
+  {
+    if constexpr (D > 0) {
+      if (k >= starti && k < endi) {
+        radixSelectOpt<D-1>(arr, starti, endi, k);
+      }
+    }
+  };
+  
+  countingSortInPlaceOptPartition<D>(arr, starti, endi, recurse);
+}
+
+template <unsigned int D, typename T>
+void radixPartialSortOpt(
+  T * arr,
+  unsigned int starti,
+  unsigned int endi,
+  unsigned int k);
+
+template <unsigned int D, typename T>
+static inline
+void radixPartialSortOptFromDigit(
+  T * arr,
+  unsigned int starti,
+  unsigned int endi,
+  unsigned int k,
+  unsigned int digit)
+{
+  if constexpr (D > 0) {
+    if (digit < D) {
+      radixPartialSortOptFromDigit<D-1>(arr, starti, endi, k, digit);
+      return;
+    }
+  }
+  
+  radixPartialSortOpt<D>(arr, starti, endi, k);
+}
+
+// Sort the smallest (k - starti) values into arr[starti, k), the values in arr[k, endi)
+// are >= arr[k - 1] and are left in an unspecified order (like std::partial_sort).
+// Buckets entirely below k are fully sorted, the one bucket that spans k recurses
+// and buckets entirely above k are not touched after the partition.
+
+template <unsigned int D, typename T>
+__attribute__((noinline))
+void radixPartialSortOpt(
+  T * arr,
+  unsigned int starti,
+  unsigned int endi,
+  unsigned int k)
+{
+#if defined(DEBUG)
+  assert(k >= starti && k <= endi);
+#endif
+  
+  if (k == starti) {
+    return;
+  }
+  
+  if ((endi - starti) <= smallBucketMaxN()) {
+    smallSortRadixKeyOpt(arr, starti, endi);
+    return;
+  }
+  
+  if constexpr (D == (sizeof(T) - 1)) {
+    auto diffBits = radixDiffBitsOpt(arr, starti, endi);
+    
+    if (diffBits == 0) {
+      return;
+    }
+    
+    unsigned int firstDigit = radixFirstVaryingDigitOpt(diffBits);
+    
+    if (firstDigit < D) {
+      radixPartialSortOptFromDigit<D-1>(arr, starti, endi, k, firstDigit);
+      return;
+    }
+  }
+  
+  auto recurse = [k](
+                    T *arr,
+                    unsigned int starti,
+                    unsigned int endi
+                    )
+  {
+    if (endi <= k) {
+      recurseBucketOpt<D>(arr, starti, endi);
+    } else if constexpr (D > 0) {
+      if (starti < k) {
+        radixPartialSortOpt<D-1>(arr, starti, endi, k);
+      }
+    }
+  };
+  
+  countingSortInPlaceOptPartition<D>(arr, starti, endi, recurse);
+}
+
+// Sort + unique. When runCounts is not a void pointer, runCounts[i] is set to the number
+// of times the unique value arr[i] appeared in the input. Buckets are processed in sorted
+// order and each writes its unique values at outi, which is never past the start of the
+// bucket, so there is no compaction pass. Ranges where only the low 8 or 16 bits vary
+// are written straight from a histogram, so duplicates there are never moved. Each
+// function returns the new outi.
+
+template <unsigned int DomainBits, typename T, typename C>
+static inline
+unsigned int countingSortUniqueRegenerateOpt(
+                                             T * arr,
+                                             C * runCounts,
+                                             unsigned int starti,
+                                             unsigned int endi,
+                                             unsigned int outi
+                                             )
+{
+  typedef decltype(radixKeyOpt(arr[starti])) U;
+  
+  constexpr unsigned int domainN = 1 << DomainBits;
+  
+  uint32_t smallCounts[(domainN <= 256) ? domainN : 1] = {};
+  std::vector<uint32_t> largeCounts((domainN <= 256) ? 0 : domainN);
+  uint32_t * counts = (domainN <= 256) ? smallCounts : largeCounts.data();
+  
+  const U prefix = regenerateCountsOpt<DomainBits>(arr, starti, endi, counts);
+  
+  for (unsigned int digit = 0; digit < domainN; digit++) {
+    unsigned int count = counts[digit];
+    if (count > 0) {
+      arr[outi] = radixKeyInverseOpt<T>((U) (prefix | digit));
+      if constexpr (!std::is_void<C>::value) {
+        runCounts[outi] = count;
+      }
+      outi++;
+    }
+  }
+  
+  return outi;
+}
+
+// Write the first value of each run of equal values in the sorted range arr[starti, endi)
+
+template <typename T, typename C>
+static inline
+unsigned int uniqueRunsOpt(
+                           T * arr,
+                           C * runCounts,
+                           unsigned int starti,
+                           unsigned int endi,
+                           unsigned int outi
+                           )
+{
+  T prev = arr[starti];
+  unsigned int count = 1;
+  
+  for (unsigned int readi = starti + 1; readi < endi; readi++) {
+    T v = arr[readi];
+    if (radixKeyOpt(v) == radixKeyOpt(prev)) {
+      count++;
+    } else {
+      arr[outi] = prev;
+      if constexpr (!std::is_void<C>::value) {
+        runCounts[outi] = count;
+      }
+      outi++;
+      prev = v;
+      count = 1;
+    }
+  }
+  
+  arr[outi] = prev;
+  if constexpr (!std::is_void<C>::value) {
+    runCounts[outi] = count;
+  }
+  
+  return outi + 1;
+}
+
+template <unsigned int D, typename T, typename C>
+unsigned int countingSortUniqueOptImpl(
+  T * arr,
+  C * runCounts,
+  unsigned int starti,
+  unsigned int endi,
+  unsigned int outi);
+
+template <unsigned int D, typename T, typename C>
+static inline
+unsigned int countingSortUniqueOptFromDigit(
+  T * arr,
+  C * runCounts,
+  unsigned int starti,
+  unsigned int endi,
+  unsigned int outi,
+  unsigned int digit)
+{
+  if constexpr (D > 0) {
+    if (digit < D) {
+      return countingSortUniqueOptFromDigit<D-1>(arr, runCounts, starti, endi, outi, digit);
+    }
+  }
+  
+  return countingSortUniqueOptImpl<D>(arr, runCounts, starti, endi, outi);
+}
+
+// The digits above D are the same for all values in arr[starti, endi)
+
+template <unsigned int D, typename T, typename C>
+__attribute__((noinline))
+unsigned int countingSortUniqueOptImpl(
+  T * arr,
+  C * runCounts,
+  unsigned int starti,
+  unsigned int endi,
+  unsigned int outi)
+{
+#if defined(DEBUG)
+  assert(outi <= starti);
+#endif
+  
+  const unsigned int n = endi - starti;
+  
+  if (n <= smallBucketMaxN()) {
+    if (n == 0) {
+      return outi;
+    }
+    smallSortRadixKeyOpt(arr, starti, endi);
+    return uniqueRunsOpt(arr, runCounts, starti, endi, outi);
+  }
+  
+  if constexpr (D == (sizeof(T) - 1)) {
+    auto diffBits = radixDiffBitsOpt(arr, starti, endi);
+    
+    if (diffBits == 0) {
+      arr[outi] = arr[starti];
+      if constexpr (!std::is_void<C>::value) {
+        runCounts[outi] = n;
       }
-       
-    } // end while (bucketIterN != 0)
+      return outi + 1;
+    }
     
-    // After a bucket iteration, the bucket may be empty. Once a bucket is empty, it will be recursed into
-    // and it will be ignored in future iterations. Note the case where a bucket is ignored in one iteration
-    // and then it becomes empty due to a different bucket writing into it, that bucket will still be processed here.
+    unsigned int firstDigit = radixFirstVaryingDigitOpt(diffBits);
     
-    if (isBucketEmpty(currentBucketi, offsets, counts)) {
-      // All bucket slots consumed by inner loop, remove bucket from bucketsThisIteration and nonEmptyBuckets
-      
-      if (debugDumpBucketBounds) {
-        std::cout << "bucket [" << currentBucketi << "] bit cleared" << std::endl;
-      }
-      
-      bitset256ClearBit(bucketsThisIteration, currentBucketi);
-      --bucketsThisIterationNum;
+    if (firstDigit == 0) {
+      return countingSortUniqueRegenerateOpt<8>(arr, runCounts, starti, endi, outi);
+    }
+    
+    if (firstDigit < D) {
+      return countingSortUniqueOptFromDigit<D-1>(arr, runCounts, starti, endi, outi, firstDigit);
+    }
+  }
+  
+  if constexpr (D == 0) {
+    // The D = 0 histogram holds the count of each unique value
+    return countingSortUniqueRegenerateOpt<8>(arr, runCounts, starti, endi, outi);
+  } else if constexpr (D == 1) {
+    // Only the low 16 bits vary. Count a large range with a 16 bit histogram, a smaller
+    // range has few duplicates per value so it is sorted and then scanned once.
+    
+    if (n >= regenerate16MinN) {
+      return countingSortUniqueRegenerateOpt<16>(arr, runCounts, starti, endi, outi);
+    }
+    
+    countingSortInPlaceOpt<1>(arr, starti, endi, true);
+    return uniqueRunsOpt(arr, runCounts, starti, endi, outi);
+  } else {
+    // A bucket is made unique as soon as it is complete when every bucket before it
+    // is done, otherwise it waits in pendingBuckets until the buckets before it are.
+    
+    unsigned int bucketStart[256];
+    unsigned int bucketEnd[256];
+    bitset256_t pendingBuckets;
+    bitset256Clear(pendingBuckets);
+    
+    unsigned int nextStarti = starti;
+    
+    auto recurse = [&](
+                      T *arr,
+                      unsigned int starti,
+                      unsigned int endi
+                      )
+    {
+      unsigned int digit = extractDigitOpt<D>(arr[starti]);
+      bucketStart[digit] = starti;
+      bucketEnd[digit] = endi;
+      bitset256SetBit(pendingBuckets, digit);
       
-      {
-        unsigned int currentBucketStartOffset = ((currentBucketi == 0) ? starti : counts[currentBucketi - 1]);
-        unsigned int currentBucketEndOffset = counts[currentBucketi];
-        
-#if defined(DEBUG)
-        {
-          auto expectedStart = checkBucketStart[currentBucketi];
-          auto expectedEnd = checkBucketEnd[currentBucketi];
-          
-          assert(currentBucketStartOffset == expectedStart);
-          assert(currentBucketEndOffset == expectedEnd);
-        }
-#endif
-        // Once bucket recursion has been executed, clear bit in nonEmptyBuckets
-        
-#if defined(DEBUG)
-        {
-          // This isBucketEmpty() check is the only place where a nonEmptyBuckets
-          // bit can be flipped off and this can only happen once for a bucket.
-          auto inNonEmpty = bitset256GetBit(nonEmptyBuckets, currentBucketi);
-          assert(inNonEmpty == true);
+      while (!bitset256IsAllOff(pendingBuckets)) {
+        unsigned int nextDigit = bitset256FindFirstSetOpt(pendingBuckets);
+        if (bucketStart[nextDigit] != nextStarti) {
+          break;
         }
-#endif
-        
-        if (1) {
-          if (debugDumpBucketBounds) {
-            std::cout << "recurse into bucket " << currentBucketi << std::endl;
-          }
-          
+        bitset256ClearBit(pendingBuckets, nextDigit);
+        outi = countingSortUniqueOptImpl<D-1>(arr, runCounts, bucketStart[nextDigit], bucketEnd[nextDigit], outi);
+        nextStarti = bucketEnd[nextDigit];
+      }
+    };
+    
+    countingSortInPlaceOptPartition<D>(arr, starti, endi, recurse);
+    
 #if defined(DEBUG)
-          auto recursedAlready = checkBucketRecursion[currentBucketi];
-          assert(recursedAlready == false);
-          checkBucketRecursion[currentBucketi] = true;
+    assert(nextStarti == endi);
 #endif
-          
-          bitset256ClearBit(nonEmptyBuckets, currentBucketi);
-          
-          recurse(arr, currentBucketStartOffset, currentBucketEndOffset);
-        }
-      }
-    } // end isBucketEmpty()
     
-    if (bucketsThisIterationNum == 0) {
-      if (debugDumpBucketBounds) {
-        std::cout << "buckets reloaded since bucketsThisIterationNum is zero" << std::endl;
-      }
+    return outi;
+  }
+}
 
-      reloadBuckets();
-    }
+// Sort arr[starti, endi) and remove duplicate values, returns the new end of the range
+// (like std::unique after a sort). Values are compared by radixKeyOpt(), so -0.0 and +0.0
+// are different values and NaN values with the same bits are duplicates.
 
-  } // end while ( numNonEmptyBuckets != 0 )
+template <unsigned int D, typename T>
+static inline
+unsigned int countingSortUniqueOpt(
+  T * arr,
+  unsigned int starti,
+  unsigned int endi)
+{
+  return countingSortUniqueOptImpl<D>(arr, (void *) nullptr, starti, endi, starti);
+}
+
+// Same as countingSortUniqueOpt() and runCounts[i] is set to the number of times arr[i]
+// appeared in the input for each i in [starti, newEndi), so the result is (value, count)
+// pairs. The runCounts array is indexed like arr and must be at least endi in length.
+
+template <unsigned int D, typename T>
+static inline
+unsigned int countingSortRunLengthOpt(
+  T * arr,
+  uint32_t * runCounts,
+  unsigned int starti,
+  unsigned int endi)
+{
+  return countingSortUniqueOptImpl<D>(arr, runCounts, starti, endi, starti);
+}
+
+// Number of boundaries written by radixPartitionOpt() for a given number of levels
+
+constexpr size_t radixPartitionBoundariesN(unsigned int levels) {
+  return (((size_t) 1) << (8 * levels)) + 1;
+}
+
+// Partition arr[starti, endi) by digit D and stop, the buckets are not sorted. With Levels = 2
+// each bucket is also partitioned by digit D-1, a 16 bit fan-out, and so on. On return bucket
+// i holds the values whose Levels digits (from D down) equal i and is the range
+// [boundaries[i], boundaries[i+1]), boundaries must hold radixPartitionBoundariesN(Levels)
+// entries and the last entry is endi. When values is not a void pointer, values[i] is moved
+// along with keys[i], as with countingSortInPlaceOptKV().
+
+template <unsigned int D, unsigned int Levels = 1, typename T, typename V>
+static inline
+void radixPartitionOptKV(
+  T * keys,
+  V * values,
+  unsigned int starti,
+  unsigned int endi,
+  unsigned int * boundaries)
+{
+  static_assert(Levels >= 1 && Levels <= (D + 1), "Levels must be in the range [1, D+1]");
   
-#if defined(DEBUG)
-    if (debugDumpBucketBounds) {
-      std::cout << "all buckets now empty totalNumberOfReloads " << totalNumberOfReloads << std::endl;
+  constexpr size_t subBoundariesN = radixPartitionBoundariesN(Levels - 1) - 1;
+  
+  bitset256_t partitionedBuckets;
+  bitset256Clear(partitionedBuckets);
+  
+  if (starti < endi) {
+    auto recurse = [values, boundaries, &partitionedBuckets](
+                      T *keys,
+                      unsigned int starti,
+                      unsigned int endi
+                      )
+    {
+      unsigned int digit = extractDigitOpt<D>(keys[starti]);
+      bitset256SetBit(partitionedBuckets, digit);
+      
+      if constexpr (Levels > 1) {
+        radixPartitionOptKV<D-1, Levels-1>(keys, values, starti, endi, boundaries + (digit * subBoundariesN));
+      } else {
+        boundaries[digit] = starti;
+      }
+    };
+    
+    countingSortInPlaceOptPartitionKV<D>(keys, values, starti, endi, recurse);
+  }
+  
+  // Empty buckets start (and end) where the next non-empty bucket starts
+  
+  boundaries[256 * subBoundariesN] = endi;
+  
+  for (int digit = 255; digit >= 0; digit--) {
+    if (!bitset256GetBit(partitionedBuckets, digit)) {
+      std::fill_n(boundaries + (digit * subBoundariesN), subBoundariesN, boundaries[(digit + 1) * subBoundariesN]);
     }
-#endif
+  }
+}
 
-  // All buckets must be empty at this point
+template <unsigned int D, unsigned int Levels = 1, typename T>
+static inline
+void radixPartitionOpt(
+  T * arr,
+  unsigned int starti,
+  unsigned int endi,
+  unsigned int * boundaries)
+{
+  radixPartitionOptKV<D, Levels>(arr, (void *) nullptr, starti, endi, boundaries);
+}
+
+// Out-of-place LSD radix sort for callers that have memory to spare. When scratch is
+// not null it must hold (endi - starti) values, the range is then sorted with one LSD
+// pass per digit that ping-pongs between arr and scratch. A single read pass counts
+// the histograms of all digits at once and a digit where every value falls in the same
+// bucket is skipped. When scratch is null, or the in-place hybrid sort is faster for
+// this key size and range size (see lsdSortWinsOpt), the in-place sort is used.
+//
+// In a large pass the scatter goes through a 64 byte write combining buffer per bucket
+// and each full cache line is written with non-temporal stores, so the destination
+// lines are not read into the cache first and the source is not evicted by them.
+
+// Ranges with fewer values are sorted in-place even when scratch is given
+
+constexpr unsigned int lsdSortMinN = 1 << 14;
+
+// Measured on a single core x86 VM with random keys (-O3). For 32 bit keys the in-place
+// sort was as fast or 10 - 50% faster than LSD at every size from 2^12 to 2^24. For 64 bit
+// keys LSD was about 2x faster from 2^14 to 2^17 and up to 35% faster from 2^22, while the
+// in-place sort was up to 40% faster in between. So LSD is only used for 64 bit keys in
+// the two ranges where it wins.
+
+constexpr unsigned int lsdSortMidMaxN = 1 << 17;
+constexpr unsigned int lsdSortLargeMinN = 1 << 22;
+
+template <typename T>
+static inline
+bool lsdSortWinsOpt(unsigned int n) {
+  if constexpr (sizeof(T) < sizeof(uint64_t)) {
+    return false;
+  } else {
+    return (n >= lsdSortMinN && n <= lsdSortMidMaxN) || n >= lsdSortLargeMinN;
+  }
+}
+
+// LSD passes over at least this many bytes use write combining and streaming stores
+
+constexpr size_t lsdStreamMinBytes = 1 << 22;
+
+template <typename T, typename C>
+static inline
+void countingSortLSDPassOpt(
+  const T * src,
+  T * dst,
+  unsigned int n,
+  unsigned int shift,
+  const C * counts,
+  bool streaming)
+{
+  constexpr unsigned int bucketMax = 256;
+  
+  unsigned int offsets[bucketMax];
   
-#if defined(DEBUG)
   {
+    unsigned int psum = 0;
     for (unsigned int bucketi = 0; bucketi < bucketMax; bucketi++) {
-      auto count = counts[bucketi] - offsets[bucketi];
-      assert (count == 0);
-      
-      auto wasNonEmpty = bitset256GetBit(nonEmptyBucketsCopy, bucketi);
+      offsets[bucketi] = psum;
+      psum += counts[bucketi];
+    }
+  }
+  
+#if defined(__SSE2__)
+  if (streaming) {
+    constexpr unsigned int lineBytes = 64;
+    constexpr unsigned int lineN = lineBytes / sizeof(T);
+    
+    alignas(64) T lines[bucketMax][lineN];
+    unsigned int lineCount[bucketMax];
+    unsigned int lineCapacity[bucketMax];
+    
+    // The first line of a bucket ends at the first line aligned destination, so every
+    // later full line can be streamed
+    
+    for (unsigned int bucketi = 0; bucketi < bucketMax; bucketi++) {
+      uintptr_t addr = (uintptr_t) (dst + offsets[bucketi]);
+      unsigned int misaligned = (unsigned int) ((addr % lineBytes) / sizeof(T));
+      lineCount[bucketi] = 0;
+      lineCapacity[bucketi] = lineN - misaligned;
+    }
+    
+    for (unsigned int i = 0; i < n; i++) {
+      T v = src[i];
+      unsigned int bucketi = (unsigned int) (radixKeyOpt(v) >> shift) & (bucketMax - 1);
+      lines[bucketi][lineCount[bucketi]++] = v;
       
-      if (wasNonEmpty) {
-        auto recursedAlready = checkBucketRecursion[bucketi];
-        assert(recursedAlready == true);
-        
-        auto bitSet = bitset256GetBit(nonEmptyBuckets, bucketi);
-        assert(bitSet == false);
+      if (lineCount[bucketi] == lineCapacity[bucketi]) {
+        T * out = dst + offsets[bucketi];
+        if (lineCapacity[bucketi] == lineN) {
+          const __m128i * in = (const __m128i *) lines[bucketi];
+          _mm_stream_si128((__m128i *) out + 0, _mm_load_si128(in + 0));
+          _mm_stream_si128((__m128i *) out + 1, _mm_load_si128(in + 1));
+          _mm_stream_si128((__m128i *) out + 2, _mm_load_si128(in + 2));
+          _mm_stream_si128((__m128i *) out + 3, _mm_load_si128(in + 3));
+        } else {
+          memcpy(out, lines[bucketi], lineCapacity[bucketi] * sizeof(T));
+        }
+        offsets[bucketi] += lineCapacity[bucketi];
+        lineCount[bucketi] = 0;
+        lineCapacity[bucketi] = lineN;
       }
     }
+    
+    // Partial lines at the end of each bucket
+    
+    for (unsigned int bucketi = 0; bucketi < bucketMax; bucketi++) {
+      memcpy(dst + offsets[bucketi], lines[bucketi], lineCount[bucketi] * sizeof(T));
+    }
+    
+    _mm_sfence();
+    return;
   }
-#endif
+#endif // __SSE2__
   
-  if (debugOut) {
-    std::cout << "countingSortInPlace D = " << D << " returns:" << std::endl;
-    std::cout << "n " << n << std::endl;
-    std::cout << "starti " << starti << std::endl;
-    std::cout << "endi " << endi << std::endl;
+  (void) streaming;
+  
+  for (unsigned int i = 0; i < n; i++) {
+    T v = src[i];
+    unsigned int bucketi = (unsigned int) (radixKeyOpt(v) >> shift) & (bucketMax - 1);
+    dst[offsets[bucketi]++] = v;
+  }
+}
+
+// Count the histograms of the low numDigits digits of arr[0, n) in one pass, counts holds
+// numDigits * 256 zeroed entries with digit 0 first.
+
+template <unsigned int numDigits, typename T, typename C>
+static inline
+void histogramDigitsOpt(
+  const T * arr,
+  unsigned int n,
+  C * counts)
+{
+  constexpr unsigned int bucketMax = 256;
+  
+  for (unsigned int i = 0; i < n; i++) {
+    auto key = radixKeyOpt(arr[i]);
+    for (unsigned int digit = 0; digit < numDigits; digit++) {
+      counts[(digit * bucketMax) + ((key >> (digit * 8)) & 0xFF)] += 1;
+    }
+  }
+}
+
+// False when all values have the same digit, an LSD pass would not change the order
+
+template <typename T, typename C>
+static inline
+bool countingSortLSDDigitVariesOpt(
+  const T * arr,
+  unsigned int n,
+  unsigned int digit,
+  const C * digitCounts)
+{
+  unsigned int firstDigit = (unsigned int) (radixKeyOpt(arr[0]) >> (digit * 8)) & 0xFF;
+  return digitCounts[firstDigit] != n;
+}
+
+// LSD sort arr[0, n) by its low numDigits digits through scratch (n values), counts
+// are the histograms from histogramDigitsOpt(). Digits that do not vary are skipped.
+
+template <unsigned int numDigits, typename T, typename C>
+static inline
+void countingSortLSDDigitsOpt(
+  T * arr,
+  unsigned int n,
+  T * scratch,
+  const C * counts,
+  bool streaming)
+{
+  constexpr unsigned int bucketMax = 256;
+  
+  T * src = arr;
+  T * dst = scratch;
+  
+  for (unsigned int digit = 0; digit < numDigits; digit++) {
+    const C * digitCounts = &counts[digit * bucketMax];
     
-    if (debugDumpInOutValues) {
-      for (int i = starti; i < endi; i++) {
-        std::cout << (unsigned int) arr[i] << std::endl;
-      }
+    if (!countingSortLSDDigitVariesOpt(src, n, digit, digitCounts)) {
+      continue;
     }
     
-    std::cout << "-------- " << std::endl;
+    countingSortLSDPassOpt(src, dst, n, digit * 8, digitCounts, streaming);
+    std::swap(src, dst);
   }
   
-#if defined(DEBUG)
-  // A bug would cause these two to not match
-  assert(n == slotWrites);
-#endif
+  if (src != arr) {
+    memcpy(arr, src, (size_t) n * sizeof(T));
+  }
+}
+
+template <typename T>
+void countingSortLSDOpt(
+  T * arr,
+  unsigned int starti,
+  unsigned int endi,
+  T * scratch)
+{
+  constexpr unsigned int numDigits = sizeof(T);
+  constexpr unsigned int bucketMax = 256;
+  
+  const unsigned int n = endi - starti;
+  
+  if (scratch == nullptr || !lsdSortWinsOpt<T>(n)) {
+    countingSortInPlaceOpt<numDigits - 1>(arr, starti, endi);
+    return;
+  }
+  
+  std::vector<uint32_t> counts(numDigits * bucketMax);
+  
+  histogramDigitsOpt<numDigits>(arr + starti, n, counts.data());
+  
+  const bool streaming = ((size_t) n * sizeof(T)) >= lsdStreamMinBytes;
+  
+  countingSortLSDDigitsOpt<numDigits>(arr + starti, n, scratch, counts.data(), streaming);
+}
+
+// Ranges with more varying digits than this are partitioned as usual. Each LSD pass
+// costs about as much as a third of an MSD level, measured on x86-64 with 32 and 64
+// bit keys of 200 to 16K values.
+
+#if defined(MID_SORT_MAX_PASSES)
+constexpr unsigned int midSortMaxPasses = MID_SORT_MAX_PASSES;
+#else
+constexpr unsigned int midSortMaxPasses = 3;
+#endif // MID_SORT_MAX_PASSES
+
+// Scratch buffer for countingSortMidOpt(), one per thread and key size so that parallel
+// bucket tasks never share it. It grows to the largest mid size bucket and is kept.
+
+template <typename T>
+static inline
+T * midSortScratchOpt(unsigned int n) {
+  static thread_local std::vector<T> scratch;
+  if (scratch.size() < n) {
+    scratch.resize(n);
+  }
+  return scratch.data();
+}
+
+// Sort a mid size range arr[starti, endi) by digits D down to 0 (the digits above D
+// are the same in all values). A range of a few hundred to a few thousand values still
+// pays for a 256 bucket histogram, prefix sum and swap loop at every MSD level, and
+// most of its child buckets are then tiny. Here the histograms of all the remaining
+// digits are counted in one pass and the range is LSD sorted with one stable pass per
+// varying digit through a thread local scratch buffer, all of which stays in L1 / L2.
+// Returns false without changing the range when more than midSortMaxPasses digits vary.
+
+template <unsigned int D, typename T>
+__attribute__((noinline))
+bool countingSortMidOpt(
+  T * arr,
+  unsigned int starti,
+  unsigned int endi)
+{
+  auto first = radixKeyOpt(arr[starti]);
+  decltype(first) diffBits = 0;
+  for (unsigned int i = starti + 1; i < endi; i++) {
+    diffBits |= radixKeyOpt(arr[i]) ^ first;
+  }
+  
+  return countingSortMidOpt<D>(arr, starti, endi, diffBits);
+}
+
+// Same as above with diffBits already known, the top level passes the result of
+// radixDiffBitsOpt() so that the range is not read again. That scan can stop early
+// and does not apply the key transform, so the number of varying digits is only an
+// estimate, the passes that are run are still chosen from the digit histograms.
+
+template <unsigned int D, typename T, typename U>
+__attribute__((noinline))
+bool countingSortMidOpt(
+  T * arr,
+  unsigned int starti,
+  unsigned int endi,
+  U diffBits)
+{
+  constexpr unsigned int numDigits = D + 1;
+  constexpr unsigned int bucketMax = 256;
+  
+  const unsigned int n = endi - starti;
+  
+  typedef decltype(radixKeyOpt(arr[starti])) K;
+  
+  unsigned int numPasses = 0;
+  for (unsigned int digit = 0; digit < numDigits; digit++) {
+    numPasses += (((diffBits >> (digit * 8)) & 0xFF) != 0) ? 1 : 0;
+  }
+  
+  if (numPasses > midSortMaxPasses) {
+    return false;
+  }
+  
+  unsigned int counts[numDigits * bucketMax] = {};
+  
+  if constexpr (std::is_floating_point<T>::value) {
+    // Sort the radixKeyOpt() keys in scratch so that the float transform is applied
+    // once on the way in and once on the way out instead of on every pass
+    K * keys = midSortScratchOpt<K>(2 * n);
+    
+    for (unsigned int i = 0; i < n; i++) {
+      keys[i] = radixKeyOpt(arr[starti + i]);
+    }
+    
+    histogramDigitsOpt<numDigits>(keys, n, counts);
+    
+    countingSortLSDDigitsOpt<numDigits>(keys, n, keys + n, counts, false);
+    
+    for (unsigned int i = 0; i < n; i++) {
+      arr[starti + i] = radixKeyInverseOpt<T>(keys[i]);
+    }
+  } else {
+    histogramDigitsOpt<numDigits>(arr + starti, n, counts);
+    
+    countingSortLSDDigitsOpt<numDigits>(arr + starti, n, midSortScratchOpt<T>(n), counts, false);
+  }
+  
+  return true;
 }
@@ -0,0 +1,487 @@
+// Multi-threaded entry point for the hybrid in-place radix sort. The top level
+// digit is partitioned by all threads at once using the speculative permutation
+// and repair approach from PARADIS, so the sort remains in-place. Once the top
+// level buckets are known, the buckets are sorted as tasks on a work-stealing
+// pool so that load balancing happens at every recursion level.
+//
+// See "PARADIS: An Efficient Parallel Algorithm for In-place Radix Sort"
+// (Cho, Brand, Bordawekar, Finkler, Kulandaisamy, Puri) VLDB 2015.
+
+#pragma once
+
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+
+#include "in_place_sort_opt.hpp"
+#include "work_stealing_pool.hpp"
+
+// Inputs smaller than this are sorted on the calling thread since the cost
+// of starting threads is larger than the single threaded sort time.
+
+constexpr unsigned int parallelSortMinN = 1 << 16;
+
+// Each thread should be given at least this many values in the top level partition.
+
+constexpr unsigned int parallelSortMinPerThread = 1 << 14;
+
+// When fewer than this number of values remain misplaced after a PARADIS round
+// the remaining values are moved into place on the calling thread.
+
+constexpr unsigned int parallelSortSerialFinishN = 1 << 12;
+
+// Buckets smaller than this are sorted inline by the worker that partitioned
+// them, larger buckets are pushed as tasks that idle workers can steal.
+
+constexpr unsigned int parallelSortMinTaskN = 1 << 14;
+
+// Execute fn(threadi) for threadi in the range (0, numThreads). The calling thread
+// runs threadi = 0 and this method returns once all threads have finished.
+
+template <typename F>
+static inline
+void parallelForThreadsOpt(unsigned int numThreads, F && fn)
+{
+  std::vector<std::thread> threads;
+  threads.reserve(numThreads - 1);
+
+  for (unsigned int threadi = 1; threadi < numThreads; threadi++) {
+    threads.emplace_back([&fn, threadi]() {
+      fn(threadi);
+    });
+  }
+
+  fn(0);
+
+  for (auto & thread : threads) {
+    thread.join();
+  }
+}
+
+// Fixed set of numThreads - 1 threads that stay parked between calls to run(), so
+// that the histogram, every PARADIS round and the bucket tasks of one sort start
+// threads once instead of once per step. run(fn) executes fn(threadi) for threadi
+// in the range (0, numThreads), the calling thread runs threadi = 0.
+
+class ParallelThreadGroup {
+public:
+  explicit ParallelThreadGroup(unsigned int numThreads)
+    : numThreads(numThreads == 0 ? 1 : numThreads)
+  {
+    threads.reserve(this->numThreads - 1);
+    for (unsigned int threadi = 1; threadi < this->numThreads; threadi++) {
+      threads.emplace_back([this, threadi]() {
+        workerLoop(threadi);
+      });
+    }
+  }
+
+  ~ParallelThreadGroup() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+      generation += 1;
+    }
+    startCond.notify_all();
+    for (auto & thread : threads) {
+      thread.join();
+    }
+  }
+
+  ParallelThreadGroup(const ParallelThreadGroup &) = delete;
+  ParallelThreadGroup & operator=(const ParallelThreadGroup &) = delete;
+
+  unsigned int size() const {
+    return numThreads;
+  }
+
+  template <typename F>
+  void run(F && fn) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      jobFn = [](void * ctx, unsigned int threadi) {
+        (*((typename std::remove_reference<F>::type *) ctx))(threadi);
+      };
+      jobCtx = (void *) &fn;
+      numRunning = numThreads - 1;
+      generation += 1;
+    }
+    startCond.notify_all();
+
+    fn(0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    doneCond.wait(lock, [this]() {
+      return numRunning == 0;
+    });
+  }
+
+private:
+  void workerLoop(unsigned int threadi) {
+    uint64_t seenGeneration = 0;
+
+    while (true) {
+      void (*fn)(void * ctx, unsigned int threadi);
+      void * ctx;
+
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        startCond.wait(lock, [&]() {
+          return generation != seenGeneration;
+        });
+        seenGeneration = generation;
+        if (stopping) {
+          return;
+        }
+        fn = jobFn;
+        ctx = jobCtx;
+      }
+
+      fn(ctx, threadi);
+
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        numRunning -= 1;
+        if (numRunning == 0) {
+          doneCond.notify_one();
+        }
+      }
+    }
+  }
+
+  const unsigned int numThreads;
+  std::vector<std::thread> threads;
+
+  std::mutex mutex;
+  std::condition_variable startCond;
+  std::condition_variable doneCond;
+  uint64_t generation = 0;
+  unsigned int numRunning = 0;
+  bool stopping = false;
+  void (*jobFn)(void * ctx, unsigned int threadi) = nullptr;
+  void * jobCtx = nullptr;
+};
+
+// Per thread bucket table, cache line aligned so that threads do not
+// write into the same cache line when updating adjacent tables.
+
+typedef struct alignas(64) {
+  uint32_t buckets[256];
+} parallelBucketTable_t;
+
+// Task that sorts the values in one bucket that was partitioned by digit D.
+// Buckets at the next digit that are large enough to be worth stealing are
+// pushed back onto this worker's deque, smaller buckets are sorted inline.
+
+template <unsigned int D>
+static
+void parallelSortBucketTaskOpt(
+  WorkStealingPool & pool,
+  unsigned int workeri,
+  void * ctx,
+  unsigned int starti,
+  unsigned int endi)
+{
+  uint32_t * arr = (uint32_t *) ctx;
+
+  // All workers are busy with tasks, so large buckets must not start histogram threads
+  histogramOptThreadsEnabled() = false;
+
+  if constexpr (D > 1) {
+    const unsigned int n = endi - starti;
+
+    if (n > smallBucketMaxN() && n <= midBucketMaxN()) {
+      // No child bucket is large enough to be a task, sorted like any other bucket
+      // so that the cache resident LSD path is used
+      countingSortInPlaceOpt<D-1>(arr, starti, endi, true);
+      return;
+    }
+
+    if (n > smallBucketMaxN()) {
+      countingSortInPlaceOptPartition<D-1>(arr, starti, endi, [&pool, workeri](uint32_t *arr, unsigned int starti, unsigned int endi) {
+        if ((endi - starti) >= parallelSortMinTaskN) {
+          pool.push(workeri, { parallelSortBucketTaskOpt<D-1>, arr, starti, endi });
+        } else {
+          recurseBucketOpt<D-1>(arr, starti, endi);
+        }
+      });
+      return;
+    }
+  }
+
+  recurseBucketOpt<D>(arr, starti, endi);
+}
+
+// Partition and sort on the threads of group, see countingSortInPlaceOptParallel()
+
+template <unsigned int D>
+__attribute__((noinline))
+void countingSortInPlaceOptParallelGroup(
+  uint32_t * arr,
+  unsigned int starti,
+  unsigned int endi,
+  ParallelThreadGroup & group)
+{
+  constexpr bool debugOut = false;
+
+  constexpr unsigned int bucketMax = 256;
+
+  const unsigned int n = endi - starti;
+
+  const unsigned int numThreads = group.size();
+
+  if (debugOut) {
+    std::cout << "countingSortInPlaceOptParallel D = " << D << " n " << n << " numThreads " << numThreads << std::endl;
+  }
+
+  // Histogram counts, each thread counts one contiguous chunk into a private table
+
+  uint32_t counts[bucketMax] = {};
+  unsigned int histogramBucketi = bucketMax;
+
+  histogramParallelOpt<D, bucketMax>(arr, starti, endi, histogramBucketi, counts, numThreads, [&](auto && histogramChunk) {
+    group.run(histogramChunk);
+  });
+
+  // Special case where all values map to the same bucket, the
+  // next digit can be partitioned by all threads instead.
+
+  if (counts[histogramBucketi] == n) {
+    if constexpr (D > 0) {
+      countingSortInPlaceOptParallelGroup<D-1>(arr, starti, endi, group);
+    }
+    return;
+  }
+
+  // Prefix sum, bucketStarts is fixed while heads is advanced as
+  // each bucket is filled in with values that belong in the bucket.
+  // The misplaced values in each bucket are in the range [heads, tails).
+
+  uint32_t bucketStarts[bucketMax];
+  uint32_t heads[bucketMax];
+  uint32_t tails[bucketMax];
+
+  {
+    unsigned int psum = starti;
+    for (unsigned int bucketi = 0; bucketi < bucketMax; bucketi++) {
+      bucketStarts[bucketi] = psum;
+      heads[bucketi] = psum;
+      psum += counts[bucketi];
+      tails[bucketi] = psum;
+    }
+  }
+
+  // Each round splits the misplaced range of every bucket into one stripe per thread.
+  // The stripe starts are saved in stripeStarts and the stripe heads/tails are advanced
+  // by the speculative permutation.
+
+  std::vector<parallelBucketTable_t> stripeStarts(numThreads);
+  std::vector<parallelBucketTable_t> stripeHeads(numThreads);
+  std::vector<parallelBucketTable_t> stripeTails(numThreads);
+
+  unsigned int numMisplaced = n;
+
+  while (numMisplaced >= parallelSortSerialFinishN) {
+    for (unsigned int threadi = 0; threadi < numThreads; threadi++) {
+      for (unsigned int bucketi = 0; bucketi < bucketMax; bucketi++) {
+        const uint64_t bucketN = tails[bucketi] - heads[bucketi];
+        const unsigned int stripeStarti = heads[bucketi] + (unsigned int) ((bucketN * threadi) / numThreads);
+        const unsigned int stripeEndi = heads[bucketi] + (unsigned int) ((bucketN * (threadi+1)) / numThreads);
+        stripeStarts[threadi].buckets[bucketi] = stripeStarti;
+        stripeHeads[threadi].buckets[bucketi] = stripeStarti;
+        stripeTails[threadi].buckets[bucketi] = stripeEndi;
+      }
+    }
+
+    // Speculative permutation, each thread only reads and writes inside its own
+    // stripes. A value that belongs in a bucket where this thread's stripe is
+    // already full is left in place and is dealt with by the repair step.
+
+    group.run([&](unsigned int threadi) {
+      uint32_t * ph = stripeHeads[threadi].buckets;
+      uint32_t * pt = stripeTails[threadi].buckets;
+
+      for (unsigned int bucketi = 0; bucketi < bucketMax; bucketi++) {
+        for (unsigned int headi = ph[bucketi]; headi < pt[bucketi]; headi++) {
+          uint32_t v = arr[headi];
+          unsigned int digit = extractDigitOpt<D>(v);
+
+          while (digit != bucketi && ph[digit] < pt[digit]) {
+            std::swap(v, arr[ph[digit]++]);
+            digit = extractDigitOpt<D>(v);
+          }
+
+          if (digit == bucketi) {
+            // Placed values are kept packed at the front of the stripe
+            arr[headi] = arr[ph[bucketi]];
+            arr[ph[bucketi]++] = v;
+          } else {
+            arr[headi] = v;
+          }
+        }
+      }
+    });
+
+    // Repair, each stripe now holds placed values in [stripeStart, stripeHead)
+    // and misplaced values in [stripeHead, stripeTail). Swap misplaced values
+    // toward the end of the bucket so that the bucket again contains one
+    // contiguous misplaced range. Buckets are independent of each other.
+
+    std::atomic<unsigned int> nextRepairBucketi(0);
+
+    group.run([&](unsigned int) {
+      for (unsigned int bucketi = nextRepairBucketi++; bucketi < bucketMax; bucketi = nextRepairBucketi++) {
+        unsigned int numPlaced = 0;
+        for (unsigned int threadi = 0; threadi < numThreads; threadi++) {
+          numPlaced += stripeHeads[threadi].buckets[bucketi] - stripeStarts[threadi].buckets[bucketi];
+        }
+
+        const unsigned int newHead = heads[bucketi] + numPlaced;
+
+        // Misplaced cursor walks forward through the stripes, placed cursor walks backward
+
+        int misplacedThreadi = 0;
+        unsigned int misplacedi = stripeHeads[0].buckets[bucketi];
+
+        int placedThreadi = numThreads - 1;
+        unsigned int placedEndi = stripeHeads[numThreads - 1].buckets[bucketi];
+
+        while (true) {
+          while (misplacedThreadi < (int)numThreads && misplacedi == stripeTails[misplacedThreadi].buckets[bucketi]) {
+            misplacedThreadi += 1;
+            if (misplacedThreadi < (int)numThreads) {
+              misplacedi = stripeHeads[misplacedThreadi].buckets[bucketi];
+            }
+          }
+          if (misplacedThreadi == (int)numThreads || misplacedi >= newHead) {
+            break;
+          }
+
+          while (placedThreadi >= 0 && placedEndi == stripeStarts[placedThreadi].buckets[bucketi]) {
+            placedThreadi -= 1;
+            if (placedThreadi >= 0) {
+              placedEndi = stripeHeads[placedThreadi].buckets[bucketi];
+            }
+          }
+#if defined(DEBUG)
+          assert(placedThreadi >= 0);
+          assert(placedEndi > newHead);
+#endif
+
+          placedEndi -= 1;
+          std::swap(arr[misplacedi], arr[placedEndi]);
+          misplacedi += 1;
+        }
+
+        heads[bucketi] = newHead;
+      }
+    });
+
+    unsigned int prevNumMisplaced = numMisplaced;
+
+    numMisplaced = 0;
+    for (unsigned int bucketi = 0; bucketi < bucketMax; bucketi++) {
+      numMisplaced += tails[bucketi] - heads[bucketi];
+    }
+
+    if (debugOut) {
+      std::cout << "PARADIS round misplaced " << prevNumMisplaced << " -> " << numMisplaced << std::endl;
+    }
+
+    if (numMisplaced == prevNumMisplaced) {
+      break;
+    }
+  }
+
+  // Serial finish, swap each remaining misplaced value directly into its bucket
+
+  for (unsigned int bucketi = 0; bucketi < bucketMax; bucketi++) {
+    while (heads[bucketi] < tails[bucketi]) {
+      unsigned int digit = extractDigitOpt<D>(arr[heads[bucketi]]);
+      if (digit == bucketi) {
+        heads[bucketi] += 1;
+      } else {
+        std::iter_swap(&arr[heads[bucketi]], &arr[heads[digit]++]);
+      }
+    }
+  }
+
+#if defined(DEBUG)
+  for (unsigned int bucketi = 0; bucketi < bucketMax; bucketi++) {
+    for (unsigned int i = bucketStarts[bucketi]; i < tails[bucketi]; i++) {
+      assert(extractDigitOpt<D>(arr[i]) == bucketi);
+    }
+  }
+#endif
+
+  // Recursion, every non-empty bucket becomes a task. Buckets are dealt out
+  // round robin, largest first, so that each worker starts with a similar
+  // amount of work. Imbalance from skewed buckets is fixed by work stealing.
+
+  if constexpr (D > 0) {
+    uint8_t bucketOrder[bucketMax];
+    for (unsigned int bucketi = 0; bucketi < bucketMax; bucketi++) {
+      bucketOrder[bucketi] = bucketi;
+    }
+    std::sort(bucketOrder, bucketOrder + bucketMax, [&](uint8_t b0, uint8_t b1) {
+      return counts[b0] > counts[b1];
+    });
+
+    WorkStealingPool pool(numThreads);
+
+    for (unsigned int orderi = 0; orderi < bucketMax; orderi++) {
+      unsigned int bucketi = bucketOrder[orderi];
+      if (counts[bucketi] == 0) {
+        break;
+      }
+      pool.push(orderi % numThreads, { parallelSortBucketTaskOpt<D>, arr, bucketStarts[bucketi], tails[bucketi] });
+    }
+
+    // The calling thread runs tasks as worker 0
+    bool wasEnabled = histogramOptThreadsEnabled();
+    pool.run([&](auto && workerLoop) {
+      group.run(workerLoop);
+    });
+    histogramOptThreadsEnabled() = wasEnabled;
+  }
+}
+
+// Sort arr[starti, endi) with up to numThreads threads, numThreads = 0 means
+// use all hardware threads. numThreads is limited to the number of logical cores,
+// since more threads than cores is slower than the serial sort. D is the top
+// digit 3,2,1,0 for 32 bit inputs.
+
+template <unsigned int D>
+__attribute__((noinline))
+void countingSortInPlaceOptParallel(
+  uint32_t * arr,
+  unsigned int starti,
+  unsigned int endi,
+  unsigned int numThreads = 0)
+{
+  const unsigned int n = endi - starti;
+
+  const unsigned int numCores = hardwareInfo().numLogicalCores;
+  if (numThreads == 0 || numThreads > numCores) {
+    numThreads = numCores;
+  }
+  numThreads = std::min(numThreads, n / parallelSortMinPerThread);
+
+  if (numThreads < 2 || n < parallelSortMinN) {
+    // numThreads = 1 also means no histogram threads
+    bool wasEnabled = histogramOptThreadsEnabled();
+    if (numThreads == 1) {
+      histogramOptThreadsEnabled() = false;
+    }
+    countingSortInPlaceOpt<D>(arr, starti, endi);
+    histogramOptThreadsEnabled() = wasEnabled;
+    return;
+  }
+
+  ParallelThreadGroup group(numThreads);
+
+  countingSortInPlaceOptParallelGroup<D>(arr, starti, endi, group);
+}
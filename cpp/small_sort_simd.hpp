@@ -0,0 +1,254 @@
+// Sorting networks for small buckets of 32 bit values, used by the radix sorts
+// once a bucket holds 128 values or fewer. A bucket of n values is copied into
+// a stack buffer padded with 0xFFFFFFFF up to the next power of 2 (at least 8)
+// and the buffer is sorted with a bitonic network. The network has no data
+// dependent branches, so there are no branch mispredictions as with std::sort.
+//
+// With AVX2 each 8 value vector is sorted in register (sort 8), then pairs of
+// sorted runs are merged as 16, 32, 64 and 128 value bitonic merges. Every merge
+// begins with a "flip" step that compares value i with value (k - 1 - i) in a
+// run of k values, so that all later steps are ascending half cleaners:
+//
+// compare distance >= 8 : min/max between two vectors
+// compare distance 4,2,1 : lane permute, min/max, then blend within one vector
+//
+// The network is selected at runtime, CPUs without AVX2 use std::sort.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#if defined(DEBUG)
+#include <assert.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SMALL_SORT_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+// Largest bucket sorted with a network
+
+constexpr unsigned int smallSortMaxN = 128;
+
+#if defined(SMALL_SORT_SIMD_X86)
+
+// Compare each lane with lane (i ^ D), lanes in the blend mask take the max
+
+template <unsigned int D, int BLEND>
+__attribute__((target("avx2")))
+__attribute__((always_inline))
+static inline
+__m256i smallSortLaneStepAVX2(__m256i v)
+{
+  const __m256i partner = _mm256_setr_epi32(0 ^ D, 1 ^ D, 2 ^ D, 3 ^ D, 4 ^ D, 5 ^ D, 6 ^ D, 7 ^ D);
+  __m256i p = _mm256_permutevar8x32_epi32(v, partner);
+  __m256i mn = _mm256_min_epu32(v, p);
+  __m256i mx = _mm256_max_epu32(v, p);
+  return _mm256_blend_epi32(mn, mx, BLEND);
+}
+
+// Compare each lane with lane (i ^ (K - 1)), the flip step for runs of K <= 8 values
+
+template <unsigned int K, int BLEND>
+__attribute__((target("avx2")))
+__attribute__((always_inline))
+static inline
+__m256i smallSortLaneFlipAVX2(__m256i v)
+{
+  const __m256i partner = _mm256_setr_epi32(0 ^ (K-1), 1 ^ (K-1), 2 ^ (K-1), 3 ^ (K-1),
+                                             4 ^ (K-1), 5 ^ (K-1), 6 ^ (K-1), 7 ^ (K-1));
+  __m256i p = _mm256_permutevar8x32_epi32(v, partner);
+  __m256i mn = _mm256_min_epu32(v, p);
+  __m256i mx = _mm256_max_epu32(v, p);
+  return _mm256_blend_epi32(mn, mx, BLEND);
+}
+
+// Finish a merge once all values are within 8 lanes of the final position
+
+__attribute__((target("avx2")))
+__attribute__((always_inline))
+static inline
+__m256i smallSortCleanAVX2(__m256i v)
+{
+  v = smallSortLaneStepAVX2<4, 0xF0>(v);
+  v = smallSortLaneStepAVX2<2, 0xCC>(v);
+  v = smallSortLaneStepAVX2<1, 0xAA>(v);
+  return v;
+}
+
+__attribute__((target("avx2")))
+__attribute__((always_inline))
+static inline
+__m256i smallSortVectorAVX2(__m256i v)
+{
+  v = smallSortLaneFlipAVX2<2, 0xAA>(v);
+  v = smallSortLaneFlipAVX2<4, 0xCC>(v);
+  v = smallSortLaneStepAVX2<1, 0xAA>(v);
+  v = smallSortLaneFlipAVX2<8, 0xF0>(v);
+  v = smallSortLaneStepAVX2<2, 0xCC>(v);
+  v = smallSortLaneStepAVX2<1, 0xAA>(v);
+  return v;
+}
+
+__attribute__((target("avx2")))
+__attribute__((always_inline))
+static inline
+__m256i smallSortReverseAVX2(__m256i v)
+{
+  return _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+}
+
+// Bitonic sort of N values held in N/8 vectors, N is a power of 2 in [8, 128]
+
+template <unsigned int N>
+__attribute__((target("avx2")))
+__attribute__((always_inline))
+static inline
+void smallSortNetworkAVX2(__m256i * v)
+{
+  constexpr unsigned int numVecs = N / 8;
+
+  for (unsigned int i = 0; i < numVecs; i++) {
+    v[i] = smallSortVectorAVX2(v[i]);
+  }
+
+  // Merge sorted runs of k/2 values into sorted runs of k values
+
+  for (unsigned int kVecs = 2; kVecs <= numVecs; kVecs *= 2) {
+    for (unsigned int runi = 0; runi < numVecs; runi += kVecs) {
+      __m256i * run = v + runi;
+
+      for (unsigned int i = 0; i < kVecs / 2; i++) {
+        __m256i lo = run[i];
+        __m256i hi = smallSortReverseAVX2(run[kVecs - 1 - i]);
+        run[i] = _mm256_min_epu32(lo, hi);
+        run[kVecs - 1 - i] = smallSortReverseAVX2(_mm256_max_epu32(lo, hi));
+      }
+
+      for (unsigned int jVecs = kVecs / 4; jVecs > 0; jVecs /= 2) {
+        for (unsigned int i = 0; i < kVecs; i++) {
+          if ((i & jVecs) == 0) {
+            __m256i lo = run[i];
+            __m256i hi = run[i + jVecs];
+            run[i] = _mm256_min_epu32(lo, hi);
+            run[i + jVecs] = _mm256_max_epu32(lo, hi);
+          }
+        }
+      }
+
+      for (unsigned int i = 0; i < kVecs; i++) {
+        run[i] = smallSortCleanAVX2(run[i]);
+      }
+    }
+  }
+}
+
+template <unsigned int N>
+__attribute__((target("avx2")))
+static inline
+void smallSortPaddedAVX2(uint32_t * buffer)
+{
+  constexpr unsigned int numVecs = N / 8;
+  __m256i v[numVecs];
+
+  for (unsigned int i = 0; i < numVecs; i++) {
+    v[i] = _mm256_load_si256((const __m256i *) &buffer[i * 8]);
+  }
+
+  smallSortNetworkAVX2<N>(v);
+
+  for (unsigned int i = 0; i < numVecs; i++) {
+    _mm256_store_si256((__m256i *) &buffer[i * 8], v[i]);
+  }
+}
+
+__attribute__((target("avx2")))
+__attribute__((noinline))
+static
+void smallSortAVX2(uint32_t * arr, unsigned int n)
+{
+  alignas(32) uint32_t buffer[smallSortMaxN];
+
+  memcpy(buffer, arr, n * sizeof(uint32_t));
+
+  unsigned int paddedN = 8;
+  while (paddedN < n) {
+    paddedN *= 2;
+  }
+
+  for (unsigned int i = n; i < paddedN; i++) {
+    buffer[i] = 0xFFFFFFFF;
+  }
+
+  switch (paddedN) {
+    case 8: {
+      smallSortPaddedAVX2<8>(buffer);
+      break;
+    }
+    case 16: {
+      smallSortPaddedAVX2<16>(buffer);
+      break;
+    }
+    case 32: {
+      smallSortPaddedAVX2<32>(buffer);
+      break;
+    }
+    case 64: {
+      smallSortPaddedAVX2<64>(buffer);
+      break;
+    }
+    default: {
+      smallSortPaddedAVX2<128>(buffer);
+      break;
+    }
+  }
+
+  memcpy(arr, buffer, n * sizeof(uint32_t));
+}
+
+#endif // SMALL_SORT_SIMD_X86
+
+static inline
+bool smallSortHasSimd()
+{
+#if defined(SMALL_SORT_SIMD_X86)
+  static const bool hasSimd = []() {
+    __builtin_cpu_init();
+    return (bool) __builtin_cpu_supports("avx2");
+  }();
+  return hasSimd;
+#else
+  return false;
+#endif // SMALL_SORT_SIMD_X86
+}
+
+// Sort arr[starti, endi) where (endi - starti) <= smallSortMaxN
+
+static inline
+void smallSortOpt(uint32_t * arr, unsigned int starti, unsigned int endi)
+{
+#if defined(DEBUG)
+  assert((endi - starti) <= smallSortMaxN);
+#endif
+
+#if defined(SMALL_SORT_SIMD_X86)
+  if (smallSortHasSimd()) {
+    smallSortAVX2(arr + starti, endi - starti);
+    return;
+  }
+#endif // SMALL_SORT_SIMD_X86
+
+  std::sort(arr+starti, arr+endi);
+}
+
+// Other key types have no network since AVX2 lacks unsigned 64 bit min/max
+
+template <typename T>
+static inline
+void smallSortOpt(T * arr, unsigned int starti, unsigned int endi)
+{
+  std::sort(arr+starti, arr+endi);
+}
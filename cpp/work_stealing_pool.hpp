@@ -0,0 +1,232 @@
+// Work-stealing task runtime used by the parallel radix sort. Each worker owns a
+// Chase-Lev deque, the owner pushes and pops tasks at the bottom (LIFO, so the
+// most recently split bucket is processed while it is still in cache) while idle
+// workers steal the oldest task from the top of another worker's deque. There is
+// no global lock, the only shared state is the count of pending tasks.
+//
+// See "Dynamic Circular Work-Stealing Deque" (Chase, Lev) SPAA 2005 and
+// "Correct and Efficient Work-Stealing for Weak Memory Models" (Le, Pop, Cohen,
+// Zappa Nardelli) PPoPP 2013 for the memory ordering used here.
+
+#pragma once
+
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+
+#if defined(DEBUG)
+#include <assert.h>
+#endif
+
+class WorkStealingPool;
+
+// A task is a function pointer plus a context pointer and a [starti, endi) range.
+// Tasks are copied by value into and out of the deques.
+
+typedef struct {
+  void (*fn)(WorkStealingPool & pool, unsigned int workeri, void * ctx, unsigned int starti, unsigned int endi);
+  void * ctx;
+  unsigned int starti;
+  unsigned int endi;
+} workStealingTask_t;
+
+// Fixed capacity Chase-Lev deque. A push onto a full deque fails and the caller
+// is expected to execute the task inline. Each slot field is an atomic so that a
+// thief reading a slot that the owner is concurrently reusing is not a data race,
+// the result of such a read is discarded when the CAS on top fails.
+
+class alignas(64) WorkStealingDeque {
+public:
+  static constexpr int64_t capacity = 1 << 12;
+  static constexpr int64_t mask = capacity - 1;
+
+  // Push onto the bottom, owner thread only
+
+  bool push(const workStealingTask_t & task) {
+    int64_t b = bottom.load(std::memory_order_relaxed);
+    int64_t t = top.load(std::memory_order_acquire);
+    if ((b - t) >= capacity) {
+      return false;
+    }
+    storeSlot(b, task);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom.store(b + 1, std::memory_order_relaxed);
+    return true;
+  }
+
+  // Pop from the bottom, owner thread only
+
+  bool pop(workStealingTask_t & task) {
+    int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top.load(std::memory_order_relaxed);
+
+    if (t > b) {
+      // Empty
+      bottom.store(b + 1, std::memory_order_relaxed);
+      return false;
+    }
+
+    loadSlot(b, task);
+
+    if (t == b) {
+      // Last task, race against thieves for it
+      bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+      bottom.store(b + 1, std::memory_order_relaxed);
+      return won;
+    }
+
+    return true;
+  }
+
+  // Steal from the top, any thread
+
+  bool steal(workStealingTask_t & task) {
+    int64_t t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = bottom.load(std::memory_order_acquire);
+
+    if (t >= b) {
+      return false;
+    }
+
+    loadSlot(t, task);
+
+    return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+  }
+
+private:
+  typedef struct {
+    std::atomic<decltype(workStealingTask_t::fn)> fn;
+    std::atomic<void *> ctx;
+    std::atomic<unsigned int> starti;
+    std::atomic<unsigned int> endi;
+  } slot_t;
+
+  void storeSlot(int64_t i, const workStealingTask_t & task) {
+    slot_t & slot = slots[i & mask];
+    slot.fn.store(task.fn, std::memory_order_relaxed);
+    slot.ctx.store(task.ctx, std::memory_order_relaxed);
+    slot.starti.store(task.starti, std::memory_order_relaxed);
+    slot.endi.store(task.endi, std::memory_order_relaxed);
+  }
+
+  void loadSlot(int64_t i, workStealingTask_t & task) {
+    slot_t & slot = slots[i & mask];
+    task.fn = slot.fn.load(std::memory_order_relaxed);
+    task.ctx = slot.ctx.load(std::memory_order_relaxed);
+    task.starti = slot.starti.load(std::memory_order_relaxed);
+    task.endi = slot.endi.load(std::memory_order_relaxed);
+  }
+
+  alignas(64) std::atomic<int64_t> top{0};
+  alignas(64) std::atomic<int64_t> bottom{0};
+  alignas(64) slot_t slots[capacity];
+};
+
+// Pool of numWorkers workers, the thread that invokes run() acts as worker 0.
+// Seed the pool with push(workeri, task) before run(), tasks may push more
+// tasks onto their own worker deque. run() returns when all tasks are done.
+
+class WorkStealingPool {
+public:
+  explicit WorkStealingPool(unsigned int numWorkers)
+  : numWorkers(numWorkers == 0 ? 1 : numWorkers),
+    deques(new WorkStealingDeque[numWorkers == 0 ? 1 : numWorkers])
+  {
+  }
+
+  unsigned int size() const {
+    return numWorkers;
+  }
+
+  // Push a task onto the deque for workeri. When invoked from inside a task,
+  // workeri must be the worker that is executing the task. If the deque is
+  // full the task is executed immediately on the calling thread.
+
+  void push(unsigned int workeri, const workStealingTask_t & task) {
+#if defined(DEBUG)
+    assert(workeri < numWorkers);
+#endif
+    numPending.fetch_add(1, std::memory_order_relaxed);
+    if (!deques[workeri].push(task)) {
+      execute(workeri, task);
+    }
+  }
+
+  void run() {
+    std::vector<std::thread> threads;
+    threads.reserve(numWorkers - 1);
+
+    for (unsigned int workeri = 1; workeri < numWorkers; workeri++) {
+      threads.emplace_back([this, workeri]() {
+        workerLoop(workeri);
+      });
+    }
+
+    workerLoop(0);
+
+    for (auto & thread : threads) {
+      thread.join();
+    }
+  }
+
+  // Same as run() on threads the caller already owns, parallelFor(fn) must invoke
+  // fn(workeri) for each workeri in [0, size()) and return once all have finished.
+
+  template <typename F>
+  void run(F && parallelFor) {
+    parallelFor([this](unsigned int workeri) {
+      workerLoop(workeri);
+    });
+  }
+
+private:
+  void execute(unsigned int workeri, const workStealingTask_t & task) {
+    task.fn(*this, workeri, task.ctx, task.starti, task.endi);
+    numPending.fetch_sub(1, std::memory_order_acq_rel);
+  }
+
+  void workerLoop(unsigned int workeri) {
+    // xorshift state for picking a victim, seeded per worker
+    uint32_t victimState = 0x9E3779B9u * (workeri + 1);
+
+    workStealingTask_t task;
+
+    while (true) {
+      if (deques[workeri].pop(task)) {
+        execute(workeri, task);
+        continue;
+      }
+
+      if (numPending.load(std::memory_order_acquire) == 0) {
+        return;
+      }
+
+      bool stolen = false;
+
+      for (unsigned int attempt = 0; attempt < numWorkers && !stolen; attempt++) {
+        victimState ^= victimState << 13;
+        victimState ^= victimState >> 17;
+        victimState ^= victimState << 5;
+        unsigned int victimi = victimState % numWorkers;
+        if (victimi != workeri) {
+          stolen = deques[victimi].steal(task);
+        }
+      }
+
+      if (stolen) {
+        execute(workeri, task);
+      } else {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  const unsigned int numWorkers;
+  std::unique_ptr<WorkStealingDeque[]> deques;
+  alignas(64) std::atomic<uint64_t> numPending{0};
+};